@@ -24,6 +24,7 @@
 
 #include "uni_mp3_player.h"
 #include "uni_log.h"
+#include <string.h>
 #include <unistd.h>
 
 #define MAIN_TAG   "main"
@@ -31,6 +32,7 @@
 int main(int argc, char *argv[]) {
   AudioParam param;
   int count = 0;
+  memset(&param, 0, sizeof(param));
   param.channels = 1;
   param.rate = 16000;
   param.bit = 16;
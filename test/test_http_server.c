@@ -0,0 +1,340 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_http_server.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#include "test_http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_HTTP_CONN_MAX   (32)
+#define TEST_HTTP_HEADER_LEN (4096)
+#define TEST_HTTP_SEND_LEN   (1024)
+
+struct TestHttpServer {
+  TestHttpConfig  config;
+  int             listen_fd;
+  int             port;
+  int             stopping;
+  pthread_t       accept_thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             fds[TEST_HTTP_CONN_MAX];
+  int             active;
+  int             max_active;
+  int             accepts;
+  int             dropped;
+  int             requests;
+  int64_t         starts[TEST_HTTP_LOG_MAX];
+};
+
+typedef struct {
+  TestHttpServer *server;
+  int            fd;
+  int            slot;
+} ConnArg;
+
+uint8_t TestHttpByte(int64_t pos) {
+  return (uint8_t)((pos * 131) ^ (pos >> 8));
+}
+
+static int _send_all(int fd, const void *buf, int len) {
+  const char *p = (const char *)buf;
+  int ret;
+  while (0 < len) {
+    if ((ret = send(fd, p, len, MSG_NOSIGNAL)) <= 0) {
+      return -1;
+    }
+    p += ret;
+    len -= ret;
+  }
+  return 0;
+}
+
+/* request head into buf, 0 when peer closed */
+static int _recv_head(int fd, char *buf, int len) {
+  int got = 0, ret;
+  while (got < len - 1) {
+    if ((ret = recv(fd, buf + got, len - 1 - got, 0)) <= 0) {
+      return 0;
+    }
+    got += ret;
+    buf[got] = '\0';
+    if (NULL != strstr(buf, "\r\n\r\n")) {
+      return got;
+    }
+  }
+  return 0;
+}
+
+static void _parse_range(const char *head, int64_t size, int64_t *start,
+                         int64_t *end) {
+  const char *p = strstr(head, "\r\nRange: bytes=");
+  *start = -1;
+  *end = size - 1;
+  if (NULL == p) {
+    return;
+  }
+  p += strlen("\r\nRange: bytes=");
+  *start = strtoll(p, (char **)&p, 10);
+  if ('-' == *p && '0' <= p[1] && p[1] <= '9') {
+    *end = strtoll(p + 1, NULL, 10);
+  }
+  if (*end >= size) {
+    *end = size - 1;
+  }
+}
+
+/* whether this response is the one cut short */
+static int _take_drop(TestHttpServer *server) {
+  int drop;
+  pthread_mutex_lock(&server->mutex);
+  drop = (0 < server->config.drop_after && !server->dropped);
+  server->dropped |= drop;
+  pthread_mutex_unlock(&server->mutex);
+  return drop;
+}
+
+/* drop_at fires on the first response really sent up to it */
+static int _take_drop_at(TestHttpServer *server) {
+  int drop;
+  pthread_mutex_lock(&server->mutex);
+  drop = !server->dropped;
+  server->dropped = 1;
+  pthread_mutex_unlock(&server->mutex);
+  return drop;
+}
+
+static int _send_body(TestHttpServer *server, int fd, int64_t start,
+                      int64_t end, int drop) {
+  uint8_t buf[TEST_HTTP_SEND_LEN];
+  struct timespec ts;
+  int64_t pos = start, stop = end + 1, cut = -1;
+  int n, i;
+  if (drop) {
+    stop = start + server->config.drop_after < stop ?
+           start + server->config.drop_after : stop;
+  }
+  if (0 < server->config.drop_at && start < server->config.drop_at &&
+      server->config.drop_at < stop) {
+    cut = server->config.drop_at;
+  }
+  while (pos < stop) {
+    n = stop - pos < TEST_HTTP_SEND_LEN ? stop - pos : TEST_HTTP_SEND_LEN;
+    if (pos < cut && cut < pos + n) {
+      n = cut - pos;
+    }
+    for (i = 0; i < n; i++) {
+      buf[i] = server->config.body[pos + i];
+    }
+    if (0 != _send_all(fd, buf, n)) {
+      return -1;
+    }
+    pos += n;
+    if (pos == cut && _take_drop_at(server)) {
+      return -1;
+    }
+    if (0 < server->config.rate_kbps) {
+      ts.tv_sec = 0;
+      ts.tv_nsec = (long)n * 8 * 1000000 / server->config.rate_kbps;
+      nanosleep(&ts, NULL);
+    }
+  }
+  return drop ? -1 : 0;
+}
+
+static void* _conn_tsk(void *arg) {
+  ConnArg *conn = (ConnArg *)arg;
+  TestHttpServer *server = conn->server;
+  char head[TEST_HTTP_HEADER_LEN], resp[512];
+  int64_t size = server->config.size, start, end;
+  int len;
+  while (_recv_head(conn->fd, head, sizeof(head))) {
+    _parse_range(head, size, &start, &end);
+    if (server->config.ignore_range || start < 0) {
+      start = 0;
+      end = size - 1;
+      len = snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\n"
+                     "Content-Length: %lld\r\nAccept-Ranges: %s\r\n\r\n",
+                     (long long)size,
+                     server->config.ignore_range ? "none" : "bytes");
+    } else if (start >= size) {
+      len = snprintf(resp, sizeof(resp), "HTTP/1.1 416 Range Not "
+                     "Satisfiable\r\nContent-Range: bytes */%lld\r\n"
+                     "Content-Length: 0\r\n\r\n", (long long)size);
+      start = 0;
+      end = -1;
+    } else {
+      len = snprintf(resp, sizeof(resp), "HTTP/1.1 206 Partial Content\r\n"
+                     "Content-Range: bytes %lld-%lld/%lld\r\n"
+                     "Content-Length: %lld\r\n\r\n", (long long)start,
+                     (long long)end, (long long)size,
+                     (long long)(end - start + 1));
+    }
+    pthread_mutex_lock(&server->mutex);
+    if (server->requests < TEST_HTTP_LOG_MAX) {
+      server->starts[server->requests] = start;
+    }
+    server->requests++;
+    pthread_mutex_unlock(&server->mutex);
+    if (0 != _send_all(conn->fd, resp, len) ||
+        0 != _send_body(server, conn->fd, start, end, _take_drop(server))) {
+      break;
+    }
+  }
+  pthread_mutex_lock(&server->mutex);
+  close(conn->fd);
+  server->fds[conn->slot] = -1;
+  server->active--;
+  pthread_cond_broadcast(&server->cond);
+  pthread_mutex_unlock(&server->mutex);
+  free(conn);
+  return NULL;
+}
+
+static void* _accept_tsk(void *arg) {
+  TestHttpServer *server = (TestHttpServer *)arg;
+  pthread_t thread;
+  ConnArg *conn;
+  int fd, slot;
+  while (0 <= (fd = accept(server->listen_fd, NULL, NULL))) {
+    pthread_mutex_lock(&server->mutex);
+    for (slot = 0; slot < TEST_HTTP_CONN_MAX; slot++) {
+      if (server->fds[slot] < 0) {
+        break;
+      }
+    }
+    if (server->stopping || TEST_HTTP_CONN_MAX == slot ||
+        NULL == (conn = malloc(sizeof(ConnArg)))) {
+      pthread_mutex_unlock(&server->mutex);
+      close(fd);
+      continue;
+    }
+    server->fds[slot] = fd;
+    server->active++;
+    server->max_active = server->active > server->max_active ?
+                         server->active : server->max_active;
+    server->accepts++;
+    pthread_mutex_unlock(&server->mutex);
+    conn->server = server;
+    conn->fd = fd;
+    conn->slot = slot;
+    pthread_create(&thread, NULL, _conn_tsk, conn);
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+TestHttpServer* TestHttpServerStart(const TestHttpConfig *config) {
+  TestHttpServer *server;
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int i;
+  if (NULL == (server = calloc(1, sizeof(TestHttpServer)))) {
+    return NULL;
+  }
+  server->config = *config;
+  for (i = 0; i < TEST_HTTP_CONN_MAX; i++) {
+    server->fds[i] = -1;
+  }
+  pthread_mutex_init(&server->mutex, NULL);
+  pthread_cond_init(&server->cond, NULL);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((server->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      0 != bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      0 != listen(server->listen_fd, 16) ||
+      0 != getsockname(server->listen_fd, (struct sockaddr *)&addr, &len)) {
+    perror("test http server");
+    close(server->listen_fd);
+    free(server);
+    return NULL;
+  }
+  server->port = ntohs(addr.sin_port);
+  pthread_create(&server->accept_thread, NULL, _accept_tsk, server);
+  return server;
+}
+
+void TestHttpServerStop(TestHttpServer *server) {
+  int i;
+  if (NULL == server) {
+    return;
+  }
+  pthread_mutex_lock(&server->mutex);
+  server->stopping = 1;
+  for (i = 0; i < TEST_HTTP_CONN_MAX; i++) {
+    if (0 <= server->fds[i]) {
+      shutdown(server->fds[i], SHUT_RDWR);
+    }
+  }
+  pthread_mutex_unlock(&server->mutex);
+  shutdown(server->listen_fd, SHUT_RDWR);
+  pthread_join(server->accept_thread, NULL);
+  close(server->listen_fd);
+  pthread_mutex_lock(&server->mutex);
+  while (0 < server->active) {
+    pthread_cond_wait(&server->cond, &server->mutex);
+  }
+  pthread_mutex_unlock(&server->mutex);
+  pthread_mutex_destroy(&server->mutex);
+  pthread_cond_destroy(&server->cond);
+  free(server);
+}
+
+int TestHttpServerPort(TestHttpServer *server) {
+  return server->port;
+}
+
+int TestHttpServerAccepts(TestHttpServer *server) {
+  int accepts;
+  pthread_mutex_lock(&server->mutex);
+  accepts = server->accepts;
+  pthread_mutex_unlock(&server->mutex);
+  return accepts;
+}
+
+int TestHttpServerMaxActive(TestHttpServer *server) {
+  int max_active;
+  pthread_mutex_lock(&server->mutex);
+  max_active = server->max_active;
+  pthread_mutex_unlock(&server->mutex);
+  return max_active;
+}
+
+int TestHttpServerRequests(TestHttpServer *server, int64_t *starts, int max) {
+  int requests, i;
+  pthread_mutex_lock(&server->mutex);
+  requests = server->requests;
+  for (i = 0; i < max && i < requests && i < TEST_HTTP_LOG_MAX; i++) {
+    starts[i] = server->starts[i];
+  }
+  pthread_mutex_unlock(&server->mutex);
+  return requests;
+}
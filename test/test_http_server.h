@@ -0,0 +1,70 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_http_server.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#ifndef TEST_INC_TEST_HTTP_SERVER_H_
+#define TEST_INC_TEST_HTTP_SERVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TEST_HTTP_LOG_MAX    (256)
+
+typedef struct TestHttpServer TestHttpServer;
+
+typedef struct {
+  const uint8_t *body;
+  int           size;
+  int           ignore_range;  /* answer 200 with whole body to Range */
+  int           drop_after;    /* once, close mid body after so many bytes */
+  int           rate_kbps;     /* throttle body, 0 unlimited */
+  int           drop_at;       /* once, close on reaching this body byte */
+} TestHttpConfig;
+
+/* keep-alive GET server on 127.0.0.1, one thread per connection */
+TestHttpServer* TestHttpServerStart(const TestHttpConfig *config);
+void            TestHttpServerStop(TestHttpServer *server);
+int             TestHttpServerPort(TestHttpServer *server);
+int             TestHttpServerAccepts(TestHttpServer *server);
+/* most connections open at once */
+int             TestHttpServerMaxActive(TestHttpServer *server);
+/* requests served so far, starts[] holds their first body byte */
+int             TestHttpServerRequests(TestHttpServer *server,
+                                       int64_t *starts, int max);
+/* deterministic body byte at pos, tests compare against it */
+uint8_t         TestHttpByte(int64_t pos);
+
+#define TEST_CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+    return -1; \
+  } \
+} while (0)
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* TEST_INC_TEST_HTTP_SERVER_H_ */
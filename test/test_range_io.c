@@ -0,0 +1,129 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_range_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#include "test_http_server.h"
+#include "uni_net_session.h"
+#include "uni_range_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BODY_SIZE            (1024 * 1024 + 777)
+#define CHUNK_SIZE           (64 * 1024)
+#define READ_SIZE            (10000)
+
+static uint8_t g_body[BODY_SIZE];
+
+static int _read_check(AVIOContext *avio, int64_t pos, int len) {
+  static uint8_t buf[READ_SIZE];
+  int ret, i;
+  TEST_CHECK(len <= READ_SIZE);
+  TEST_CHECK(pos == avio_seek(avio, pos, SEEK_SET));
+  ret = avio_read(avio, buf, len);
+  TEST_CHECK(ret == (pos + len > BODY_SIZE ? BODY_SIZE - pos : len));
+  for (i = 0; i < ret; i++) {
+    TEST_CHECK(TestHttpByte(pos + i) == buf[i]);
+  }
+  return 0;
+}
+
+static int _test_sequential(TestHttpServer *server, const char *url) {
+  static uint8_t buf[READ_SIZE];
+  RangeIo *io;
+  AVIOContext *avio;
+  int64_t pos = 0, starts[TEST_HTTP_LOG_MAX];
+  int ret, i, n;
+  TEST_CHECK(NULL != (io = RangeIoCreate(url, 4, CHUNK_SIZE,
+                                         8 * CHUNK_SIZE)));
+  avio = RangeIoGetAVIO(io);
+  TEST_CHECK(BODY_SIZE == avio_size(avio));
+  while (0 < (ret = avio_read(avio, buf, sizeof(buf)))) {
+    for (i = 0; i < ret; i++) {
+      TEST_CHECK(TestHttpByte(pos + i) == buf[i]);
+    }
+    pos += ret;
+  }
+  TEST_CHECK(BODY_SIZE == pos);
+  RangeIoDestroy(io);
+  /* throttled server makes the slots overlap */
+  TEST_CHECK(2 <= TestHttpServerMaxActive(server));
+  n = TestHttpServerRequests(server, starts, TEST_HTTP_LOG_MAX);
+  for (i = 0; i < n && i < TEST_HTTP_LOG_MAX; i++) {
+    TEST_CHECK(0 == starts[i] % CHUNK_SIZE);
+  }
+  return 0;
+}
+
+static int _test_seek(const char *url) {
+  static const int64_t seeks[] = {
+    500000, 10, 1000000, 1024 * 1024, BODY_SIZE - 100, 65535, 3 * CHUNK_SIZE,
+    200000, 900000, 0
+  };
+  RangeIo *io;
+  AVIOContext *avio;
+  int i;
+  TEST_CHECK(NULL != (io = RangeIoCreate(url, 3, CHUNK_SIZE,
+                                         4 * CHUNK_SIZE)));
+  avio = RangeIoGetAVIO(io);
+  for (i = 0; i < (int)(sizeof(seeks) / sizeof(seeks[0])); i++) {
+    TEST_CHECK(0 == _read_check(avio, seeks[i], READ_SIZE));
+  }
+  RangeIoDestroy(io);
+  return 0;
+}
+
+static int _test_no_range(void) {
+  TestHttpConfig config = {g_body, BODY_SIZE, 1, 0, 0};
+  TestHttpServer *server;
+  char url[64];
+  TEST_CHECK(NULL != (server = TestHttpServerStart(&config)));
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/a.mp3",
+           TestHttpServerPort(server));
+  TEST_CHECK(NULL == RangeIoCreate(url, 4, CHUNK_SIZE, 8 * CHUNK_SIZE));
+  TestHttpServerStop(server);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  TestHttpConfig config = {g_body, BODY_SIZE, 0, 0, 40000};
+  TestHttpServer *server;
+  char url[64];
+  int i, ret = 0;
+  for (i = 0; i < BODY_SIZE; i++) {
+    g_body[i] = TestHttpByte(i);
+  }
+  NetSessionInit();
+  if (NULL == (server = TestHttpServerStart(&config))) {
+    printf("test_range_io FAIL server\n");
+    return 1;
+  }
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/a.mp3",
+           TestHttpServerPort(server));
+  ret |= _test_sequential(server, url);
+  ret |= _test_seek(url);
+  TestHttpServerStop(server);
+  ret |= _test_no_range();
+  NetSessionFinal();
+  printf("test_range_io %s\n", 0 == ret ? "pass" : "FAIL");
+  return 0 == ret ? 0 : 1;
+}
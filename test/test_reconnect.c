@@ -0,0 +1,121 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_reconnect.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#include "test_http_server.h"
+#include "uni_mp3_player.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* mpeg-1 layer III, 128kbps 48kHz mono, no padding, zero side info */
+#define FRAME_SIZE           (384)
+#define FRAME_SAMPLES        (1152)
+#define FRAME_COUNT          (400)
+#define BODY_SIZE            (FRAME_SIZE * FRAME_COUNT)
+/* mid frame, resume must restart at the frame the demuxer did not finish */
+#define DROP_AT              (FRAME_SIZE * 250 + 100)
+#define WAIT_MS              (20 * 1000)
+
+extern int retrieve_done;
+
+static uint8_t g_body[BODY_SIZE];
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int64_t g_pcm_bytes;
+
+static int _pcm_cb(void *opaque, const char *buf, int len) {
+  pthread_mutex_lock(&g_mutex);
+  g_pcm_bytes += len;
+  pthread_mutex_unlock(&g_mutex);
+  return len;
+}
+
+static void _silent_frames(void) {
+  static const uint8_t header[4] = {0xFF, 0xFB, 0x94, 0xC0};
+  int i;
+  memset(g_body, 0, sizeof(g_body));
+  for (i = 0; i < FRAME_COUNT; i++) {
+    memcpy(g_body + i * FRAME_SIZE, header, sizeof(header));
+  }
+}
+
+static int _test_reconnect(TestHttpServer *server, const char *url) {
+  ReconnectParam reconnect = {3, 20, 100};
+  int64_t starts[TEST_HTTP_LOG_MAX], pcm_bytes;
+  int waited, resumed = 0, i, n;
+  TEST_CHECK(0 == Mp3SetReconnectParam(&reconnect));
+  retrieve_done = 0;
+  TEST_CHECK(0 == Mp3Play((char *)url));
+  for (waited = 0; !retrieve_done && waited < WAIT_MS; waited += 10) {
+    usleep(1000 * 10);
+  }
+  Mp3Stop();
+  TEST_CHECK(retrieve_done);
+  pthread_mutex_lock(&g_mutex);
+  pcm_bytes = g_pcm_bytes;
+  pthread_mutex_unlock(&g_mutex);
+  /* a frame lost or played twice around the cut changes the count */
+  TEST_CHECK((int64_t)FRAME_COUNT * FRAME_SAMPLES * 2 == pcm_bytes);
+  n = TestHttpServerRequests(server, starts, TEST_HTTP_LOG_MAX);
+  for (i = 0; i < n && i < TEST_HTTP_LOG_MAX; i++) {
+    /* Range resume in the cut body, not a restart from byte 0 */
+    resumed |= (0 < starts[i] && starts[i] <= DROP_AT);
+  }
+  TEST_CHECK(resumed);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  /* throttled so the cut lands while the demuxer reads that response */
+  TestHttpConfig config = {g_body, BODY_SIZE, 0, 0, 2000, DROP_AT};
+  AudioParam param;
+  TestHttpServer *server;
+  AudioSink *sink;
+  char url[64];
+  int ret;
+  _silent_frames();
+  memset(&param, 0, sizeof(param));
+  param.channels = 1;
+  param.rate = 48000;
+  param.bit = 16;
+  if (0 != Mp3Init(&param) ||
+      NULL == (sink = AudioSinkCallbackCreate(_pcm_cb, NULL))) {
+    printf("test_reconnect FAIL init\n");
+    return 1;
+  }
+  Mp3SetSink(sink);
+  if (NULL == (server = TestHttpServerStart(&config))) {
+    printf("test_reconnect FAIL server\n");
+    return 1;
+  }
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/silence.mp3",
+           TestHttpServerPort(server));
+  ret = _test_reconnect(server, url);
+  TestHttpServerStop(server);
+  Mp3SetSink(NULL);
+  AudioSinkDestroy(sink);
+  Mp3Final();
+  printf("test_reconnect %s\n", 0 == ret ? "pass" : "FAIL");
+  return 0 == ret ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_shared_fetch.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#include "test_http_server.h"
+#include "uni_net_session.h"
+#include "uni_shared_fetch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BODY_SIZE            (2 * 1024 * 1024)
+#define WRITER_READ          (300 * 1024)
+#define READ_SIZE            (32 * 1024)
+
+#define CHILD_CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d %d check failed: %s\n", __FILE__, __LINE__, \
+            (int)getpid(), #cond); \
+    _exit(1); \
+  } \
+} while (0)
+
+static uint8_t g_body[BODY_SIZE];
+
+static void _read_check(AVIOContext *avio, int64_t *pos, int64_t len) {
+  static uint8_t buf[READ_SIZE];
+  int ret, i;
+  while (0 < len && 0 < (ret = avio_read(avio, buf,
+                                         len < READ_SIZE ? len : READ_SIZE))) {
+    for (i = 0; i < ret; i++) {
+      CHILD_CHECK(TestHttpByte(*pos + i) == buf[i]);
+    }
+    *pos += ret;
+    len -= ret;
+  }
+}
+
+/* downloads, then dies without closing, as a crashed player would */
+static void _writer(const char *url, const char *dir, int ready_fd,
+                    int attached_fd) {
+  SharedFetch *sf;
+  int64_t pos = 0;
+  char c = 0;
+  NetSessionInit();
+  CHILD_CHECK(NULL != (sf = SharedFetchOpen(url, dir)));
+  _read_check(SharedFetchGetAVIO(sf), &pos, WRITER_READ);
+  CHILD_CHECK(WRITER_READ == pos);
+  CHILD_CHECK(1 == write(ready_fd, &c, 1));
+  CHILD_CHECK(1 == read(attached_fd, &c, 1));
+  _exit(0);
+}
+
+/* attaches to the running download and must take it over */
+static void _reader(const char *url, const char *dir, int ready_fd,
+                    int attached_fd) {
+  SharedFetch *sf;
+  int64_t pos = 0;
+  char c = 0;
+  NetSessionInit();
+  CHILD_CHECK(1 == read(ready_fd, &c, 1));
+  CHILD_CHECK(NULL != (sf = SharedFetchOpen(url, dir)));
+  CHILD_CHECK(1 == write(attached_fd, &c, 1));
+  _read_check(SharedFetchGetAVIO(sf), &pos, BODY_SIZE + 1);
+  CHILD_CHECK(BODY_SIZE == pos);
+  SharedFetchClose(sf);
+  NetSessionFinal();
+  _exit(0);
+}
+
+static int _wait_ok(pid_t pid) {
+  int status;
+  return pid > 0 && pid == waitpid(pid, &status, 0) && WIFEXITED(status) &&
+         0 == WEXITSTATUS(status);
+}
+
+static int _test_takeover(void) {
+  /* throttled so writer dies long before the download ends */
+  TestHttpConfig config = {g_body, BODY_SIZE, 0, 0, 8000};
+  TestHttpServer *server;
+  char url[64], dir[] = "/tmp/test_shared_fetch_XXXXXX", cmd[64];
+  int64_t starts[TEST_HTTP_LOG_MAX];
+  int ready[2], attached[2], n, i, resumed = 0;
+  pid_t writer, reader;
+  TEST_CHECK(NULL != mkdtemp(dir));
+  TEST_CHECK(0 == pipe(ready) && 0 == pipe(attached));
+  TEST_CHECK(NULL != (server = TestHttpServerStart(&config)));
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/a.mp3",
+           TestHttpServerPort(server));
+  if (0 == (writer = fork())) {
+    _writer(url, dir, ready[1], attached[0]);
+  }
+  if (0 == (reader = fork())) {
+    _reader(url, dir, ready[0], attached[1]);
+  }
+  TEST_CHECK(_wait_ok(writer));
+  TEST_CHECK(_wait_ok(reader));
+  n = TestHttpServerRequests(server, starts, TEST_HTTP_LOG_MAX);
+  for (i = 0; i < n && i < TEST_HTTP_LOG_MAX; i++) {
+    resumed |= (WRITER_READ <= starts[i]);
+  }
+  /* one download from 0, one Range resume by the reader, nothing more */
+  TEST_CHECK(2 == n && 0 == starts[0] && resumed);
+  TestHttpServerStop(server);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  TEST_CHECK(0 == system(cmd));
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i, ret;
+  for (i = 0; i < BODY_SIZE; i++) {
+    g_body[i] = TestHttpByte(i);
+  }
+  /* a failed child leaves the other blocked, do not hang the suite */
+  alarm(60);
+  ret = _test_takeover();
+  printf("test_shared_fetch %s\n", 0 == ret ? "pass" : "FAIL");
+  return 0 == ret ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : test_shm_ring.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.05
+ *
+ **************************************************************************/
+#include "uni_shm_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_CAPACITY        (16 * 1024)
+#define STREAM_BYTES         (4 * 1024 * 1024)
+#define WRITE_BYTES          (7000)
+
+#define CHILD_CHECK(cond) do { \
+  if (!(cond)) { \
+    fprintf(stderr, "%s:%d reader check failed: %s\n", __FILE__, __LINE__, \
+            #cond); \
+    _exit(1); \
+  } \
+} while (0)
+
+static uint8_t _byte(uint64_t pos) {
+  return (uint8_t)((pos * 167) ^ (pos >> 11));
+}
+
+static int64_t _now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* companion process, stands in for the audio daemon */
+static void _reader(int fd) {
+  ShmRing *ring;
+  SinkFormat format;
+  const uint8_t *data;
+  uint64_t pos = 0, batch;
+  int64_t ns, last_ns = 0;
+  int n, i, take, wraps = 0;
+  CHILD_CHECK(NULL != (ring = ShmRingAttach(fd)));
+  while (0 != (n = ShmRingPeek(ring, &data, 5000))) {
+    if (n < 0) {
+      break;
+    }
+    CHILD_CHECK(0 == ShmRingGetFormat(ring, &format));
+    CHILD_CHECK(48000 == format.rate && 2 == format.channels &&
+                16 == format.bit);
+    /* readable span crosses wrap in place thanks to double mapping */
+    for (i = 0; i < n; i++) {
+      CHILD_CHECK(_byte(pos + i) == data[i]);
+    }
+    wraps += (pos % RING_CAPACITY + n > RING_CAPACITY);
+    /* every batch start is stamped when producer wrote it */
+    batch = (pos + WRITE_BYTES - 1) / WRITE_BYTES * WRITE_BYTES;
+    if (batch < pos + n) {
+      ns = ShmRingTimestamp(ring, batch);
+      CHILD_CHECK(0 < ns && ns <= _now_ns() && last_ns <= ns);
+      last_ns = ns;
+    }
+    take = n > 5000 ? 5000 : n;
+    CHILD_CHECK(0 == ShmRingRelease(ring, take));
+    pos += take;
+  }
+  /* -1 only after producer closed and ring drained */
+  CHILD_CHECK(n < 0);
+  CHILD_CHECK(STREAM_BYTES == pos);
+  CHILD_CHECK(0 < wraps);
+  ShmRingDestroy(ring);
+  _exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  static uint8_t buf[WRITE_BYTES];
+  SinkFormat format = {48000, 2, 16, 0, 0};
+  struct iovec iov[2];
+  ShmRing *ring;
+  AudioSink *sink;
+  uint64_t pos = 0;
+  int status, len, i, ret = 0;
+  pid_t pid;
+  if (NULL == (ring = ShmRingCreate(NULL, RING_CAPACITY))) {
+    printf("test_shm_ring FAIL create\n");
+    return 1;
+  }
+  if (0 == (pid = fork())) {
+    _reader(dup(ShmRingGetFd(ring)));
+  }
+  /* a failed reader leaves writes blocked, do not hang the suite */
+  alarm(60);
+  sink = ShmRingGetSink(ring);
+  AudioSinkOpen(sink, &format);
+  while (pos < STREAM_BYTES && 0 == ret) {
+    len = STREAM_BYTES - pos < WRITE_BYTES ? STREAM_BYTES - pos : WRITE_BYTES;
+    for (i = 0; i < len; i++) {
+      buf[i] = _byte(pos + i);
+    }
+    /* two iovs so a batch also splits across the wrap */
+    iov[0].iov_base = buf;
+    iov[0].iov_len = len / 3;
+    iov[1].iov_base = buf + len / 3;
+    iov[1].iov_len = len - len / 3;
+    ret = (len == AudioSinkWrite(sink, iov, 2)) ? 0 : -1;
+    pos += len;
+  }
+  ret |= AudioSinkDrain(sink);
+  AudioSinkClose(sink);
+  ShmRingDestroy(ring);
+  if (pid < 0 || pid != waitpid(pid, &status, 0) || !WIFEXITED(status) ||
+      0 != WEXITSTATUS(status)) {
+    ret = -1;
+  }
+  printf("test_shm_ring %s\n", 0 == ret ? "pass" : "FAIL");
+  return 0 == ret ? 0 : 1;
+}
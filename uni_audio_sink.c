@@ -0,0 +1,493 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_audio_sink.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.28
+ *
+ **************************************************************************/
+#include "uni_audio_sink.h"
+#include "uni_audio_tap.h"
+
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIO_SINK_TAG      "audio_sink"
+#define WAV_HEADER_SIZE     (44)
+
+struct AudioSink {
+  const AudioSinkOps *ops;
+  void               *opaque;
+  int                opened;
+  SinkStats          stats;
+  pthread_mutex_t    mutex;
+  int                lead_ms;
+  int                pace_lead_ms;
+  int                rate;
+  int                frame_bytes;
+  int64_t            anchor_ns;
+  int64_t            paced_bytes;
+  SinkFormat         format;
+  AudioTap           *tap;
+  uint64_t           tap_frames;
+};
+
+typedef struct {
+  int  (*cb)(void *opaque, const char *buf, int len);
+  void *opaque;
+} CallbackSink;
+
+typedef struct {
+  char       *path;
+  int        fd;
+  SinkFormat format;
+  int64_t    data_bytes;
+} WavSink;
+
+typedef struct {
+  int fd;
+} FdSink;
+
+static int64_t _now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t _now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * written audio since anchor is due at anchor + its duration, write may
+ * return lead early. behind real time (stall, pause) moves the anchor
+ * instead of bursting to catch up
+ */
+static int64_t _pace(AudioSink *sink, int len) {
+  int64_t now_ns = _now_ns(), media_ns, due_ns;
+  struct timespec ts;
+  if (sink->pace_lead_ms < 0 || 0 >= len) {
+    return 0;
+  }
+  if (0 == sink->anchor_ns) {
+    sink->anchor_ns = now_ns;
+  }
+  sink->paced_bytes += len;
+  media_ns = av_rescale(sink->paced_bytes / sink->frame_bytes, 1000000000,
+                        sink->rate);
+  if (now_ns > sink->anchor_ns + media_ns) {
+    sink->anchor_ns = now_ns - media_ns;
+    pthread_mutex_lock(&sink->mutex);
+    sink->stats.late_count++;
+    pthread_mutex_unlock(&sink->mutex);
+    return 0;
+  }
+  due_ns = sink->anchor_ns + media_ns - (int64_t)sink->pace_lead_ms * 1000000;
+  if (due_ns <= now_ns) {
+    return 0;
+  }
+  ts.tv_sec = due_ns / 1000000000;
+  ts.tv_nsec = due_ns % 1000000000;
+  while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) {
+  }
+  return (_now_ns() - now_ns) / 1000;
+}
+
+static int _iov_len(const struct iovec *iov, int iovcnt) {
+  int i, len = 0;
+  for (i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  return len;
+}
+
+/* writev until all written, poll when fd is non-blocking and full */
+static int _writev_all(int fd, const struct iovec *iov, int iovcnt) {
+  struct iovec vec[AUDIO_SINK_IOV_MAX];
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  int total = 0, i = 0;
+  ssize_t n;
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  while (i < iovcnt) {
+    if ((n = writev(fd, vec + i, iovcnt - i)) < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      if (EAGAIN == errno || EWOULDBLOCK == errno) {
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      LOGE(AUDIO_SINK_TAG, "writev failed[%s]", strerror(errno));
+      return -1;
+    }
+    total += n;
+    while (i < iovcnt && (size_t)n >= vec[i].iov_len) {
+      n -= vec[i++].iov_len;
+    }
+    if (i < iovcnt) {
+      vec[i].iov_base = (char *)vec[i].iov_base + n;
+      vec[i].iov_len -= n;
+    }
+  }
+  return total;
+}
+
+static int _callback_write(void *opaque, const struct iovec *iov,
+                           int iovcnt) {
+  CallbackSink *sink = (CallbackSink *)opaque;
+  int i, ret, total = 0;
+  for (i = 0; i < iovcnt; i++) {
+    if ((ret = sink->cb(sink->opaque, iov[i].iov_base, iov[i].iov_len)) < 0) {
+      return -1;
+    }
+    total += ret;
+  }
+  return total;
+}
+
+static void _free_opaque(void *opaque) {
+  av_free(opaque);
+}
+
+static const AudioSinkOps g_callback_ops = {
+  .name    = "callback",
+  .write   = _callback_write,
+  .destroy = _free_opaque,
+};
+
+static void _wav_header(WavSink *sink, uint8_t *header) {
+  int block_align = sink->format.channels * sink->format.bit / 8;
+  /* RIFF sizes are 32-bit, longer takes are clamped */
+  uint32_t data = (uint32_t)FFMIN(sink->data_bytes,
+                                  UINT32_MAX - WAV_HEADER_SIZE);
+  memcpy(header, "RIFF", 4);
+  AV_WL32(header + 4, 36 + data);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  AV_WL32(header + 16, 16);
+  AV_WL16(header + 20, sink->format.is_float ? 3 : 1);
+  AV_WL16(header + 22, sink->format.channels);
+  AV_WL32(header + 24, sink->format.rate);
+  AV_WL32(header + 28, sink->format.rate * block_align);
+  AV_WL16(header + 32, block_align);
+  AV_WL16(header + 34, sink->format.bit);
+  memcpy(header + 36, "data", 4);
+  AV_WL32(header + 40, data);
+}
+
+static int _wav_patch(WavSink *sink) {
+  uint8_t header[WAV_HEADER_SIZE];
+  _wav_header(sink, header);
+  if (WAV_HEADER_SIZE != pwrite(sink->fd, header, WAV_HEADER_SIZE, 0)) {
+    LOGE(AUDIO_SINK_TAG, "write wav header failed[%s]", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int _wav_open(void *opaque, const SinkFormat *format) {
+  WavSink *sink = (WavSink *)opaque;
+  if (format->planar) {
+    LOGE(AUDIO_SINK_TAG, "wav holds interleaved pcm only");
+    return -1;
+  }
+  sink->format = *format;
+  sink->data_bytes = 0;
+  sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (sink->fd < 0) {
+    LOGE(AUDIO_SINK_TAG, "open %s failed[%s]", sink->path, strerror(errno));
+    return -1;
+  }
+  /* placeholder sizes, data starts right after */
+  if (0 != _wav_patch(sink) ||
+      WAV_HEADER_SIZE != lseek(sink->fd, WAV_HEADER_SIZE, SEEK_SET)) {
+    close(sink->fd);
+    sink->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static int _wav_write(void *opaque, const struct iovec *iov, int iovcnt) {
+  WavSink *sink = (WavSink *)opaque;
+  int ret = _writev_all(sink->fd, iov, iovcnt);
+  if (0 < ret) {
+    sink->data_bytes += ret;
+  }
+  return ret;
+}
+
+static int _wav_drain(void *opaque) {
+  return _wav_patch((WavSink *)opaque);
+}
+
+static void _wav_close(void *opaque) {
+  WavSink *sink = (WavSink *)opaque;
+  if (0 <= sink->fd) {
+    _wav_patch(sink);
+    close(sink->fd);
+    sink->fd = -1;
+  }
+}
+
+static void _wav_destroy(void *opaque) {
+  WavSink *sink = (WavSink *)opaque;
+  av_free(sink->path);
+  av_free(sink);
+}
+
+static const AudioSinkOps g_wav_ops = {
+  .name    = "wav",
+  .open    = _wav_open,
+  .write   = _wav_write,
+  .drain   = _wav_drain,
+  .close   = _wav_close,
+  .destroy = _wav_destroy,
+};
+
+static int _null_write(void *opaque, const struct iovec *iov, int iovcnt) {
+  return _iov_len(iov, iovcnt);
+}
+
+static const AudioSinkOps g_null_ops = {
+  .name  = "null",
+  .write = _null_write,
+};
+
+static int _fd_write(void *opaque, const struct iovec *iov, int iovcnt) {
+  return _writev_all(((FdSink *)opaque)->fd, iov, iovcnt);
+}
+
+static const AudioSinkOps g_fd_ops = {
+  .name    = "fd",
+  .write   = _fd_write,
+  .destroy = _free_opaque,
+};
+
+AudioSink* AudioSinkCreate(const AudioSinkOps *ops, void *opaque) {
+  AudioSink *sink;
+  if (NULL == ops || NULL == ops->write) {
+    LOGE(AUDIO_SINK_TAG, "sink without write");
+    return NULL;
+  }
+  if (NULL == (sink = av_mallocz(sizeof(AudioSink)))) {
+    LOGE(AUDIO_SINK_TAG, "alloc audio sink failed");
+    return NULL;
+  }
+  sink->ops = ops;
+  sink->opaque = opaque;
+  sink->lead_ms = -1;
+  pthread_mutex_init(&sink->mutex, NULL);
+  return sink;
+}
+
+void AudioSinkDestroy(AudioSink *sink) {
+  if (NULL == sink) {
+    return;
+  }
+  AudioSinkClose(sink);
+  if (NULL != sink->ops->destroy) {
+    sink->ops->destroy(sink->opaque);
+  }
+  pthread_mutex_destroy(&sink->mutex);
+  av_free(sink);
+}
+
+AudioSink* AudioSinkCallbackCreate(int (*cb)(void *opaque, const char *buf,
+                                             int len),
+                                   void *opaque) {
+  CallbackSink *priv;
+  AudioSink *sink;
+  if (NULL == (priv = av_mallocz(sizeof(CallbackSink)))) {
+    return NULL;
+  }
+  priv->cb = cb;
+  priv->opaque = opaque;
+  if (NULL == (sink = AudioSinkCreate(&g_callback_ops, priv))) {
+    av_free(priv);
+  }
+  return sink;
+}
+
+AudioSink* AudioSinkWavCreate(const char *path) {
+  WavSink *priv;
+  AudioSink *sink;
+  if (NULL == (priv = av_mallocz(sizeof(WavSink)))) {
+    return NULL;
+  }
+  priv->fd = -1;
+  if (NULL == (priv->path = av_strdup(path)) ||
+      NULL == (sink = AudioSinkCreate(&g_wav_ops, priv))) {
+    _wav_destroy(priv);
+    return NULL;
+  }
+  return sink;
+}
+
+AudioSink* AudioSinkNullCreate(void) {
+  return AudioSinkCreate(&g_null_ops, NULL);
+}
+
+AudioSink* AudioSinkFdCreate(int fd) {
+  FdSink *priv;
+  AudioSink *sink;
+  if (NULL == (priv = av_mallocz(sizeof(FdSink)))) {
+    return NULL;
+  }
+  priv->fd = fd;
+  if (NULL == (sink = AudioSinkCreate(&g_fd_ops, priv))) {
+    av_free(priv);
+  }
+  return sink;
+}
+
+int AudioSinkOpen(AudioSink *sink, const SinkFormat *format) {
+  AudioSinkClose(sink);
+  if (NULL != sink->ops->open && 0 != sink->ops->open(sink->opaque, format)) {
+    LOGE(AUDIO_SINK_TAG, "open %s sink failed", sink->ops->name);
+    return -1;
+  }
+  sink->opened = 1;
+  sink->rate = format->rate;
+  sink->frame_bytes = format->channels * format->bit / 8;
+  sink->pace_lead_ms = (0 < sink->rate && 0 < sink->frame_bytes ?
+                        sink->lead_ms : -1);
+  sink->anchor_ns = 0;
+  sink->paced_bytes = 0;
+  sink->format = *format;
+  sink->tap_frames = 0;
+  LOGT(AUDIO_SINK_TAG, "%s sink open, rate=%d, channels=%d, bit=%d%s%s",
+       sink->ops->name, format->rate, format->channels, format->bit,
+       format->is_float ? " float" : "", format->planar ? " planar" : "");
+  return 0;
+}
+
+int AudioSinkSetPacing(AudioSink *sink, int lead_ms) {
+  sink->lead_ms = lead_ms < 0 ? -1 : lead_ms;
+  return 0;
+}
+
+int AudioSinkSetTap(AudioSink *sink, struct AudioTap *tap) {
+  sink->tap = tap;
+  return 0;
+}
+
+/* copy batch into tap once and point vec at that copy, backend reads it */
+static uint8_t* _tap_copy(AudioSink *sink, struct iovec *vec, int iovcnt,
+                          int len) {
+  uint8_t *dst;
+  int i;
+  if (NULL == sink->tap || NULL == (dst = AudioTapBegin(sink->tap, len))) {
+    return NULL;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    memcpy(dst, vec[i].iov_base, vec[i].iov_len);
+    vec[i].iov_base = dst;
+    dst += vec[i].iov_len;
+  }
+  return dst;
+}
+
+int AudioSinkWrite(AudioSink *sink, const struct iovec *iov, int iovcnt) {
+  struct iovec vec[AUDIO_SINK_IOV_MAX];
+  int64_t start_us, blocked_us = 0, paced_us;
+  int ret, total = 0, i = 0, len = _iov_len(iov, iovcnt);
+  uint8_t *tapped;
+  if (iovcnt > AUDIO_SINK_IOV_MAX) {
+    LOGE(AUDIO_SINK_TAG, "iovcnt %d over %d", iovcnt, AUDIO_SINK_IOV_MAX);
+    return -1;
+  }
+  memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+  tapped = _tap_copy(sink, vec, iovcnt, len);
+  /* backend may take part of batch, hand it the rest */
+  while (total < len) {
+    start_us = _now_us();
+    ret = sink->ops->write(sink->opaque, vec + i, iovcnt - i);
+    blocked_us += _now_us() - start_us;
+    if (ret <= 0) {
+      LOGE(AUDIO_SINK_TAG, "%s sink write failed[%d]", sink->ops->name, ret);
+      total = -1;
+      break;
+    }
+    total += ret;
+    while (i < iovcnt && ret >= (int)vec[i].iov_len) {
+      ret -= vec[i++].iov_len;
+    }
+    if (i < iovcnt) {
+      vec[i].iov_base = (char *)vec[i].iov_base + ret;
+      vec[i].iov_len -= ret;
+    }
+  }
+  /* stamp when backend took the last byte, before pacing sleeps */
+  if (NULL != tapped && 0 < total) {
+    AudioTapCommit(sink->tap, total, &sink->format, sink->tap_frames,
+                   _now_ns());
+  }
+  if (0 < total && 0 < sink->frame_bytes) {
+    sink->tap_frames += total / sink->frame_bytes;
+  }
+  paced_us = _pace(sink, total);
+  pthread_mutex_lock(&sink->mutex);
+  sink->stats.written_bytes += FFMAX(total, 0);
+  sink->stats.backpressure_us += blocked_us;
+  sink->stats.paced_us += paced_us;
+  pthread_mutex_unlock(&sink->mutex);
+  return total;
+}
+
+int AudioSinkDrain(AudioSink *sink) {
+  if (!sink->opened || NULL == sink->ops->drain) {
+    return 0;
+  }
+  return sink->ops->drain(sink->opaque);
+}
+
+void AudioSinkClose(AudioSink *sink) {
+  if (!sink->opened) {
+    return;
+  }
+  if (NULL != sink->ops->close) {
+    sink->ops->close(sink->opaque);
+  }
+  sink->opened = 0;
+}
+
+void AudioSinkAbort(AudioSink *sink) {
+  if (NULL != sink->ops->abort) {
+    sink->ops->abort(sink->opaque);
+  }
+}
+
+int AudioSinkStatsGet(AudioSink *sink, SinkStats *stats) {
+  pthread_mutex_lock(&sink->mutex);
+  *stats = sink->stats;
+  pthread_mutex_unlock(&sink->mutex);
+  return 0;
+}
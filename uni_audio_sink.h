@@ -0,0 +1,110 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_audio_sink.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.28
+ *
+ **************************************************************************/
+#ifndef AUDIO_SINK_INC_UNI_AUDIO_SINK_H_
+#define AUDIO_SINK_INC_UNI_AUDIO_SINK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define AUDIO_SINK_IOV_MAX (16)
+
+typedef struct AudioSink AudioSink;
+struct AudioTap;
+
+typedef struct {
+  int rate;
+  int channels;
+  int bit;           /* 16, 24 (3 bytes) or 32, signed unless is_float */
+  int is_float;
+  int planar;        /* each write is one iov per channel plane */
+} SinkFormat;
+
+typedef struct {
+  int64_t written_bytes;
+  int64_t backpressure_us; /* time blocked inside write */
+  int64_t paced_us;        /* time slept by pacing clock */
+  int     late_count;      /* pacing clock restarted after falling behind */
+} SinkStats;
+
+/**
+ * output backend, player opens it per play, writes pcm and
+ * drains at end of stream. write returns bytes taken or -1, blocking
+ * until the backend has room is how a sink pushes back on decoding
+ */
+typedef struct {
+  const char *name;
+  int        (*open)(void *opaque, const SinkFormat *format);
+  int        (*write)(void *opaque, const struct iovec *iov, int iovcnt);
+  int        (*drain)(void *opaque);
+  void       (*close)(void *opaque);
+  void       (*destroy)(void *opaque);
+  void       (*abort)(void *opaque);  /* optional, make blocked write fail */
+} AudioSinkOps;
+
+/* own backend, ops must outlive sink, destroy hook frees opaque */
+AudioSink* AudioSinkCreate(const AudioSinkOps *ops, void *opaque);
+void       AudioSinkDestroy(AudioSink *sink);
+
+/* hand every buffer to user, cb returns bytes taken or -1 */
+AudioSink* AudioSinkCallbackCreate(int (*cb)(void *opaque, const char *buf,
+                                             int len),
+                                   void *opaque);
+/* RIFF header sizes are patched on drain and close */
+AudioSink* AudioSinkWavCreate(const char *path);
+/* drop pcm, measures decode cost alone */
+AudioSink* AudioSinkNullCreate(void);
+/* writev to pipe, socket or file, fd stays owned by caller */
+AudioSink* AudioSinkFdCreate(int fd);
+
+/**
+ * pace writes to real time for sinks without own clock, relays or file
+ * simulators. deadlines are absolute on CLOCK_MONOTONIC from samples
+ * written, so no drift. lead_ms is how far writes may run ahead of real
+ * time, -1 off. takes effect on next open
+ */
+int        AudioSinkSetPacing(AudioSink *sink, int lead_ms);
+/**
+ * copy every write into tap, stamped with frame index since open and
+ * CLOCK_MONOTONIC time the backend took it, NULL detaches. set before
+ * writes start, tap must outlive sink or be detached first
+ */
+int        AudioSinkSetTap(AudioSink *sink, struct AudioTap *tap);
+int        AudioSinkOpen(AudioSink *sink, const SinkFormat *format);
+/* all of iov or -1, at most AUDIO_SINK_IOV_MAX, counts bytes and time */
+int        AudioSinkWrite(AudioSink *sink, const struct iovec *iov,
+                          int iovcnt);
+int        AudioSinkDrain(AudioSink *sink);
+void       AudioSinkClose(AudioSink *sink);
+/* wake write blocked on a stalled consumer, used on stop */
+void       AudioSinkAbort(AudioSink *sink);
+int        AudioSinkStatsGet(AudioSink *sink, SinkStats *stats);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* AUDIO_SINK_INC_UNI_AUDIO_SINK_H_ */
@@ -0,0 +1,207 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_audio_tap.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.04
+ *
+ **************************************************************************/
+#include "uni_audio_tap.h"
+
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUDIO_TAP_TAG        "audio_tap"
+#define AUDIO_TAP_SLOTS      (256)
+#define AUDIO_TAP_SLOT_BUSY  (UINT64_MAX)
+
+/* one committed chunk, seq is a seqlock, BUSY while producer rewrites it */
+typedef struct {
+  uint64_t   seq;
+  SinkFormat format;
+  uint64_t   sample;
+  int64_t    ns;
+  uint64_t   pos;
+  int        len;
+} TapSlot;
+
+struct AudioTap {
+  uint8_t  *data;
+  int      capacity;
+  uint64_t begin_pos;       /* producer only, region of pending chunk */
+  int32_t  data_seq;        /* futex, reader sleeps on it */
+  int32_t  reader_waiting;
+  uint64_t next;            /* reader only, seq of next chunk */
+  uint64_t dropped;
+  uint64_t reserve_pos __attribute__((aligned(64)));
+  uint64_t head __attribute__((aligned(64)));
+  TapSlot  slots[AUDIO_TAP_SLOTS];
+};
+
+static int64_t _now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* pairs with the waiting flag store in _sleep, syscall only for sleeper */
+static void _wake(AudioTap *tap) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&tap->reader_waiting, __ATOMIC_RELAXED)) {
+    __atomic_add_fetch(&tap->data_seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &tap->data_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+/* announce sleeper first, then recheck, so a wake in between is not lost */
+static void _sleep(AudioTap *tap, int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+  int32_t val = __atomic_load_n(&tap->data_seq, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&tap->reader_waiting, 1, __ATOMIC_SEQ_CST);
+  if (tap->next == __atomic_load_n(&tap->head, __ATOMIC_ACQUIRE)) {
+    syscall(SYS_futex, &tap->data_seq, FUTEX_WAIT, val, &ts, NULL, 0);
+  }
+  __atomic_store_n(&tap->reader_waiting, 0, __ATOMIC_RELAXED);
+}
+
+/* byte region is gone once reservations ran a full capacity past it */
+static int _region_valid(AudioTap *tap, uint64_t pos) {
+  return __atomic_load_n(&tap->reserve_pos, __ATOMIC_ACQUIRE) <=
+         pos + tap->capacity;
+}
+
+AudioTap* AudioTapCreate(int capacity) {
+  AudioTap *tap;
+  if (capacity <= 0) {
+    LOGE(AUDIO_TAP_TAG, "invalid capacity %d", capacity);
+    return NULL;
+  }
+  if (NULL == (tap = av_mallocz(sizeof(AudioTap)))) {
+    LOGE(AUDIO_TAP_TAG, "alloc tap failed");
+    return NULL;
+  }
+  if (NULL == (tap->data = av_malloc(capacity))) {
+    LOGE(AUDIO_TAP_TAG, "alloc %d bytes failed", capacity);
+    av_free(tap);
+    return NULL;
+  }
+  tap->capacity = capacity;
+  return tap;
+}
+
+void AudioTapDestroy(AudioTap *tap) {
+  if (NULL == tap) {
+    return;
+  }
+  av_free(tap->data);
+  av_free(tap);
+}
+
+uint8_t* AudioTapBegin(AudioTap *tap, int len) {
+  uint64_t pos = tap->reserve_pos;
+  int offset = pos % tap->capacity;
+  if (len <= 0 || len > tap->capacity / 2) {
+    return NULL;
+  }
+  /* keep chunk contiguous, skip the tail instead of splitting it */
+  if (offset + len > tap->capacity) {
+    pos += tap->capacity - offset;
+  }
+  tap->begin_pos = pos;
+  /* reservation visible before any byte of old chunks gets overwritten */
+  __atomic_store_n(&tap->reserve_pos, pos + len, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return tap->data + pos % tap->capacity;
+}
+
+void AudioTapCommit(AudioTap *tap, int len, const SinkFormat *format,
+                    uint64_t sample, int64_t ns) {
+  uint64_t head = tap->head;
+  TapSlot *slot = &tap->slots[head % AUDIO_TAP_SLOTS];
+  __atomic_store_n(&slot->seq, AUDIO_TAP_SLOT_BUSY, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->format = *format;
+  slot->sample = sample;
+  slot->ns = ns;
+  slot->pos = tap->begin_pos;
+  slot->len = len;
+  __atomic_store_n(&slot->seq, head, __ATOMIC_RELEASE);
+  __atomic_store_n(&tap->head, head + 1, __ATOMIC_RELEASE);
+  _wake(tap);
+}
+
+/* copy slot out, fails when producer reused it meanwhile */
+static int _slot_read(AudioTap *tap, uint64_t seq, AudioTapChunk *chunk) {
+  TapSlot *slot = &tap->slots[seq % AUDIO_TAP_SLOTS];
+  if (seq != __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) {
+    return -1;
+  }
+  chunk->format = slot->format;
+  chunk->sample = slot->sample;
+  chunk->ns = slot->ns;
+  chunk->pos = slot->pos;
+  chunk->len = slot->len;
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (seq != __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) ||
+      !_region_valid(tap, chunk->pos)) {
+    return -1;
+  }
+  chunk->seq = seq;
+  chunk->data = tap->data + chunk->pos % tap->capacity;
+  return 0;
+}
+
+int AudioTapGet(AudioTap *tap, AudioTapChunk *chunk, int timeout_ms) {
+  int64_t until_ns = _now_ns() + (int64_t)timeout_ms * 1000000;
+  int left_ms;
+  uint64_t head;
+  while (1) {
+    head = __atomic_load_n(&tap->head, __ATOMIC_ACQUIRE);
+    if (head - tap->next > AUDIO_TAP_SLOTS) {
+      __atomic_add_fetch(&tap->dropped, head - tap->next - AUDIO_TAP_SLOTS,
+                         __ATOMIC_RELAXED);
+      tap->next = head - AUDIO_TAP_SLOTS;
+    }
+    while (tap->next < head) {
+      if (0 == _slot_read(tap, tap->next++, chunk)) {
+        return 1;
+      }
+      __atomic_add_fetch(&tap->dropped, 1, __ATOMIC_RELAXED);
+    }
+    if (0 >= (left_ms = (until_ns - _now_ns()) / 1000000)) {
+      return 0;
+    }
+    _sleep(tap, left_ms);
+  }
+}
+
+int AudioTapValid(AudioTap *tap, const AudioTapChunk *chunk) {
+  /* pairs with fence in AudioTapBegin, orders data reads before check */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return _region_valid(tap, chunk->pos);
+}
+
+uint64_t AudioTapDropped(AudioTap *tap) {
+  return __atomic_load_n(&tap->dropped, __ATOMIC_RELAXED);
+}
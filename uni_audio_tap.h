@@ -0,0 +1,73 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_audio_tap.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.04
+ *
+ **************************************************************************/
+#ifndef AUDIO_TAP_INC_UNI_AUDIO_TAP_H_
+#define AUDIO_TAP_INC_UNI_AUDIO_TAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uni_audio_sink.h"
+#include <stdint.h>
+
+typedef struct AudioTap AudioTap;
+
+typedef struct {
+  uint64_t      seq;
+  SinkFormat    format;
+  uint64_t      sample;  /* first frame index since sink open */
+  int64_t       ns;      /* CLOCK_MONOTONIC when sink took the chunk */
+  const uint8_t *data;   /* in place inside tap, see AudioTapValid */
+  int           len;
+  uint64_t      pos;
+} AudioTapChunk;
+
+/**
+ * lock free single producer single consumer copy of final output, e.g.
+ * echo cancellation reference. producer never waits, a slow reader loses
+ * the oldest chunks. attach with AudioSinkSetTap, sink copies each write
+ * in once and hands the backend that copy, so device and reference are
+ * the same bytes
+ */
+AudioTap* AudioTapCreate(int capacity);
+void      AudioTapDestroy(AudioTap *tap);
+
+/* producer, contiguous room for len bytes, NULL when len too big */
+uint8_t*  AudioTapBegin(AudioTap *tap, int len);
+void      AudioTapCommit(AudioTap *tap, int len, const SinkFormat *format,
+                         uint64_t sample, int64_t ns);
+
+/**
+ * next chunk in place, wait up to timeout_ms. return 1 got, 0 timeout.
+ * overrun skips ahead and counts dropped chunks
+ */
+int       AudioTapGet(AudioTap *tap, AudioTapChunk *chunk, int timeout_ms);
+/* chunk data not overwritten meanwhile, check after consuming it */
+int       AudioTapValid(AudioTap *tap, const AudioTapChunk *chunk);
+uint64_t  AudioTapDropped(AudioTap *tap);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* AUDIO_TAP_INC_UNI_AUDIO_TAP_H_ */
@@ -0,0 +1,335 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_broadcast.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.01
+ *
+ **************************************************************************/
+#include "uni_broadcast.h"
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define BROADCAST_TAG "broadcast"
+
+struct BroadcastSub {
+  Broadcast          *bc;
+  BroadcastLagPolicy policy;
+  uint64_t           read_pos;
+  BroadcastSubStats  stats;
+  BroadcastSub       *next;
+};
+
+struct Broadcast {
+  pthread_mutex_t mutex;
+  pthread_cond_t  data_cond;  /* subscribers wait for write */
+  pthread_cond_t  space_cond; /* producer waits for blocking subscribers */
+  uint8_t         *data;
+  int             capacity;
+  uint64_t        write_pos;
+  SinkFormat      format;
+  int             frame_bytes;
+  uint64_t        frame_origin;  /* write_pos at open, frames count from it */
+  BroadcastSub    *subs;
+  int             refs;       /* owner plus subscribers */
+  int             closed;
+  int             aborted;
+  AudioSink       *sink;
+};
+
+static void _free(Broadcast *bc) {
+  AudioSinkDestroy(bc->sink);
+  pthread_cond_destroy(&bc->data_cond);
+  pthread_cond_destroy(&bc->space_cond);
+  pthread_mutex_destroy(&bc->mutex);
+  av_free(bc->data);
+  av_free(bc);
+}
+
+/* drop a reference with mutex held, last one frees */
+static void _unref_locked(Broadcast *bc) {
+  int refs = --bc->refs;
+  pthread_mutex_unlock(&bc->mutex);
+  if (0 == refs) {
+    _free(bc);
+  }
+}
+
+/* room left before slowest blocking subscriber gets overwritten */
+static int _writable(Broadcast *bc) {
+  BroadcastSub *sub;
+  uint64_t used = 0;
+  for (sub = bc->subs; NULL != sub; sub = sub->next) {
+    if (BROADCAST_LAG_BLOCK == sub->policy) {
+      used = FFMAX(used, bc->write_pos - sub->read_pos);
+    }
+  }
+  return bc->capacity - (int)used;
+}
+
+/* last frame boundary, producer may sit mid-frame while it waits */
+static uint64_t _live_edge(Broadcast *bc) {
+  return bc->write_pos - (bc->write_pos - bc->frame_origin) % bc->frame_bytes;
+}
+
+static void _copy_in(Broadcast *bc, const uint8_t *src, int len) {
+  int off = bc->write_pos % bc->capacity;
+  int n = FFMIN(len, bc->capacity - off);
+  memcpy(bc->data + off, src, n);
+  memcpy(bc->data, src + n, len - n);
+  bc->write_pos += len;
+}
+
+static void _copy_out(Broadcast *bc, uint64_t pos, uint8_t *dst, int len) {
+  int off = pos % bc->capacity;
+  int n = FFMIN(len, bc->capacity - off);
+  memcpy(dst, bc->data + off, n);
+  memcpy(dst + n, bc->data, len - n);
+}
+
+static int _bc_sink_open(void *opaque, const SinkFormat *format) {
+  Broadcast *bc = (Broadcast *)opaque;
+  pthread_mutex_lock(&bc->mutex);
+  bc->aborted = 0;
+  bc->format = *format;
+  /* planar writes come plane by plane, no interleaved frame to keep */
+  bc->frame_bytes = format->planar ? 1 :
+                    FFMAX(format->channels * format->bit / 8, 1);
+  bc->frame_origin = bc->write_pos;
+  pthread_mutex_unlock(&bc->mutex);
+  return 0;
+}
+
+/* take all of iov, waiting for blocking subscribers chunk by chunk */
+static int _bc_sink_write(void *opaque, const struct iovec *iov,
+                          int iovcnt) {
+  Broadcast *bc = (Broadcast *)opaque;
+  const uint8_t *src;
+  int i, left, n, total = 0;
+  pthread_mutex_lock(&bc->mutex);
+  for (i = 0; i < iovcnt; i++) {
+    src = iov[i].iov_base;
+    left = iov[i].iov_len;
+    while (0 < left) {
+      while (0 == (n = _writable(bc)) && !bc->aborted) {
+        pthread_cond_wait(&bc->space_cond, &bc->mutex);
+      }
+      if (bc->aborted) {
+        pthread_mutex_unlock(&bc->mutex);
+        return -1;
+      }
+      n = FFMIN(n, left);
+      _copy_in(bc, src, n);
+      src += n;
+      left -= n;
+      total += n;
+      pthread_cond_broadcast(&bc->data_cond);
+    }
+  }
+  pthread_mutex_unlock(&bc->mutex);
+  return total;
+}
+
+/* blocking subscribers have everything, dropping ones are not waited */
+static int _bc_sink_drain(void *opaque) {
+  Broadcast *bc = (Broadcast *)opaque;
+  int ret;
+  pthread_mutex_lock(&bc->mutex);
+  while (_writable(bc) < bc->capacity && !bc->aborted) {
+    pthread_cond_wait(&bc->space_cond, &bc->mutex);
+  }
+  ret = bc->aborted ? -1 : 0;
+  pthread_mutex_unlock(&bc->mutex);
+  return ret;
+}
+
+static void _bc_sink_abort(void *opaque) {
+  Broadcast *bc = (Broadcast *)opaque;
+  pthread_mutex_lock(&bc->mutex);
+  bc->aborted = 1;
+  pthread_cond_broadcast(&bc->space_cond);
+  pthread_mutex_unlock(&bc->mutex);
+}
+
+static const AudioSinkOps g_bc_sink_ops = {
+  .name  = "broadcast",
+  .open  = _bc_sink_open,
+  .write = _bc_sink_write,
+  .drain = _bc_sink_drain,
+  .abort = _bc_sink_abort,
+};
+
+Broadcast* BroadcastCreate(int capacity) {
+  Broadcast *bc;
+  pthread_condattr_t attr;
+  if (NULL == (bc = av_mallocz(sizeof(Broadcast)))) {
+    LOGE(BROADCAST_TAG, "alloc broadcast failed");
+    return NULL;
+  }
+  bc->capacity = FFMAX(capacity, 1);
+  if (NULL == (bc->data = av_malloc(bc->capacity))) {
+    LOGE(BROADCAST_TAG, "alloc ring %d failed", bc->capacity);
+    av_free(bc);
+    return NULL;
+  }
+  pthread_mutex_init(&bc->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&bc->data_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&bc->space_cond, NULL);
+  bc->refs = 1;
+  bc->frame_bytes = 1;
+  if (NULL == (bc->sink = AudioSinkCreate(&g_bc_sink_ops, bc))) {
+    _free(bc);
+    return NULL;
+  }
+  LOGT(BROADCAST_TAG, "broadcast capacity=%d", bc->capacity);
+  return bc;
+}
+
+void BroadcastDestroy(Broadcast *bc) {
+  if (NULL == bc) {
+    return;
+  }
+  pthread_mutex_lock(&bc->mutex);
+  bc->closed = 1;
+  bc->aborted = 1;
+  pthread_cond_broadcast(&bc->data_cond);
+  pthread_cond_broadcast(&bc->space_cond);
+  _unref_locked(bc);
+}
+
+AudioSink* BroadcastGetSink(Broadcast *bc) {
+  return bc->sink;
+}
+
+int BroadcastGetFormat(Broadcast *bc, SinkFormat *format) {
+  pthread_mutex_lock(&bc->mutex);
+  *format = bc->format;
+  pthread_mutex_unlock(&bc->mutex);
+  return 0 < format->rate ? 0 : -1;
+}
+
+BroadcastSub* BroadcastSubscribe(Broadcast *bc, BroadcastLagPolicy policy) {
+  BroadcastSub *sub;
+  if (NULL == (sub = av_mallocz(sizeof(BroadcastSub)))) {
+    LOGE(BROADCAST_TAG, "alloc subscriber failed");
+    return NULL;
+  }
+  sub->bc = bc;
+  sub->policy = policy;
+  pthread_mutex_lock(&bc->mutex);
+  sub->read_pos = _live_edge(bc);
+  sub->next = bc->subs;
+  bc->subs = sub;
+  bc->refs++;
+  pthread_mutex_unlock(&bc->mutex);
+  return sub;
+}
+
+void BroadcastUnsubscribe(BroadcastSub *sub) {
+  Broadcast *bc;
+  BroadcastSub **p;
+  if (NULL == sub) {
+    return;
+  }
+  bc = sub->bc;
+  pthread_mutex_lock(&bc->mutex);
+  for (p = &bc->subs; NULL != *p; p = &(*p)->next) {
+    if (*p == sub) {
+      *p = sub->next;
+      break;
+    }
+  }
+  /* producer may wait on this one */
+  pthread_cond_broadcast(&bc->space_cond);
+  av_free(sub);
+  _unref_locked(bc);
+}
+
+static int _wait_data(Broadcast *bc, const struct timespec *until) {
+  if (NULL == until) {
+    return pthread_cond_wait(&bc->data_cond, &bc->mutex);
+  }
+  return pthread_cond_timedwait(&bc->data_cond, &bc->mutex, until);
+}
+
+int BroadcastRead(BroadcastSub *sub, uint8_t *buf, int len, int timeout_ms) {
+  Broadcast *bc = sub->bc;
+  struct timespec until;
+  uint64_t avail, edge;
+  int n, frame;
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  until.tv_sec += timeout_ms / 1000;
+  until.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (until.tv_nsec >= 1000000000) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&bc->mutex);
+  while (1) {
+    avail = bc->write_pos - sub->read_pos;
+    if (avail > (uint64_t)bc->capacity) {
+      /* only dropping subscribers fall this far, resume from live edge */
+      edge = _live_edge(bc);
+      sub->stats.dropped_bytes += edge - sub->read_pos;
+      sub->stats.overrun_count++;
+      LOGW(BROADCAST_TAG, "subscriber overrun, dropped %llu bytes",
+           (unsigned long long)(edge - sub->read_pos));
+      sub->read_pos = edge;
+      continue;
+    }
+    /* whole frames only, a torn tail only once producer is gone */
+    frame = (bc->closed || len < bc->frame_bytes) ? 1 : bc->frame_bytes;
+    if (avail >= (uint64_t)frame) {
+      break;
+    }
+    if (bc->closed) {
+      pthread_mutex_unlock(&bc->mutex);
+      return -1;
+    }
+    if (0 != _wait_data(bc, timeout_ms < 0 ? NULL : &until)) {
+      pthread_mutex_unlock(&bc->mutex);
+      return 0;
+    }
+  }
+  n = (int)FFMIN((uint64_t)len, avail);
+  n -= n % frame;
+  _copy_out(bc, sub->read_pos, buf, n);
+  sub->read_pos += n;
+  sub->stats.read_bytes += n;
+  if (BROADCAST_LAG_BLOCK == sub->policy) {
+    pthread_cond_broadcast(&bc->space_cond);
+  }
+  pthread_mutex_unlock(&bc->mutex);
+  return n;
+}
+
+int BroadcastSubStatsGet(BroadcastSub *sub, BroadcastSubStats *stats) {
+  pthread_mutex_lock(&sub->bc->mutex);
+  *stats = sub->stats;
+  stats->lag_bytes = sub->bc->write_pos - sub->read_pos;
+  pthread_mutex_unlock(&sub->bc->mutex);
+  return 0;
+}
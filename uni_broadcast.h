@@ -0,0 +1,79 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_broadcast.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.01
+ *
+ **************************************************************************/
+#ifndef BROADCAST_INC_UNI_BROADCAST_H_
+#define BROADCAST_INC_UNI_BROADCAST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uni_audio_sink.h"
+#include <stdint.h>
+
+typedef struct Broadcast Broadcast;
+typedef struct BroadcastSub BroadcastSub;
+
+typedef enum {
+  BROADCAST_LAG_DROP = 0, /* overrun skips to live edge, producer never waits */
+  BROADCAST_LAG_BLOCK,    /* producer waits for this subscriber */
+} BroadcastLagPolicy;
+
+typedef struct {
+  int64_t read_bytes;
+  int64_t dropped_bytes;  /* skipped on overrun */
+  int     overrun_count;
+  int64_t lag_bytes;      /* written but not read yet */
+} BroadcastSubStats;
+
+/**
+ * one decoder, many listeners. player writes to the sink once, every
+ * subscriber has own read cursor over the same ring, so decode cost does
+ * not grow with listeners. positions are byte counters that never wrap.
+ * live channels pace the sink, see AudioSinkSetPacing, else drop-only
+ * rings run as fast as decode
+ */
+Broadcast*    BroadcastCreate(int capacity);
+/* subscribers keep the ring alive, reads return -1 once drained */
+void          BroadcastDestroy(Broadcast *bc);
+/* player facing sink, ring outlives sink */
+AudioSink*    BroadcastGetSink(Broadcast *bc);
+int           BroadcastGetFormat(Broadcast *bc, SinkFormat *format);
+
+/* joins at last frame boundary of live edge */
+BroadcastSub* BroadcastSubscribe(Broadcast *bc, BroadcastLagPolicy policy);
+void          BroadcastUnsubscribe(BroadcastSub *sub);
+/**
+ * copy up to len bytes in whole frames, len below one frame reads bytes.
+ * wait up to timeout_ms, -1 forever. return bytes, 0 timeout, -1 ring
+ * destroyed and nothing left
+ */
+int           BroadcastRead(BroadcastSub *sub, uint8_t *buf, int len,
+                            int timeout_ms);
+int           BroadcastSubStatsGet(BroadcastSub *sub,
+                                   BroadcastSubStats *stats);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* BROADCAST_INC_UNI_BROADCAST_H_ */
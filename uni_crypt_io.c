@@ -0,0 +1,175 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_crypt_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.26
+ *
+ **************************************************************************/
+#include "uni_crypt_io.h"
+
+#include <libavutil/aes.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CRYPT_IO_TAG          "crypt_io"
+#define CRYPT_AVIO_BUF_SIZE   (32 * 1024)
+#define CRYPT_BLOCK_SIZE      (16)
+#define CRYPT_BATCH_BLOCKS    (256)
+
+struct CryptIo {
+  AVIOContext   *inner;
+  struct AVAES  *aes;
+  uint8_t       iv[CRYPT_IV_SIZE];
+  int64_t       pos;
+  AVIOContext   *avio;
+  uint8_t       counter[CRYPT_BATCH_BLOCKS * CRYPT_BLOCK_SIZE];
+  uint8_t       keystream[CRYPT_BATCH_BLOCKS * CRYPT_BLOCK_SIZE];
+};
+
+/* counter block of block index, 128-bit big-endian add */
+static void _counter_block(const uint8_t *iv, uint64_t block, uint8_t *out) {
+  uint64_t hi = AV_RB64(iv);
+  uint64_t lo = AV_RB64(iv + 8);
+  uint64_t sum = lo + block;
+  AV_WB64(out, hi + (sum < lo));
+  AV_WB64(out + 8, sum);
+}
+
+/* buf ^= keystream, 16 then 8 bytes a step, unaligned both sides */
+static void _xor(uint8_t *buf, const uint8_t *ks, int len) {
+  int i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(ks + i)));
+    _mm_storeu_si128((__m128i *)(buf + i), v);
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    AV_WN64(buf + i, AV_RN64(buf + i) ^ AV_RN64(ks + i));
+  }
+  for (; i < len; i++) {
+    buf[i] ^= ks[i];
+  }
+}
+
+/**
+ * counter is set from pos, so seek costs nothing. keystream is made for a
+ * batch of blocks in one ecb call, av_aes is the aes backend on purpose,
+ * it carries its own AES-NI path and keeps us off a second crypto lib
+ */
+static void _crypt(CryptIo *io, uint8_t *buf, int size) {
+  uint64_t block;
+  int skip, blocks, len, i;
+  while (0 < size) {
+    block = io->pos / CRYPT_BLOCK_SIZE;
+    skip = io->pos % CRYPT_BLOCK_SIZE;
+    blocks = FFMIN(CRYPT_BATCH_BLOCKS,
+                   (skip + size + CRYPT_BLOCK_SIZE - 1) / CRYPT_BLOCK_SIZE);
+    for (i = 0; i < blocks; i++) {
+      _counter_block(io->iv, block + i, io->counter + i * CRYPT_BLOCK_SIZE);
+    }
+    av_aes_crypt(io->aes, io->keystream, io->counter, blocks, NULL, 0);
+    len = FFMIN(size, blocks * CRYPT_BLOCK_SIZE - skip);
+    _xor(buf, io->keystream + skip, len);
+    buf += len;
+    size -= len;
+    io->pos += len;
+  }
+}
+
+static int _crypt_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  CryptIo *io = (CryptIo *)opaque;
+  int ret = avio_read_partial(io->inner, buf, buf_size);
+  if (0 == ret) {
+    return AVERROR_EOF;
+  }
+  if (0 < ret) {
+    _crypt(io, buf, ret);
+  }
+  return ret;
+}
+
+static int64_t _crypt_seek(void *opaque, int64_t offset, int whence) {
+  CryptIo *io = (CryptIo *)opaque;
+  int64_t pos;
+  if (whence & AVSEEK_SIZE) {
+    return avio_size(io->inner);
+  }
+  if (0 <= (pos = avio_seek(io->inner, offset, whence & ~AVSEEK_FORCE))) {
+    io->pos = pos;
+  }
+  return pos;
+}
+
+CryptIo* CryptIoCreate(AVIOContext *inner, const uint8_t *key,
+                       int key_bits, const uint8_t *iv) {
+  CryptIo *io;
+  unsigned char *buffer;
+  if (NULL == (io = av_mallocz(sizeof(CryptIo)))) {
+    LOGE(CRYPT_IO_TAG, "alloc crypt io failed");
+    return NULL;
+  }
+  io->inner = inner;
+  io->pos = avio_tell(inner);
+  memcpy(io->iv, iv, CRYPT_IV_SIZE);
+  if (NULL == (io->aes = av_aes_alloc()) ||
+      0 != av_aes_init(io->aes, key, key_bits, 0)) {
+    LOGE(CRYPT_IO_TAG, "init aes-%d failed", key_bits);
+    goto L_ERROR;
+  }
+  if (NULL == (buffer = av_malloc(CRYPT_AVIO_BUF_SIZE))) {
+    LOGE(CRYPT_IO_TAG, "alloc avio buffer failed");
+    goto L_ERROR;
+  }
+  io->avio = avio_alloc_context(buffer, CRYPT_AVIO_BUF_SIZE, 0, io,
+                                _crypt_read_packet, NULL, _crypt_seek);
+  if (NULL == io->avio) {
+    LOGE(CRYPT_IO_TAG, "alloc avio context failed");
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  io->avio->seekable = inner->seekable;
+  return io;
+L_ERROR:
+  CryptIoDestroy(io);
+  return NULL;
+}
+
+void CryptIoDestroy(CryptIo *io) {
+  if (NULL == io) {
+    return;
+  }
+  if (NULL != io->avio) {
+    av_freep(&io->avio->buffer);
+    avio_context_free(&io->avio);
+  }
+  av_free(io->aes);
+  av_free(io);
+}
+
+AVIOContext* CryptIoGetAVIO(CryptIo *io) {
+  return io->avio;
+}
@@ -0,0 +1,51 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_crypt_io.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.26
+ *
+ **************************************************************************/
+#ifndef CRYPT_IO_INC_UNI_CRYPT_IO_H_
+#define CRYPT_IO_INC_UNI_CRYPT_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+#define CRYPT_IV_SIZE      (16)
+
+typedef struct CryptIo CryptIo;
+
+/**
+ * AES-CTR decrypting view of inner, decrypts in place in its AVIO buffer.
+ * iv is the 128-bit big-endian counter block of byte 0, incremented per
+ * 16 bytes like openssl. key_bits 128, 192 or 256. inner stays owned by
+ * caller and must outlive the CryptIo
+ */
+CryptIo*     CryptIoCreate(AVIOContext *inner, const uint8_t *key,
+                           int key_bits, const uint8_t *iv);
+void         CryptIoDestroy(CryptIo *io);
+AVIOContext* CryptIoGetAVIO(CryptIo *io);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* CRYPT_IO_INC_UNI_CRYPT_IO_H_ */
@@ -0,0 +1,507 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_event_loop.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.18
+ *
+ **************************************************************************/
+#include "uni_event_loop.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+#include "uni_feed_io.h"
+#include "uni_log.h"
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define EVENT_LOOP_TAG       "event_loop"
+#define LOOP_MAX_EVENTS      (64)
+#define LOOP_HEADER_LEN      (8 * 1024)
+#define LOOP_RECV_LEN        (16 * 1024)
+#define LOOP_HOST_LEN        (256)
+#define LOOP_PATH_LEN        (2048)
+#define LOOP_WAKEUP_ID       (UINT64_MAX)
+
+typedef enum {
+  STREAM_CONNECTING = 0,
+  STREAM_HEADER,
+  STREAM_BODY,
+  STREAM_DONE
+} StreamState;
+
+struct LoopStream {
+  int         index;
+  uint32_t    generation;
+  int         fd;
+  StreamState state;
+  int         paused;
+  int         ending;
+  char        *request;
+  int         request_len;
+  int         request_sent;
+  char        *header;
+  int         header_len;
+  int64_t     body_left;
+  int         last_recv;
+  FeedIo      *feed;
+};
+
+struct EventLoop {
+  int             epfd;
+  int             wakeup_fd;
+  int             running;
+  pthread_t       thread;
+  int             max_streams;
+  LoopStream      **streams;
+  uint32_t        generation;
+  pthread_mutex_t mutex;
+};
+
+static uint64_t _stream_id(LoopStream *stream) {
+  return ((uint64_t)stream->generation << 32) | (uint32_t)stream->index;
+}
+
+static LoopStream* _lookup_stream(EventLoop *loop, uint64_t id) {
+  uint32_t index = (uint32_t)id;
+  LoopStream *stream;
+  if (index >= (uint32_t)loop->max_streams) {
+    return NULL;
+  }
+  /* event may belong to a stream closed while epoll_wait returned */
+  stream = loop->streams[index];
+  if (NULL == stream || (uint32_t)(id >> 32) != stream->generation) {
+    return NULL;
+  }
+  return stream;
+}
+
+static void _loop_wakeup(void *opaque) {
+  EventLoop *loop = (EventLoop *)opaque;
+  uint64_t one = 1;
+  write(loop->wakeup_fd, &one, sizeof(one));
+}
+
+static void _stream_poll(EventLoop *loop, LoopStream *stream,
+                         uint32_t events) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.u64 = _stream_id(stream);
+  epoll_ctl(loop->epfd, EPOLL_CTL_MOD, stream->fd, &ev);
+}
+
+static void _stream_finish(EventLoop *loop, LoopStream *stream) {
+  if (STREAM_DONE == stream->state) {
+    return;
+  }
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+  close(stream->fd);
+  stream->fd = -1;
+  stream->state = STREAM_DONE;
+  av_freep(&stream->header);
+  FeedIoEnd(stream->feed);
+}
+
+static void _stream_send(EventLoop *loop, LoopStream *stream) {
+  int err = 0, ret;
+  socklen_t len = sizeof(err);
+  if (STREAM_CONNECTING == stream->state && 0 == stream->request_sent) {
+    getsockopt(stream->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (0 != err) {
+      LOGE(EVENT_LOOP_TAG, "stream[%d] connect failed[%s]", stream->index,
+           strerror(err));
+      _stream_finish(loop, stream);
+      return;
+    }
+  }
+  ret = send(stream->fd, stream->request + stream->request_sent,
+             stream->request_len - stream->request_sent, MSG_NOSIGNAL);
+  if (ret < 0) {
+    if (EAGAIN != errno && EWOULDBLOCK != errno) {
+      _stream_finish(loop, stream);
+    }
+    return;
+  }
+  stream->request_sent += ret;
+  if (stream->request_sent == stream->request_len) {
+    stream->state = STREAM_HEADER;
+    _stream_poll(loop, stream, EPOLLIN);
+  }
+}
+
+static int _parse_header(LoopStream *stream, char *end) {
+  char *line, *next, *p;
+  int status = 0;
+  *end = '\0';
+  if (1 != sscanf(stream->header, "HTTP/1.%*d %d", &status) ||
+      (200 != status && 206 != status)) {
+    LOGE(EVENT_LOOP_TAG, "stream[%d] http status %d", stream->index, status);
+    return -1;
+  }
+  stream->body_left = -1;
+  for (line = strstr(stream->header, "\r\n"); NULL != line; line = next) {
+    line += 2;
+    next = strstr(line, "\r\n");
+    if (av_stristart(line, "Content-Length:", (const char **)&p)) {
+      stream->body_left = strtoll(p, NULL, 10);
+    } else if (av_stristart(line, "Transfer-Encoding:", (const char **)&p) &&
+               NULL != av_stristr(p, "chunked")) {
+      LOGE(EVENT_LOOP_TAG, "stream[%d] chunked not supported", stream->index);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void _stream_recv_header(EventLoop *loop, LoopStream *stream) {
+  char *end;
+  int ret, body;
+  ret = recv(stream->fd, stream->header + stream->header_len,
+             LOOP_HEADER_LEN - 1 - stream->header_len, 0);
+  if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+    return;
+  }
+  if (ret <= 0) {
+    _stream_finish(loop, stream);
+    return;
+  }
+  stream->header_len += ret;
+  stream->header[stream->header_len] = '\0';
+  if (NULL == (end = strstr(stream->header, "\r\n\r\n"))) {
+    if (LOOP_HEADER_LEN - 1 == stream->header_len) {
+      LOGE(EVENT_LOOP_TAG, "stream[%d] header too large", stream->index);
+      _stream_finish(loop, stream);
+    }
+    return;
+  }
+  body = stream->header_len - (int)(end + 4 - stream->header);
+  if (0 != _parse_header(stream, end)) {
+    _stream_finish(loop, stream);
+    return;
+  }
+  stream->state = STREAM_BODY;
+  /* fifo is empty and never smaller than header buffer, cannot block */
+  if (0 < body) {
+    body = 0 <= stream->body_left ? (int)FFMIN(body, stream->body_left) : body;
+    FeedIoWrite(stream->feed, end + 4, body);
+    stream->body_left -= (0 <= stream->body_left ? body : 0);
+  }
+  av_freep(&stream->header);
+  if (0 == stream->body_left) {
+    _stream_finish(loop, stream);
+  }
+}
+
+static int _recv_fill(void *opaque, void *dst, int size) {
+  LoopStream *stream = (LoopStream *)opaque;
+  stream->last_recv = recv(stream->fd, dst, size, 0);
+  if (stream->last_recv < 0 && EAGAIN != errno && EWOULDBLOCK != errno) {
+    LOGW(EVENT_LOOP_TAG, "stream[%d] recv failed[%s]", stream->index,
+         strerror(errno));
+  }
+  return stream->last_recv;
+}
+
+static void _stream_recv_body(EventLoop *loop, LoopStream *stream) {
+  int size, ret;
+  if (0 == (size = FeedIoSpace(stream->feed))) {
+    /* decoder is behind, stop polling until it drains the fifo */
+    stream->paused = 1;
+    _stream_poll(loop, stream, 0);
+    return;
+  }
+  size = FFMIN(size, LOOP_RECV_LEN);
+  if (0 <= stream->body_left) {
+    size = (int)FFMIN(size, stream->body_left);
+  }
+  stream->last_recv = 0;
+  ret = FeedIoFill(stream->feed, _recv_fill, stream, size);
+  if (0 < ret) {
+    if (0 <= stream->body_left && 0 == (stream->body_left -= ret)) {
+      _stream_finish(loop, stream);
+    }
+    return;
+  }
+  /* an ending stream is off epoll, a would-block read means nothing left */
+  if (!stream->ending && stream->last_recv < 0 &&
+      (EAGAIN == errno || EWOULDBLOCK == errno)) {
+    return;
+  }
+  _stream_finish(loop, stream);
+}
+
+static void _stream_drain_end(EventLoop *loop, LoopStream *stream) {
+  /* no more readiness events, read what fits until eof or fifo full */
+  while (STREAM_DONE != stream->state && 0 < FeedIoSpace(stream->feed)) {
+    _stream_recv_body(loop, stream);
+  }
+}
+
+static void _stream_end(EventLoop *loop, LoopStream *stream) {
+  /* peer hung up while paused, keep the tail in socket buffer for later */
+  stream->ending = 1;
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+  _stream_drain_end(loop, stream);
+}
+
+static void _resume_streams(EventLoop *loop) {
+  LoopStream *stream;
+  int i;
+  for (i = 0; i < loop->max_streams; i++) {
+    stream = loop->streams[i];
+    if (NULL != stream && stream->paused && STREAM_BODY == stream->state &&
+        0 < FeedIoSpace(stream->feed)) {
+      if (stream->ending) {
+        _stream_drain_end(loop, stream);
+      } else {
+        stream->paused = 0;
+        _stream_poll(loop, stream, EPOLLIN);
+      }
+    }
+  }
+}
+
+static void _handle_event(EventLoop *loop, LoopStream *stream,
+                          uint32_t events) {
+  switch (stream->state) {
+    case STREAM_CONNECTING:
+      _stream_send(loop, stream);
+      break;
+    case STREAM_HEADER:
+      _stream_recv_header(loop, stream);
+      break;
+    case STREAM_BODY:
+      /* level-triggered hup/err fires even with no events requested */
+      if ((events & (EPOLLHUP | EPOLLERR)) && stream->paused) {
+        _stream_end(loop, stream);
+        break;
+      }
+      _stream_recv_body(loop, stream);
+      break;
+    default:
+      break;
+  }
+}
+
+static void* __event_loop_tsk(void *args) {
+  EventLoop *loop = (EventLoop *)args;
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  LoopStream *stream;
+  uint64_t counter;
+  int i, n;
+  while (loop->running) {
+    if ((n = epoll_wait(loop->epfd, events, LOOP_MAX_EVENTS, -1)) < 0) {
+      if (EINTR != errno) {
+        LOGE(EVENT_LOOP_TAG, "epoll_wait failed[%s]", strerror(errno));
+        break;
+      }
+      continue;
+    }
+    pthread_mutex_lock(&loop->mutex);
+    for (i = 0; i < n; i++) {
+      if (LOOP_WAKEUP_ID == events[i].data.u64) {
+        read(loop->wakeup_fd, &counter, sizeof(counter));
+        _resume_streams(loop);
+        continue;
+      }
+      if (NULL != (stream = _lookup_stream(loop, events[i].data.u64))) {
+        _handle_event(loop, stream, events[i].events);
+      }
+    }
+    pthread_mutex_unlock(&loop->mutex);
+  }
+  return NULL;
+}
+
+EventLoop* EventLoopCreate(int max_streams) {
+  EventLoop *loop;
+  struct epoll_event ev;
+  if (NULL == (loop = av_mallocz(sizeof(EventLoop)))) {
+    LOGE(EVENT_LOOP_TAG, "alloc event loop failed");
+    return NULL;
+  }
+  loop->epfd = -1;
+  loop->wakeup_fd = -1;
+  loop->max_streams = max_streams;
+  pthread_mutex_init(&loop->mutex, NULL);
+  if (NULL == (loop->streams = av_mallocz_array(max_streams,
+                                                sizeof(LoopStream *)))) {
+    goto L_ERROR;
+  }
+  if (0 > (loop->epfd = epoll_create1(EPOLL_CLOEXEC)) ||
+      0 > (loop->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+    LOGE(EVENT_LOOP_TAG, "create epoll failed[%s]", strerror(errno));
+    goto L_ERROR;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u64 = LOOP_WAKEUP_ID;
+  epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakeup_fd, &ev);
+  loop->running = 1;
+  if (0 != pthread_create(&loop->thread, NULL, __event_loop_tsk, loop)) {
+    LOGE(EVENT_LOOP_TAG, "create event loop thread failed");
+    loop->running = 0;
+    goto L_ERROR;
+  }
+  return loop;
+L_ERROR:
+  EventLoopDestroy(loop);
+  return NULL;
+}
+
+void EventLoopDestroy(EventLoop *loop) {
+  int i;
+  if (NULL == loop) {
+    return;
+  }
+  if (loop->running) {
+    loop->running = 0;
+    _loop_wakeup(loop);
+    pthread_join(loop->thread, NULL);
+  }
+  for (i = 0; NULL != loop->streams && i < loop->max_streams; i++) {
+    if (NULL != loop->streams[i]) {
+      EventLoopCloseStream(loop, loop->streams[i]);
+    }
+  }
+  av_freep(&loop->streams);
+  if (0 <= loop->wakeup_fd) {
+    close(loop->wakeup_fd);
+  }
+  if (0 <= loop->epfd) {
+    close(loop->epfd);
+  }
+  pthread_mutex_destroy(&loop->mutex);
+  av_free(loop);
+}
+
+static int _connect_nonblock(const char *host, int port) {
+  struct addrinfo hints, *ai = NULL;
+  char service[16];
+  int fd;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%d", port);
+  if (0 != getaddrinfo(host, service, &hints, &ai)) {
+    LOGE(EVENT_LOOP_TAG, "resolve %s failed", host);
+    return -1;
+  }
+  fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (0 <= fd && 0 != connect(fd, ai->ai_addr, ai->ai_addrlen) &&
+      EINPROGRESS != errno) {
+    LOGE(EVENT_LOOP_TAG, "connect %s failed[%s]", host, strerror(errno));
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(ai);
+  return fd;
+}
+
+static void _free_stream(LoopStream *stream) {
+  if (0 <= stream->fd) {
+    close(stream->fd);
+  }
+  FeedIoDestroy(stream->feed);
+  av_free(stream->request);
+  av_free(stream->header);
+  av_free(stream);
+}
+
+LoopStream* EventLoopOpenStream(EventLoop *loop, const char *url,
+                                int buffer_size) {
+  char proto[16], host[LOOP_HOST_LEN], path[LOOP_PATH_LEN];
+  char host_hdr[LOOP_HOST_LEN + 16];
+  LoopStream *stream;
+  struct epoll_event ev;
+  int port, i;
+  av_url_split(proto, sizeof(proto), NULL, 0, host, sizeof(host), &port,
+               path, sizeof(path), url);
+  if (0 != strcmp(proto, "http") || '\0' == host[0]) {
+    LOGE(EVENT_LOOP_TAG, "only plain http supported, url=%s", url);
+    return NULL;
+  }
+  port = port < 0 ? 80 : port;
+  if (80 == port) {
+    snprintf(host_hdr, sizeof(host_hdr), "%s", host);
+  } else {
+    snprintf(host_hdr, sizeof(host_hdr), "%s:%d", host, port);
+  }
+  if (NULL == (stream = av_mallocz(sizeof(LoopStream)))) {
+    return NULL;
+  }
+  stream->fd = -1;
+  stream->request = av_asprintf("GET %s HTTP/1.1\r\nHost: %s\r\n"
+                                "User-Agent: uni_mp3_player\r\nAccept: */*\r\n"
+                                "Connection: close\r\n\r\n",
+                                '\0' == path[0] ? "/" : path, host_hdr);
+  stream->header = av_malloc(LOOP_HEADER_LEN);
+  stream->feed = FeedIoCreate(FFMAX(buffer_size, LOOP_HEADER_LEN));
+  if (NULL == stream->request || NULL == stream->header ||
+      NULL == stream->feed) {
+    goto L_ERROR;
+  }
+  stream->request_len = strlen(stream->request);
+  FeedIoSetSpaceCb(stream->feed, _loop_wakeup, loop);
+  if (0 > (stream->fd = _connect_nonblock(host, port))) {
+    goto L_ERROR;
+  }
+  pthread_mutex_lock(&loop->mutex);
+  for (i = 0; i < loop->max_streams && NULL != loop->streams[i]; i++) {
+  }
+  if (i == loop->max_streams) {
+    pthread_mutex_unlock(&loop->mutex);
+    LOGE(EVENT_LOOP_TAG, "too many streams, max=%d", loop->max_streams);
+    goto L_ERROR;
+  }
+  stream->index = i;
+  stream->generation = ++loop->generation;
+  loop->streams[i] = stream;
+  ev.events = EPOLLOUT;
+  ev.data.u64 = _stream_id(stream);
+  epoll_ctl(loop->epfd, EPOLL_CTL_ADD, stream->fd, &ev);
+  pthread_mutex_unlock(&loop->mutex);
+  return stream;
+L_ERROR:
+  _free_stream(stream);
+  return NULL;
+}
+
+void EventLoopCloseStream(EventLoop *loop, LoopStream *stream) {
+  pthread_mutex_lock(&loop->mutex);
+  if (0 <= stream->fd) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+  }
+  loop->streams[stream->index] = NULL;
+  FeedIoAbort(stream->feed);
+  pthread_mutex_unlock(&loop->mutex);
+  _free_stream(stream);
+}
+
+AVIOContext* LoopStreamGetAVIO(LoopStream *stream) {
+  return FeedIoGetAVIO(stream->feed);
+}
@@ -0,0 +1,53 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_event_loop.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.18
+ *
+ **************************************************************************/
+#ifndef EVENT_LOOP_INC_UNI_EVENT_LOOP_H_
+#define EVENT_LOOP_INC_UNI_EVENT_LOOP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct EventLoop  EventLoop;
+typedef struct LoopStream LoopStream;
+
+/* one epoll thread drives non-blocking http sockets of up to max_streams */
+EventLoop*   EventLoopCreate(int max_streams);
+void         EventLoopDestroy(EventLoop *loop);
+
+/**
+ * plain http GET, body goes into a buffer_size fifo exposed as AVIO.
+ * decoder thread blocks in read and is woken only when body bytes arrive,
+ * socket stops being polled while fifo is full
+ */
+LoopStream*  EventLoopOpenStream(EventLoop *loop, const char *url,
+                                 int buffer_size);
+void         EventLoopCloseStream(EventLoop *loop, LoopStream *stream);
+AVIOContext* LoopStreamGetAVIO(LoopStream *stream);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* EVENT_LOOP_INC_UNI_EVENT_LOOP_H_ */
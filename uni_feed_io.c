@@ -0,0 +1,191 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_feed_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.10
+ *
+ **************************************************************************/
+#include "uni_feed_io.h"
+
+#include <libavutil/fifo.h>
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include "uni_log.h"
+#include <pthread.h>
+
+#define FEED_IO_TAG          "feed_io"
+#define FEED_AVIO_BUF_SIZE   (4 * 1024)
+
+struct FeedIo {
+  AVFifoBuffer    *fifo;
+  AVIOContext     *avio;
+  int             eof;
+  int             aborted;
+  int             space_wanted;
+  void            (*space_cb)(void *opaque);
+  void            *space_opaque;
+  pthread_mutex_t mutex;
+  pthread_cond_t  readable;
+  pthread_cond_t  writable;
+};
+
+static int _feed_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  FeedIo *io = (FeedIo *)opaque;
+  int len;
+  pthread_mutex_lock(&io->mutex);
+  while (0 == av_fifo_size(io->fifo) && !io->eof && !io->aborted) {
+    pthread_cond_wait(&io->readable, &io->mutex);
+  }
+  if (io->aborted || 0 == av_fifo_size(io->fifo)) {
+    pthread_mutex_unlock(&io->mutex);
+    return AVERROR_EOF;
+  }
+  /* return what we have, do not wait for a full buffer */
+  len = FFMIN(buf_size, av_fifo_size(io->fifo));
+  av_fifo_generic_read(io->fifo, buf, len, NULL);
+  pthread_cond_signal(&io->writable);
+  if (io->space_wanted && NULL != io->space_cb) {
+    io->space_wanted = 0;
+    io->space_cb(io->space_opaque);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return len;
+}
+
+FeedIo* FeedIoCreate(int capacity) {
+  FeedIo *io;
+  unsigned char *buffer;
+  if (NULL == (io = av_mallocz(sizeof(FeedIo)))) {
+    LOGE(FEED_IO_TAG, "alloc feed io failed");
+    return NULL;
+  }
+  if (NULL == (io->fifo = av_fifo_alloc(capacity))) {
+    LOGE(FEED_IO_TAG, "alloc fifo failed, capacity=%d", capacity);
+    goto L_ERROR;
+  }
+  if (NULL == (buffer = av_malloc(FEED_AVIO_BUF_SIZE))) {
+    LOGE(FEED_IO_TAG, "alloc avio buffer failed");
+    goto L_ERROR;
+  }
+  io->avio = avio_alloc_context(buffer, FEED_AVIO_BUF_SIZE, 0, io,
+                                _feed_read_packet, NULL, NULL);
+  if (NULL == io->avio) {
+    LOGE(FEED_IO_TAG, "alloc avio context failed");
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  io->avio->seekable = 0;
+  pthread_mutex_init(&io->mutex, NULL);
+  pthread_cond_init(&io->readable, NULL);
+  pthread_cond_init(&io->writable, NULL);
+  return io;
+L_ERROR:
+  av_fifo_freep(&io->fifo);
+  av_free(io);
+  return NULL;
+}
+
+void FeedIoDestroy(FeedIo *io) {
+  if (NULL == io) {
+    return;
+  }
+  av_freep(&io->avio->buffer);
+  avio_context_free(&io->avio);
+  av_fifo_freep(&io->fifo);
+  pthread_cond_destroy(&io->writable);
+  pthread_cond_destroy(&io->readable);
+  pthread_mutex_destroy(&io->mutex);
+  av_free(io);
+}
+
+AVIOContext* FeedIoGetAVIO(FeedIo *io) {
+  return io->avio;
+}
+
+int FeedIoWrite(FeedIo *io, const char *data, int len) {
+  int space, written = 0;
+  pthread_mutex_lock(&io->mutex);
+  while (written < len) {
+    while (0 == (space = av_fifo_space(io->fifo)) && !io->aborted) {
+      pthread_cond_wait(&io->writable, &io->mutex);
+    }
+    if (io->aborted) {
+      pthread_mutex_unlock(&io->mutex);
+      LOGW(FEED_IO_TAG, "feed aborted, written=%d, len=%d", written, len);
+      return -1;
+    }
+    space = FFMIN(space, len - written);
+    av_fifo_generic_write(io->fifo, (void *)(data + written), space, NULL);
+    written += space;
+    pthread_cond_signal(&io->readable);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return written;
+}
+
+int FeedIoEnd(FeedIo *io) {
+  pthread_mutex_lock(&io->mutex);
+  io->eof = 1;
+  pthread_cond_broadcast(&io->readable);
+  pthread_mutex_unlock(&io->mutex);
+  return 0;
+}
+
+int FeedIoAbort(FeedIo *io) {
+  pthread_mutex_lock(&io->mutex);
+  io->aborted = 1;
+  pthread_cond_broadcast(&io->readable);
+  pthread_cond_broadcast(&io->writable);
+  pthread_mutex_unlock(&io->mutex);
+  return 0;
+}
+
+int FeedIoSpace(FeedIo *io) {
+  int space;
+  pthread_mutex_lock(&io->mutex);
+  space = io->aborted ? 0 : av_fifo_space(io->fifo);
+  io->space_wanted = (0 == space);
+  pthread_mutex_unlock(&io->mutex);
+  return space;
+}
+
+void FeedIoSetSpaceCb(FeedIo *io, void (*space_cb)(void *opaque),
+                      void *opaque) {
+  pthread_mutex_lock(&io->mutex);
+  io->space_cb = space_cb;
+  io->space_opaque = opaque;
+  pthread_mutex_unlock(&io->mutex);
+}
+
+int FeedIoFill(FeedIo *io, int (*fill)(void *opaque, void *dst, int size),
+               void *opaque, int size) {
+  int len;
+  pthread_mutex_lock(&io->mutex);
+  if (io->aborted) {
+    pthread_mutex_unlock(&io->mutex);
+    return -1;
+  }
+  size = FFMIN(size, av_fifo_space(io->fifo));
+  if (0 < (len = av_fifo_generic_write(io->fifo, opaque, size, fill))) {
+    pthread_cond_signal(&io->readable);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return len;
+}
@@ -0,0 +1,59 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_feed_io.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.10
+ *
+ **************************************************************************/
+#ifndef FEED_IO_INC_UNI_FEED_IO_H_
+#define FEED_IO_INC_UNI_FEED_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct FeedIo FeedIo;
+
+/* push-mode byte source, producer calls FeedIoWrite, demuxer reads AVIO */
+FeedIo*      FeedIoCreate(int capacity);
+void         FeedIoDestroy(FeedIo *io);
+AVIOContext* FeedIoGetAVIO(FeedIo *io);
+
+/* block while fifo full, return bytes written or -1 when aborted */
+int          FeedIoWrite(FeedIo *io, const char *data, int len);
+/* no more data, reader gets AVERROR_EOF once fifo drained */
+int          FeedIoEnd(FeedIo *io);
+/* wake up all blocked reader and writer, used on stop */
+int          FeedIoAbort(FeedIo *io);
+
+/* non-blocking producer, 0 space arms space_cb once reader drains data */
+int          FeedIoSpace(FeedIo *io);
+void         FeedIoSetSpaceCb(FeedIo *io, void (*space_cb)(void *opaque),
+                              void *opaque);
+/* fill fifo straight from fill(), e.g. non-blocking recv, no staging copy */
+int          FeedIoFill(FeedIo *io, int (*fill)(void *opaque, void *dst,
+                                                int size),
+                        void *opaque, int size);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* FEED_IO_INC_UNI_FEED_IO_H_ */
@@ -0,0 +1,343 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_hedge_open.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.25
+ *
+ **************************************************************************/
+#include "uni_hedge_open.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/avstring.h>
+#include "uni_log.h"
+#include <pthread.h>
+#include <time.h>
+
+#define HEDGE_OPEN_TAG       "hedge_open"
+
+typedef enum {
+  RACER_IDLE = 0,
+  RACER_OPENING,
+  RACER_OPENED,
+  RACER_FAILED
+} RacerState;
+
+typedef struct {
+  struct HedgeOpen *hedge;
+  int              index;
+  char             *url;
+  pthread_t        thread;
+  RacerState       state;
+  int              aborted;
+  int              joined;
+  int64_t          start_ms;
+  int64_t          end_ms;
+  int64_t          lost_ms;
+  HttpIo           *http;
+  AVFormatContext  *fmt_ctx;
+  AVIOInterruptCB  int_cb;
+  AVIOInterruptCB  owner_cb;
+  int              adopted;
+} HedgeRacer;
+
+struct HedgeOpen {
+  HedgeRacer      *racers;
+  int             count;
+  int             started;
+  int             winner;
+  int             taken;
+  int64_t         start_ms;
+  int64_t         deadline_ms;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
+static int64_t _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * ffmpeg io copies the callback into its URLContext, so the winner keeps
+ * calling this one. once adopted it forwards to the owner instead of the
+ * race deadline
+ */
+static int _racer_interrupt_cb(void *ctx) {
+  HedgeRacer *racer = (HedgeRacer *)ctx;
+  if (racer->adopted) {
+    return NULL != racer->owner_cb.callback &&
+           racer->owner_cb.callback(racer->owner_cb.opaque);
+  }
+  return racer->aborted || _now_ms() >= racer->hedge->deadline_ms;
+}
+
+static void _racer_close(HedgeRacer *racer) {
+  avformat_close_input(&racer->fmt_ctx);
+  HttpIoDestroy(racer->http);
+  racer->http = NULL;
+}
+
+static void _racer_abort(HedgeRacer *racer) {
+  racer->aborted = 1;
+  if (NULL != racer->http) {
+    HttpIoAbort(racer->http);
+  }
+}
+
+/* decodable means demuxer found audio stream with codec parameters */
+static int _racer_open(HedgeRacer *racer) {
+  AVFormatContext *fmt_ctx;
+  HttpIo *http;
+  int idx;
+  /* not http(s) leaves http NULL, ffmpeg opens url itself */
+  http = HttpIoCreate(racer->url);
+  pthread_mutex_lock(&racer->hedge->mutex);
+  racer->http = http;
+  if (racer->aborted) {
+    _racer_abort(racer);
+  }
+  pthread_mutex_unlock(&racer->hedge->mutex);
+  if (racer->aborted || NULL == (fmt_ctx = avformat_alloc_context())) {
+    return -1;
+  }
+  fmt_ctx->interrupt_callback = racer->int_cb;
+  fmt_ctx->pb = NULL != racer->http ? HttpIoGetAVIO(racer->http) : NULL;
+  racer->fmt_ctx = fmt_ctx;
+  if (avformat_open_input(&racer->fmt_ctx, racer->url, NULL, NULL) < 0 ||
+      avformat_find_stream_info(racer->fmt_ctx, NULL) < 0) {
+    return -1;
+  }
+  idx = av_find_best_stream(racer->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1,
+                            NULL, 0);
+  if (idx < 0 || 0 >= racer->fmt_ctx->streams[idx]->codecpar->sample_rate) {
+    return -1;
+  }
+  return 0;
+}
+
+static void _abort_losers(HedgeOpen *hedge) {
+  int i;
+  for (i = 0; i < hedge->started; i++) {
+    if (i != hedge->winner) {
+      /* still opening here, its latency is at least this long */
+      if (RACER_OPENING == hedge->racers[i].state) {
+        hedge->racers[i].lost_ms = _now_ms();
+      }
+      _racer_abort(&hedge->racers[i]);
+    }
+  }
+}
+
+static void* __hedge_racer_tsk(void *args) {
+  HedgeRacer *racer = (HedgeRacer *)args;
+  HedgeOpen *hedge = racer->hedge;
+  HttpIo *http = NULL;
+  int rc = _racer_open(racer);
+  int won = 0;
+  pthread_mutex_lock(&hedge->mutex);
+  racer->end_ms = _now_ms();
+  racer->state = 0 == rc ? RACER_OPENED : RACER_FAILED;
+  if (0 == rc && hedge->winner < 0) {
+    hedge->winner = racer->index;
+    won = 1;
+    _abort_losers(hedge);
+  }
+  if (!won) {
+    /* loser closes itself, keep abort from touching freed http */
+    http = racer->http;
+    racer->http = NULL;
+  }
+  LOGT(HEDGE_OPEN_TAG, "mirror[%d] %s in %lldms", racer->index,
+       0 == rc ? "opened" : "failed",
+       (long long)(racer->end_ms - racer->start_ms));
+  pthread_cond_broadcast(&hedge->cond);
+  pthread_mutex_unlock(&hedge->mutex);
+  if (!won) {
+    avformat_close_input(&racer->fmt_ctx);
+    HttpIoDestroy(http);
+  }
+  return NULL;
+}
+
+static int _start_racer(HedgeOpen *hedge) {
+  HedgeRacer *racer = &hedge->racers[hedge->started];
+  racer->start_ms = _now_ms();
+  racer->state = RACER_OPENING;
+  if (0 != pthread_create(&racer->thread, NULL, __hedge_racer_tsk, racer)) {
+    LOGE(HEDGE_OPEN_TAG, "create racer[%d] failed", racer->index);
+    racer->state = RACER_IDLE;
+    return -1;
+  }
+  hedge->started++;
+  LOGT(HEDGE_OPEN_TAG, "start mirror[%d] %s", racer->index, racer->url);
+  return 0;
+}
+
+static int _all_failed(HedgeOpen *hedge) {
+  int i;
+  for (i = 0; i < hedge->started; i++) {
+    if (RACER_FAILED != hedge->racers[i].state) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void _timedwait_ms(HedgeOpen *hedge, int64_t until_ms) {
+  struct timespec ts;
+  ts.tv_sec = until_ms / 1000;
+  ts.tv_nsec = (until_ms % 1000) * 1000000;
+  pthread_cond_timedwait(&hedge->cond, &hedge->mutex, &ts);
+}
+
+static void _race(HedgeOpen *hedge, int delay_ms) {
+  int64_t next_ms = hedge->start_ms;
+  pthread_mutex_lock(&hedge->mutex);
+  while (hedge->winner < 0 && _now_ms() < hedge->deadline_ms) {
+    if (hedge->started < hedge->count &&
+        (_now_ms() >= next_ms || _all_failed(hedge))) {
+      if (0 != _start_racer(hedge)) {
+        break;
+      }
+      next_ms = _now_ms() + delay_ms;
+      continue;
+    }
+    if (hedge->started == hedge->count && _all_failed(hedge)) {
+      break;
+    }
+    _timedwait_ms(hedge, hedge->started < hedge->count ?
+                  FFMIN(next_ms, hedge->deadline_ms) : hedge->deadline_ms);
+  }
+  pthread_mutex_unlock(&hedge->mutex);
+}
+
+HedgeOpen* HedgeOpenCreate(const char **urls, int count, int delay_ms,
+                           int timeout_ms) {
+  HedgeOpen *hedge;
+  pthread_condattr_t attr;
+  int i;
+  if (NULL == (hedge = av_mallocz(sizeof(HedgeOpen)))) {
+    LOGE(HEDGE_OPEN_TAG, "alloc hedge open failed");
+    return NULL;
+  }
+  pthread_mutex_init(&hedge->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&hedge->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  hedge->winner = -1;
+  hedge->count = count;
+  hedge->start_ms = _now_ms();
+  hedge->deadline_ms = hedge->start_ms + timeout_ms;
+  hedge->racers = av_mallocz_array(count, sizeof(HedgeRacer));
+  if (NULL == hedge->racers) {
+    goto L_ERROR;
+  }
+  for (i = 0; i < count; i++) {
+    hedge->racers[i].hedge = hedge;
+    hedge->racers[i].index = i;
+    hedge->racers[i].int_cb.callback = _racer_interrupt_cb;
+    hedge->racers[i].int_cb.opaque = &hedge->racers[i];
+    if (NULL == (hedge->racers[i].url = av_strdup(urls[i]))) {
+      goto L_ERROR;
+    }
+  }
+  _race(hedge, delay_ms);
+  if (hedge->winner < 0) {
+    LOGE(HEDGE_OPEN_TAG, "all %d mirrors failed", hedge->started);
+    goto L_ERROR;
+  }
+  LOGT(HEDGE_OPEN_TAG, "mirror[%d] won in %lldms", hedge->winner,
+       (long long)(hedge->racers[hedge->winner].end_ms - hedge->start_ms));
+  return hedge;
+L_ERROR:
+  HedgeOpenDestroy(hedge);
+  return NULL;
+}
+
+void HedgeOpenDestroy(HedgeOpen *hedge) {
+  int i;
+  if (NULL == hedge) {
+    return;
+  }
+  pthread_mutex_lock(&hedge->mutex);
+  for (i = 0; i < hedge->started; i++) {
+    _racer_abort(&hedge->racers[i]);
+  }
+  pthread_mutex_unlock(&hedge->mutex);
+  for (i = 0; i < hedge->started; i++) {
+    if (!hedge->racers[i].joined) {
+      pthread_join(hedge->racers[i].thread, NULL);
+    }
+  }
+  if (0 <= hedge->winner && !hedge->taken) {
+    _racer_close(&hedge->racers[hedge->winner]);
+  }
+  for (i = 0; NULL != hedge->racers && i < hedge->count; i++) {
+    av_free(hedge->racers[i].url);
+  }
+  av_freep(&hedge->racers);
+  pthread_cond_destroy(&hedge->cond);
+  pthread_mutex_destroy(&hedge->mutex);
+  av_free(hedge);
+}
+
+AVFormatContext* HedgeOpenTakeInput(HedgeOpen *hedge, HttpIo **http,
+                                    const AVIOInterruptCB *int_cb) {
+  HedgeRacer *racer = &hedge->racers[hedge->winner];
+  AVFormatContext *fmt_ctx = racer->fmt_ctx;
+  /* winner thread is done with it, before any reader calls back */
+  pthread_join(racer->thread, NULL);
+  racer->joined = 1;
+  racer->owner_cb = *int_cb;
+  racer->adopted = 1;
+  hedge->taken = 1;
+  fmt_ctx->interrupt_callback = *int_cb;
+  racer->fmt_ctx = NULL;
+  *http = racer->http;
+  racer->http = NULL;
+  return fmt_ctx;
+}
+
+int HedgeOpenStatsGet(HedgeOpen *hedge, HedgeOpenStats *stats) {
+  HedgeRacer *primary = &hedge->racers[0];
+  HedgeRacer *winner = &hedge->racers[hedge->winner];
+  pthread_mutex_lock(&hedge->mutex);
+  stats->winner = hedge->winner;
+  stats->open_ms = (int)(winner->end_ms - hedge->start_ms);
+  stats->saved_is_bound = 0;
+  if (0 == hedge->winner) {
+    stats->saved_ms = 0;
+  } else if (0 < primary->lost_ms) {
+    /* aborted while opening, it had already run past the winner */
+    stats->saved_ms = (int)FFMAX(primary->lost_ms - winner->end_ms, 0);
+    stats->saved_is_bound = 1;
+  } else if (RACER_OPENED == primary->state) {
+    stats->saved_ms = (int)(primary->end_ms - winner->end_ms);
+  } else if (RACER_FAILED == primary->state &&
+             primary->end_ms <= winner->end_ms) {
+    /* without hedge winner would only start after primary failed */
+    stats->saved_ms = (int)(primary->end_ms - winner->start_ms);
+  } else {
+    stats->saved_ms = -1;
+  }
+  pthread_mutex_unlock(&hedge->mutex);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_hedge_open.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.25
+ *
+ **************************************************************************/
+#ifndef HEDGE_OPEN_INC_UNI_HEDGE_OPEN_H_
+#define HEDGE_OPEN_INC_UNI_HEDGE_OPEN_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avformat.h>
+#include "uni_http_io.h"
+
+typedef struct HedgeOpen HedgeOpen;
+
+typedef struct {
+  int winner;    /* index of mirror that opened first */
+  int open_ms;   /* create to first decodable frame */
+  int saved_ms;  /* primary mirror latency minus open_ms, -1 unknown */
+  int saved_is_bound; /* primary cut off while opening, saved_ms at least */
+} HedgeOpenStats;
+
+/**
+ * open urls[0] and start the next mirror each delay_ms no mirror has
+ * produced a decodable frame, or right away when one fails. blocks until
+ * the first mirror finds its audio stream, then cancels the rest, primary
+ * included. NULL when every mirror failed within timeout_ms
+ */
+HedgeOpen*       HedgeOpenCreate(const char **urls, int count, int delay_ms,
+                                 int timeout_ms);
+/* aborts and joins racers, frees inputs not taken */
+void             HedgeOpenDestroy(HedgeOpen *hedge);
+
+/**
+ * hand opened input of winner to caller, http NULL if ffmpeg io used.
+ * int_cb replaces the race deadline, also inside io ffmpeg opened itself.
+ * hedge must outlive the input
+ */
+AVFormatContext* HedgeOpenTakeInput(HedgeOpen *hedge, HttpIo **http,
+                                    const AVIOInterruptCB *int_cb);
+int              HedgeOpenStatsGet(HedgeOpen *hedge, HedgeOpenStats *stats);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* HEDGE_OPEN_INC_UNI_HEDGE_OPEN_H_ */
@@ -0,0 +1,228 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_http_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.15
+ *
+ **************************************************************************/
+#include "uni_http_io.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include "uni_net_session.h"
+#include "uni_log.h"
+#include <stdio.h>
+#include <time.h>
+
+#define HTTP_IO_TAG          "http_io"
+#define HTTP_AVIO_BUF_SIZE   (32 * 1024)
+#define HTTP_RATE_WINDOW     (128 * 1024)
+#define HTTP_RATE_IDLE_US    (50 * 1000)
+#define HTTP_RATE_WAIT_US    (1000)
+
+struct HttpIo {
+  char            *url;
+  HttpConn        *conn;
+  int64_t         pos;
+  int64_t         size;
+  int             aborted;
+  AVIOInterruptCB int_cb;
+  AVIOContext     *avio;
+  int64_t         window_bytes;
+  int64_t         window_start_us;
+  int64_t         last_us;
+  int             backlog;
+  int64_t         bps;
+};
+
+static int64_t _now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * wall clock rate while the reader keeps pulling. a reader stalled on its
+ * watermark lets the socket fill, that backlog reads back at memory speed,
+ * so after a stall nothing counts until a read has to wait for the network
+ */
+static void _rate_update(HttpIo *io, int bytes, int64_t begin_us,
+                         int64_t end_us) {
+  int64_t bps, elapsed_us;
+  if (0 == io->last_us || begin_us - io->last_us > HTTP_RATE_IDLE_US) {
+    io->backlog = 1;
+  }
+  io->last_us = end_us;
+  if (io->backlog) {
+    if (end_us - begin_us < HTTP_RATE_WAIT_US) {
+      return;
+    }
+    /* socket drained, window starts at what arrives from here */
+    io->backlog = 0;
+    io->window_bytes = 0;
+    io->window_start_us = end_us;
+    return;
+  }
+  io->window_bytes += bytes;
+  elapsed_us = end_us - io->window_start_us;
+  if (io->window_bytes < HTTP_RATE_WINDOW || elapsed_us <= 0) {
+    return;
+  }
+  bps = io->window_bytes * 8 * 1000000 / elapsed_us;
+  io->bps = 0 == io->bps ? bps : (io->bps * 7 + bps * 3) / 10;
+  io->window_bytes = 0;
+  io->window_start_us = end_us;
+}
+
+static int _http_interrupt_cb(void *ctx) {
+  return ((HttpIo *)ctx)->aborted;
+}
+
+static int _http_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  HttpIo *io = (HttpIo *)opaque;
+  int64_t begin_us = _now_us();
+  int ret;
+  if (io->aborted) {
+    return AVERROR_EOF;
+  }
+  if (NULL == io->conn) {
+    if (0 <= io->size && io->pos >= io->size) {
+      return AVERROR_EOF;
+    }
+    io->conn = NetSessionRequest(io->url, io->pos, 0, &io->int_cb);
+    if (NULL == io->conn) {
+      return AVERROR(EIO);
+    }
+  }
+  if (0 < (ret = HttpConnRead(io->conn, buf, buf_size))) {
+    io->pos += ret;
+    _rate_update(io, ret, begin_us, _now_us());
+  } else if (AVERROR_EOF != ret) {
+    /* drop broken connection, next read resumes with Range at pos */
+    NetSessionRelease(io->conn);
+    io->conn = NULL;
+  }
+  return ret;
+}
+
+static int64_t _http_seek(void *opaque, int64_t offset, int whence) {
+  HttpIo *io = (HttpIo *)opaque;
+  int64_t pos;
+  if (whence & AVSEEK_SIZE) {
+    return 0 <= io->size ? io->size : AVERROR(ENOSYS);
+  }
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = io->pos + offset;
+      break;
+    case SEEK_END:
+      if (io->size < 0) {
+        return AVERROR(ENOSYS);
+      }
+      pos = io->size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos == io->pos) {
+    return pos;
+  }
+  if (pos < 0 || !(io->avio->seekable & AVIO_SEEKABLE_NORMAL)) {
+    return AVERROR(EINVAL);
+  }
+  /* next read issues a Range request, reusing an idle connection if any */
+  NetSessionRelease(io->conn);
+  io->conn = NULL;
+  io->pos = pos;
+  return pos;
+}
+
+HttpIo* HttpIoCreate(const char *url) {
+  HttpIo *io;
+  unsigned char *buffer;
+  if (NULL == (io = av_mallocz(sizeof(HttpIo)))) {
+    LOGE(HTTP_IO_TAG, "alloc http io failed");
+    return NULL;
+  }
+  io->int_cb.callback = _http_interrupt_cb;
+  io->int_cb.opaque = io;
+  if (NULL == (io->url = av_strdup(url))) {
+    goto L_ERROR;
+  }
+  if (NULL == (io->conn = NetSessionRequest(url, 0, 0, &io->int_cb))) {
+    goto L_ERROR;
+  }
+  io->size = HttpConnTotalSize(io->conn);
+  if (NULL == (buffer = av_malloc(HTTP_AVIO_BUF_SIZE))) {
+    LOGE(HTTP_IO_TAG, "alloc avio buffer failed");
+    goto L_ERROR;
+  }
+  io->avio = avio_alloc_context(buffer, HTTP_AVIO_BUF_SIZE, 0, io,
+                                _http_read_packet, NULL, _http_seek);
+  if (NULL == io->avio) {
+    LOGE(HTTP_IO_TAG, "alloc avio context failed");
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  io->avio->seekable = (HttpConnAcceptRanges(io->conn) && 0 <= io->size) ?
+                       AVIO_SEEKABLE_NORMAL : 0;
+  return io;
+L_ERROR:
+  HttpIoDestroy(io);
+  return NULL;
+}
+
+void HttpIoDestroy(HttpIo *io) {
+  if (NULL == io) {
+    return;
+  }
+  NetSessionRelease(io->conn);
+  if (NULL != io->avio) {
+    av_freep(&io->avio->buffer);
+    avio_context_free(&io->avio);
+  }
+  av_freep(&io->url);
+  av_free(io);
+}
+
+AVIOContext* HttpIoGetAVIO(HttpIo *io) {
+  return io->avio;
+}
+
+int HttpIoPause(HttpIo *io) {
+  /* without Range a new request would restart body from byte 0 */
+  if (!(io->avio->seekable & AVIO_SEEKABLE_NORMAL)) {
+    return -1;
+  }
+  NetSessionRelease(io->conn);
+  io->conn = NULL;
+  return 0;
+}
+
+int64_t HttpIoThroughput(HttpIo *io) {
+  return io->bps;
+}
+
+int HttpIoAbort(HttpIo *io) {
+  io->aborted = 1;
+  return 0;
+}
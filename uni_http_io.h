@@ -0,0 +1,52 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_http_io.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.15
+ *
+ **************************************************************************/
+#ifndef HTTP_IO_INC_UNI_HTTP_IO_H_
+#define HTTP_IO_INC_UNI_HTTP_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct HttpIo HttpIo;
+
+/**
+ * single http stream on NetSession, connection goes back to keep-alive pool
+ * when body read to end. return NULL when url is not http(s) or unreachable
+ */
+HttpIo*      HttpIoCreate(const char *url);
+void         HttpIoDestroy(HttpIo *io);
+AVIOContext* HttpIoGetAVIO(HttpIo *io);
+/* close connection from reader thread, next read resumes with Range */
+int          HttpIoPause(HttpIo *io);
+/* delivery rate in bit/s smoothed over recent reads, 0 until measured */
+int64_t      HttpIoThroughput(HttpIo *io);
+/* make blocking read return, used on stop */
+int          HttpIoAbort(HttpIo *io);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* HTTP_IO_INC_UNI_HTTP_IO_H_ */
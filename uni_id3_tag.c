@@ -0,0 +1,250 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_id3_tag.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.24
+ *
+ **************************************************************************/
+#include "uni_id3_tag.h"
+
+#include <libavutil/common.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <string.h>
+
+#define ID3_TAG_TAG            "id3_tag"
+#define ID3_FRAME_HEADER_SIZE  (10)
+#define ID3_TEXT_FRAME_MAX     (4 * 1024)
+#define ID3_FLAG_UNSYNC        (0x80)
+#define ID3_FLAG_EXTENDED      (0x40)
+#define ID3_FLAG_FOOTER        (0x10)
+
+typedef enum {
+  ID3_ENC_LATIN1 = 0,
+  ID3_ENC_UTF16BOM,
+  ID3_ENC_UTF16BE,
+  ID3_ENC_UTF8
+} Id3Encoding;
+
+static const struct {
+  const char *id;
+  const char *key;
+} g_frame_keys[] = {
+  {"TIT2", "title"},
+  {"TPE1", "artist"},
+  {"TALB", "album"},
+  {"TPE2", "album_artist"},
+  {"TCOM", "composer"},
+  {"TCON", "genre"},
+  {"TRCK", "track"},
+  {"TPOS", "disc"},
+  {"TYER", "date"},
+  {"TDRC", "date"},
+  {"TCOP", "copyright"},
+  {"TENC", "encoded_by"},
+  {"TLAN", "language"},
+};
+
+static int64_t _syncsafe32(const uint8_t *p) {
+  return ((int64_t)(p[0] & 0x7f) << 21) | ((p[1] & 0x7f) << 14) |
+         ((p[2] & 0x7f) << 7) | (p[3] & 0x7f);
+}
+
+int64_t Id3TagSize(const uint8_t *header) {
+  if (0 != memcmp(header, "ID3", 3) || 0xff == header[3] ||
+      0xff == header[4] || ((header[6] | header[7] | header[8] |
+                             header[9]) & 0x80)) {
+    return 0;
+  }
+  return ID3_HEADER_SIZE + _syncsafe32(header + 6) +
+         ((header[5] & ID3_FLAG_FOOTER) ? ID3_HEADER_SIZE : 0);
+}
+
+static const char* _frame_key(const char *id) {
+  int i;
+  for (i = 0; i < FF_ARRAY_ELEMS(g_frame_keys); i++) {
+    if (0 == memcmp(id, g_frame_keys[i].id, 4)) {
+      return g_frame_keys[i].key;
+    }
+  }
+  return id;
+}
+
+/* drop 0x00 stuffed after every 0xff, return new length */
+static int _unsync(uint8_t *buf, int len) {
+  int i, o = 0;
+  for (i = 0; i < len; i++) {
+    buf[o++] = buf[i];
+    if (0xff == buf[i] && i + 1 < len && 0x00 == buf[i + 1]) {
+      i++;
+    }
+  }
+  return o;
+}
+
+static uint32_t _get_u16(const uint8_t *p, int len, int *i, int be) {
+  uint32_t val;
+  if (*i + 1 >= len) {
+    return 0;
+  }
+  val = be ? AV_RB16(p + *i) : AV_RL16(p + *i);
+  *i += 2;
+  return val;
+}
+
+/* text frame body to utf-8, first string only, out holds 2 * len + 1 */
+static void _text_to_utf8(const uint8_t *p, int len, char *out) {
+  Id3Encoding enc = p[0];
+  uint32_t val;
+  uint8_t tmp;
+  int i = 1, be = 1;
+  char *o = out;
+  switch (enc) {
+    case ID3_ENC_LATIN1:
+      for (; i < len && 0 != p[i]; i++) {
+        val = p[i];
+        PUT_UTF8(val, tmp, *o++ = tmp;)
+      }
+      break;
+    case ID3_ENC_UTF16BOM:
+      if (len < 3) {
+        break;
+      }
+      be = !(0xff == p[1] && 0xfe == p[2]);
+      i = 3;
+      /* fall through */
+    case ID3_ENC_UTF16BE:
+      while (i + 1 < len) {
+        GET_UTF16(val, _get_u16(p, len, &i, be), break;)
+        if (0 == val) {
+          break;
+        }
+        PUT_UTF8(val, tmp, *o++ = tmp;)
+      }
+      break;
+    case ID3_ENC_UTF8:
+      for (; i < len && 0 != p[i]; i++) {
+        *o++ = p[i];
+      }
+      break;
+    default:
+      LOGW(ID3_TAG_TAG, "unknown text encoding %d", enc);
+      break;
+  }
+  *o = '\0';
+}
+
+static int _read_text_frame(AVIOContext *pb, const char *id, int size,
+                            int unsync, AVDictionary **metadata) {
+  uint8_t *body;
+  char *text;
+  if (NULL == (body = av_malloc(size))) {
+    return -1;
+  }
+  if (size != avio_read(pb, body, size)) {
+    av_free(body);
+    return -1;
+  }
+  if (unsync) {
+    size = _unsync(body, size);
+  }
+  if (0 < size && NULL != (text = av_malloc(2 * size + 1))) {
+    _text_to_utf8(body, size, text);
+    if ('\0' != text[0]) {
+      av_dict_set(metadata, _frame_key(id), text, AV_DICT_DONT_STRDUP_VAL);
+    } else {
+      av_free(text);
+    }
+  }
+  av_free(body);
+  return 0;
+}
+
+static int _skip_extended_header(AVIOContext *pb, int version) {
+  uint8_t buf[4];
+  int64_t size;
+  if (sizeof(buf) != avio_read(pb, buf, sizeof(buf))) {
+    return -1;
+  }
+  /* v2.4 size counts itself, v2.3 does not */
+  size = 4 == version ? _syncsafe32(buf) - 4 : AV_RB32(buf);
+  return size < 0 || avio_skip(pb, size) < 0 ? -1 : 0;
+}
+
+int Id3TagParse(AVIOContext *pb, AVDictionary **metadata) {
+  uint8_t header[ID3_HEADER_SIZE];
+  char id[5] = {0};
+  int64_t end, size;
+  int version, tag_unsync, frame_unsync, skip;
+  if (ID3_HEADER_SIZE != avio_read(pb, header, ID3_HEADER_SIZE) ||
+      0 == Id3TagSize(header)) {
+    return -1;
+  }
+  version = header[3];
+  if (3 != version && 4 != version) {
+    LOGW(ID3_TAG_TAG, "id3v2.%d not supported", version);
+    return -1;
+  }
+  end = avio_tell(pb) + _syncsafe32(header + 6);
+  tag_unsync = 3 == version && (header[5] & ID3_FLAG_UNSYNC);
+  if ((header[5] & ID3_FLAG_EXTENDED) &&
+      0 != _skip_extended_header(pb, version)) {
+    return -1;
+  }
+  while (avio_tell(pb) + ID3_FRAME_HEADER_SIZE <= end) {
+    if (ID3_FRAME_HEADER_SIZE != avio_read(pb, header,
+                                           ID3_FRAME_HEADER_SIZE) ||
+        '\0' == header[0]) {
+      break;  /* padding */
+    }
+    memcpy(id, header, 4);
+    size = 4 == version ? _syncsafe32(header + 4) : AV_RB32(header + 4);
+    if (size > end - avio_tell(pb)) {
+      LOGW(ID3_TAG_TAG, "frame %s overruns tag", id);
+      break;
+    }
+    skip = 0;
+    frame_unsync = tag_unsync;
+    if (4 == version) {
+      /* grouping, data length indicator prefix the body */
+      skip = !!(header[9] & 0x40) + ((header[9] & 0x01) ? 4 : 0);
+      frame_unsync |= !!(header[9] & 0x02);
+    } else {
+      skip = !!(header[9] & 0x20);
+    }
+    /* compressed or encrypted frames are never plain text */
+    if ('T' != id[0] || 0 == strcmp(id, "TXXX") ||
+        (header[9] & (4 == version ? 0x0c : 0xc0)) ||
+        size - skip <= 0 || size > ID3_TEXT_FRAME_MAX) {
+      if (avio_skip(pb, size) < 0) {
+        break;
+      }
+      continue;
+    }
+    if (avio_skip(pb, skip) < 0 ||
+        0 != _read_text_frame(pb, id, (int)(size - skip), frame_unsync,
+                              metadata)) {
+      break;
+    }
+  }
+  LOGT(ID3_TAG_TAG, "id3v2.%d parsed, %d entries", version,
+       av_dict_count(*metadata));
+  return 0;
+}
@@ -0,0 +1,50 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_id3_tag.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.24
+ *
+ **************************************************************************/
+#ifndef ID3_TAG_INC_UNI_ID3_TAG_H_
+#define ID3_TAG_INC_UNI_ID3_TAG_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+#include <libavutil/dict.h>
+
+#define ID3_HEADER_SIZE    (10)
+
+/* whole ID3v2 tag length in bytes incl. header and footer, 0 if no tag */
+int64_t Id3TagSize(const uint8_t *header);
+
+/**
+ * parse text frames of ID3v2.3/2.4 tag starting at current position of pb
+ * into metadata as utf-8, keys named like ffmpeg ("title", "artist"...).
+ * other frames (APIC cover art...) are skipped with avio_skip, so a
+ * seekable network pb never downloads them
+ */
+int     Id3TagParse(AVIOContext *pb, AVDictionary **metadata);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* ID3_TAG_INC_UNI_ID3_TAG_H_ */
@@ -26,16 +26,56 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswresample/swresample.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/avstring.h>
+#include <libavutil/intreadwrite.h>
+#include "uni_audio_sink.h"
+#include "uni_crypt_io.h"
+#include "uni_feed_io.h"
+#include "uni_hedge_open.h"
+#include "uni_http_io.h"
+#include "uni_id3_tag.h"
+#include "uni_net_session.h"
+#include "uni_packet_queue.h"
+#include "uni_pcm_ops.h"
+#include "uni_pcm_volume.h"
+#include "uni_range_io.h"
+#include "uni_shared_fetch.h"
 #include "uni_log.h"
+#include <limits.h>
 #include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MP3_PLAYER_TAG               "mp3_player"
-#define AUDIO_OUT_SIZE               (8 * 1024)
 #define OPEN_INPUT_TIMEOUT_S         (30)
 #define READ_HEADER_TIMEOUT_S        (4)
 #define READ_FRAME_TIMEOUT_S         (5)
 #define AUDIO_RETRIEVE_DATA_FINISHED (-1)
+#define FEED_FIFO_SIZE               (64 * 1024)
+#define FEED_PROBE_SIZE              (8 * 1024)
+#define FEED_URL_NAME                "mp3feed"
+#define PREBUFFER_START_MS           (300)
+#define PREBUFFER_LOW_MS             (0)
+#define PREBUFFER_HIGH_MS            (3000)
+#define RECONNECT_MAX_RETRIES        (5)
+#define RECONNECT_BASE_DELAY_MS      (200)
+#define RECONNECT_MAX_DELAY_MS       (3000)
+#define ID3_SKIP_MIN_SIZE            (64 * 1024)
+#define ID3_SKIP_MARK                "id3v2_size"
+#define ID3_FETCH_BUF_SIZE           (4096)
+#define PAUSE_MEMORY_BUDGET          (4 * 1024 * 1024)
+#define DRIFT_MAX_PPM                (1000)
+#define DRIFT_MIN_INTERVAL_US        (500 * 1000)
+#define DRIFT_SMOOTH                 (0.05)
+#define DRIFT_SETTLE_S               (10)
+#define OUTPUT_BRANCH_MAX            (4)
+#define VOLUME_RAMP_MS               (10)
+#define HEDGE_DELAY_MS               (800)
+#define ABR_MARGIN_PERCENT           (40)
+#define ABR_DOWN_WINDOW_MS           (3000)
+#define ABR_UP_WINDOW_MS             (10000)
+#define ABR_PREROLL_FRAMES           (4)
 
 typedef enum {
   MP3_IDLE_STATE = 0,
@@ -51,7 +91,10 @@ typedef enum {
   MP3_START_EVENT,
   MP3_PAUSE_EVENT,
   MP3_RESUME_EVENT,
-  MP3_STOP_EVENT
+  MP3_STOP_EVENT,
+  MP3_FEED_EVENT,
+  MP3_PLAY_MIRRORS_EVENT,
+  MP3_PLAY_VARIANTS_EVENT
 } Mp3Event;
 
 typedef enum {
@@ -61,14 +104,94 @@ typedef enum {
   BLOCK_READ_FRAME,
 } BlockState;
 
+typedef struct {
+  char **urls;
+  int  count;
+} MirrorList;
+
+typedef struct {
+  Mp3Variant *variants;
+  int        count;
+} VariantList;
+
+typedef struct {
+  Mp3Variant *variants;     /* sorted by bitrate ascending */
+  int        count;
+  int        current;
+  int        target;        /* variant throughput asks for */
+  int64_t    target_since_ms;
+  int64_t    splice_pts;    /* first sample wanted from new variant */
+  int64_t    preroll;       /* decoded then dropped to refill reservoir */
+  int64_t    last_bps;      /* kept across tracks for start choice */
+} AbrState;
+
+/* what a hibernated play needs to reopen at same frame, no probing */
+typedef struct {
+  char              *url;
+  AVInputFormat     *iformat;
+  AVCodecParameters *codecpar;
+  int               stream_idx;
+  AVRational        time_base;
+  int64_t           byte_pos;   /* first undecoded packet, -1 unknown */
+  int64_t           sample_pos; /* same in stream time_base */
+} ResumeRecord;
+
+/* sink clock against our output, guarded by drift_mutex */
+typedef struct {
+  int64_t written;       /* frames handed to sink this play */
+  int64_t last_played;
+  int64_t last_us;       /* 0 before first report */
+  int64_t target_depth;  /* frames, -1 until known */
+  int64_t depth;
+  double  ratio;         /* sink rate / nominal rate, smoothed */
+  double  correction;    /* relative change of output sample count */
+  double  carry;         /* sub-sample part not applied yet */
+} DriftState;
+
+typedef struct {
+  int64_t             layout;
+  int                 rate;
+  enum AVSampleFormat sample_fmt;  /* what swr produces */
+  int                 channels;
+  int                 s24;         /* s32 from swr, packed to 3 bytes */
+} OutFormat;
+
+/* extra rendition of the decoded frames, own swr and sink */
+typedef struct {
+  OutFormat         out;
+  AudioSink         *sink;
+  struct SwrContext *swr;
+  uint8_t           *data[AUDIO_SINK_IOV_MAX];
+  int               capacity;
+  int               failed;
+} OutputBranch;
+
+/* fade asked for before play, applied as playing starts */
+typedef struct {
+  int          valid;
+  float        target;
+  int64_t      start;
+  int64_t      duration;
+  PcmFadeCurve curve;
+} FadeRequest;
+
 typedef struct _ConvertCtxNode{
-  int                    channel_layout;
+  int64_t                channel_layout;
   enum AVSampleFormat    sample_fmt;
   int                    sample_rate;
   struct SwrContext      *au_convert_ctx;
   struct _ConvertCtxNode *next;
 } ConvertCtxNode;
 
+typedef struct {
+  char            *url;
+  int64_t         pos;
+  int64_t         end;
+  int             gen;
+  HttpConn        *conn;
+  AVIOInterruptCB int_cb;
+} Id3Fetch;
+
 static struct {
   AVFormatContext     *fmt_ctx;
   AVCodecContext      *audio_dec_ctx;
@@ -78,15 +201,71 @@ static struct {
   AVPacket            orig_pkt;
   AVFrame             *frame;
   int                 audio_stream_idx;
-  long long           out_channel_layout;
-  int                 out_sample_rate;
-  enum AVSampleFormat out_sample_fmt;
-  int                 out_channels;
-  uint8_t             *out_buffer;
+  int                 demux_stream_idx;
+  OutFormat           out;
+  uint8_t             *out_data[AUDIO_SINK_IOV_MAX];
+  int                 out_capacity;
   Mp3State            state;
   pthread_t           prepare_thread;
+  int                 prepare_running;
+  int                 prepare_cancel;
   int                 last_timestamp;
   int                 block_state;
+  FeedIo              *feed;
+  pthread_mutex_t     feed_mutex;
+  RangeIo             *range;
+  HttpIo              *http;
+  RangeParam          range_param;
+  PacketQueue         *pkt_queue;
+  pthread_t           demux_thread;
+  PrebufferParam      prebuffer_param;
+  int                 abort_request;
+  ReconnectParam      reconnect_param;
+  char                *id3_url;
+  int64_t             id3_size;
+  int                 meta_gen;
+  AVDictionary        *metadata;
+  HedgeOpen           *hedge;
+  HedgeParam          hedge_param;
+  AbrState            abr;
+  AbrParam            abr_param;
+  pthread_mutex_t     io_mutex;
+  CryptIo             *crypt;
+  AVIOContext         *crypt_src;
+  int                 decrypt_key_bits;
+  uint8_t             decrypt_key[32];
+  uint8_t             decrypt_iv[CRYPT_IV_SIZE];
+  SharedFetch         *shared;
+  char                *shared_dir;
+  PauseParam          pause_param;
+  pthread_mutex_t     pause_mutex;
+  pthread_cond_t      pause_cond;
+  int                 demux_paused;
+  int                 retrieve_gen;
+  pthread_t           retrieve_thread;
+  int                 retrieve_running;
+  pthread_mutex_t     fsm_mutex;
+  pthread_cond_t      fsm_cond;
+  HibernateParam      hibernate_param;
+  int                 hibernate_gen;
+  ResumeRecord        resume;
+  char                *url;
+  int64_t             play_pos;
+  int64_t             play_pts;
+  AudioSink           *sink;
+  int                 sinks_kept;
+  DriftState          drift;
+  DriftParam          drift_param;
+  pthread_mutex_t     drift_mutex;
+  int                 period_ms;
+  int                 period_frames;
+  AVAudioFifo         *period_fifo;
+  uint8_t             *period_data[AUDIO_SINK_IOV_MAX];
+  OutputBranch        branches[OUTPUT_BRANCH_MAX];
+  int                 branch_count;
+  PcmVolume           *volume;
+  PcmLimiterParam     limiter_param;
+  FadeRequest         fade_pending;
 } g_mp3_player;
 
 static const char* _block_state_2_string(BlockState state) {
@@ -104,6 +283,9 @@ static int interrupt_cb(void *ctx) {
   int timeout;
   seconds = time((time_t *)NULL);
   LOGD(MP3_PLAYER_TAG, "%s", _block_state_2_string(g_mp3_player.block_state));
+  if (g_mp3_player.abort_request) {
+    return 1;
+  }
   switch (g_mp3_player.block_state) {
     case BLOCK_NULL:
       return 0;
@@ -146,6 +328,12 @@ static char* _event2string(Mp3Event event) {
     return "MP3_RESUME_EVENT";
   case MP3_STOP_EVENT:
     return "MP3_STOP_EVENT";
+  case MP3_FEED_EVENT:
+    return "MP3_FEED_EVENT";
+  case MP3_PLAY_MIRRORS_EVENT:
+    return "MP3_PLAY_MIRRORS_EVENT";
+  case MP3_PLAY_VARIANTS_EVENT:
+    return "MP3_PLAY_VARIANTS_EVENT";
   default:
     break;
   }
@@ -171,11 +359,23 @@ static char* _state2string(Mp3State state) {
 }
 
 static void _mp3_set_state(Mp3State state) {
+  /* wake retrieve thread parked in pause */
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
   g_mp3_player.state = state;
+  /* stream position 0 is now, under the lock Mp3Fade checks state with */
+  if (MP3_PLAYING_STATE == state && g_mp3_player.fade_pending.valid) {
+    PcmVolumeFade(g_mp3_player.volume, g_mp3_player.fade_pending.target,
+                  g_mp3_player.fade_pending.start,
+                  g_mp3_player.fade_pending.duration,
+                  g_mp3_player.fade_pending.curve);
+    g_mp3_player.fade_pending.valid = 0;
+  }
+  pthread_cond_broadcast(&g_mp3_player.pause_cond);
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
   LOGT(MP3_PLAYER_TAG, "mp3 state is set to %d", state);
 }
 
-static ConvertCtxNode* _create_convert_ctx_node(int channel_layout,
+static ConvertCtxNode* _create_convert_ctx_node(int64_t channel_layout,
                                                 enum AVSampleFormat sample_fmt,
                                                 int sample_rate) {
   ConvertCtxNode *node, *head = g_mp3_player.convert_ctx_list;
@@ -184,9 +384,9 @@ static ConvertCtxNode* _create_convert_ctx_node(int channel_layout,
   node->sample_fmt = sample_fmt;
   node->sample_rate = sample_rate;
   node->au_convert_ctx = swr_alloc_set_opts(NULL,
-                                            g_mp3_player.out_channel_layout,
-                                            g_mp3_player.out_sample_fmt,
-                                            g_mp3_player.out_sample_rate,
+                                            g_mp3_player.out.layout,
+                                            g_mp3_player.out.sample_fmt,
+                                            g_mp3_player.out.rate,
                                             node->channel_layout,
                                             node->sample_fmt,
                                             node->sample_rate,
@@ -212,7 +412,18 @@ static void _destroy_convert_ctx_node(ConvertCtxNode *node) {
   }
 }
 
-static void _choose_au_convert_ctx(int channel_layout,
+static void _convert_ctx_list_free(void) {
+  ConvertCtxNode *head = g_mp3_player.convert_ctx_list;
+  ConvertCtxNode *node = head;
+  while (NULL != node) {
+    head = node->next;
+    _destroy_convert_ctx_node(node);
+    node = head;
+  }
+  g_mp3_player.convert_ctx_list = NULL;
+}
+
+static void _choose_au_convert_ctx(int64_t channel_layout,
                                    enum AVSampleFormat sample_fmt,
                                    int sample_rate) {
   ConvertCtxNode *node = g_mp3_player.convert_ctx_list;
@@ -221,7 +432,7 @@ static void _choose_au_convert_ctx(int channel_layout,
         node->sample_fmt == sample_fmt &&
         node->sample_rate == sample_rate) {
       g_mp3_player.au_convert_ctx = node->au_convert_ctx;
-      LOGW(MP3_PLAYER_TAG, "channel_layout=%d, sample_fmt=%d,"
+      LOGW(MP3_PLAYER_TAG, "channel_layout=%"PRId64", sample_fmt=%d,"
            "sample_rate=%d", node->channel_layout, node->sample_fmt,
            node->sample_rate);
       return;
@@ -281,230 +492,1488 @@ static void _set_block_state(BlockState state) {
   g_mp3_player.block_state = state;
 }
 
-static int _mp3_prepare_internal(const char *url) {
-  av_register_all();
-  avformat_network_init();
-  g_mp3_player.fmt_ctx = avformat_alloc_context();
-  if (NULL == g_mp3_player.fmt_ctx) {
-    LOGE(MP3_PLAYER_TAG, "Could not alloc context");
-    return -1;
+static int _is_http_url(const char *url) {
+  return 0 == strncmp(url, "http://", 7) || 0 == strncmp(url, "https://", 8);
+}
+
+static int _range_io_enabled(const char *url) {
+  return g_mp3_player.range_param.connections > 1 &&
+         g_mp3_player.range_param.chunk_size > 0 && _is_http_url(url);
+}
+
+static int _packet_duration_ms(AVPacket *pkt) {
+  AVStream *st = g_mp3_player.fmt_ctx->streams[g_mp3_player.demux_stream_idx];
+  if (0 < pkt->duration) {
+    return (int)av_rescale_q(pkt->duration, st->time_base,
+                             (AVRational){1, 1000});
   }
-  g_mp3_player.fmt_ctx->interrupt_callback = int_cb;
-  _set_block_state(BLOCK_OPEN_INPUT);
-  LOGT(MP3_PLAYER_TAG, "before avformat_open_input");
-  if (avformat_open_input(&g_mp3_player.fmt_ctx, url, NULL, NULL) < 0) {
-    LOGE(MP3_PLAYER_TAG, "Could not open source file %s", url);
-    return -1;
+  if (0 < st->codecpar->frame_size && 0 < st->codecpar->sample_rate) {
+    return 1000 * st->codecpar->frame_size / st->codecpar->sample_rate;
   }
-  _set_block_state(BLOCK_READ_HEADER);
-  LOGT(MP3_PLAYER_TAG, "before avformat_find_stream_info");
-  if (avformat_find_stream_info(g_mp3_player.fmt_ctx, NULL) < 0) {
-    LOGE(MP3_PLAYER_TAG, "Could not find stream information");
-    return -1;
+  return 0;
+}
+
+static int _demux_premature_end(int ret) {
+  AVIOContext *pb = g_mp3_player.fmt_ctx->pb;
+  int64_t size;
+  if (AVERROR_EOF != ret) {
+    return 1;
   }
-  LOGT(MP3_PLAYER_TAG, "before _open_codec_context");
-  if (_open_codec_context(&g_mp3_player.audio_stream_idx,
-                         &g_mp3_player.audio_dec_ctx,
-                         g_mp3_player.fmt_ctx, AVMEDIA_TYPE_AUDIO) < 0) {
-    LOGE(MP3_PLAYER_TAG, "Open codec context failed");
-    return -1;
+  /* connection dropped before Content-Length reached looks like eof */
+  size = (NULL != pb ? avio_size(pb) : -1);
+  return 0 < size && avio_tell(pb) < size;
+}
+
+static void _demux_backoff(int delay_ms) {
+  while (0 < delay_ms && !g_mp3_player.abort_request) {
+    usleep(1000 * FFMIN(delay_ms, 10));
+    delay_ms -= 10;
   }
-  if (NULL == g_mp3_player.fmt_ctx->streams[g_mp3_player.audio_stream_idx]) {
-    LOGE(MP3_PLAYER_TAG, "Could not find audio stream");
+}
+
+/* byte seek makes any AVIO backend issue a Range request at resume_pos */
+static int _demux_reconnect(int64_t resume_pos, int attempt) {
+  ReconnectParam *param = &g_mp3_player.reconnect_param;
+  int ret;
+  if (resume_pos < 0 || attempt >= param->max_retries ||
+      g_mp3_player.abort_request) {
     return -1;
   }
-  _set_block_state(BLOCK_NULL);
-  LOGT(MP3_PLAYER_TAG, "before av_dump_format");
-  av_dump_format(g_mp3_player.fmt_ctx, 0, url, 0);
-  if (NULL == (g_mp3_player.frame = av_frame_alloc())) {
-    LOGE(MP3_PLAYER_TAG, "Could not allocate frame");
-    return -1;
+  LOGW(MP3_PLAYER_TAG, "reconnect[%d] at byte %lld", attempt + 1,
+       (long long)resume_pos);
+  _demux_backoff(FFMIN(param->base_delay_ms << FFMIN(attempt, 16),
+                       param->max_delay_ms));
+  _set_block_state(BLOCK_READ_FRAME);
+  if ((ret = av_seek_frame(g_mp3_player.fmt_ctx, -1, resume_pos,
+                           AVSEEK_FLAG_BYTE)) < 0) {
+    LOGW(MP3_PLAYER_TAG, "resume seek failed[%s]", av_err2str(ret));
+    return 0;
   }
-  av_init_packet(&g_mp3_player.pkt);
-  g_mp3_player.pkt.data = NULL;
-  g_mp3_player.pkt.size = 0;
-  g_mp3_player.out_buffer = (uint8_t *)av_malloc(AUDIO_OUT_SIZE);
-  LOGT(MP3_PLAYER_TAG, "before _choose_au_convert_ctx");
-  _choose_au_convert_ctx(av_get_default_channel_layout( \
-                         g_mp3_player.audio_dec_ctx->channels),
-                         g_mp3_player.audio_dec_ctx->sample_fmt,
-                         g_mp3_player.audio_dec_ctx->sample_rate);
-  LOGT(MP3_PLAYER_TAG, "prepare internal success");
+  /* mp3 parser resyncs to next frame header from here */
+  g_mp3_player.fmt_ctx->pb->error = 0;
   return 0;
 }
 
-static void _write_databuffer(char *buf, int len, int *actual_write_size) {
-  static int total_len = 0;
-  total_len += len;
-  LOGT(MP3_PLAYER_TAG, "len=%d, total_len=%d, total=%ds",
-       len, total_len, total_len / 32000);
-  //usleep(1000 * len / 32);
-  *actual_write_size = len;
+static int64_t _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static int _swr_context_cache_check_and_process(int *decode_byte_len) {
-  int cache_size = 0;
-  int data_len;
-  cache_size = swr_get_out_samples(g_mp3_player.au_convert_ctx, 0);
-  if (g_mp3_player.frame->nb_samples > 0 &&
-      cache_size >= g_mp3_player.frame->nb_samples) {
-    data_len = swr_convert(g_mp3_player.au_convert_ctx,
-                           &g_mp3_player.out_buffer,
-                           AUDIO_OUT_SIZE / 2, NULL, 0);
-    data_len *= (av_get_bytes_per_sample(g_mp3_player.out_sample_fmt) *
-                g_mp3_player.out_channels);
-    if (0 == data_len) {
-      LOGW(MP3_PLAYER_TAG, "try read swr_cache, cannot get data, datasize=0");
-      goto L_END;
+/* highest variant measured throughput sustains with margin, else lowest */
+static int _abr_pick(int64_t bps) {
+  AbrState *abr = &g_mp3_player.abr;
+  int i, pick = 0;
+  for (i = 0; i < abr->count; i++) {
+    if ((int64_t)abr->variants[i].bitrate_kbps * 10 *
+        (100 + g_mp3_player.abr_param.margin_percent) <= bps) {
+      pick = i;
     }
-    _write_databuffer((char *)g_mp3_player.out_buffer, data_len,
-                      decode_byte_len);
-    return 0;
   }
-L_END:
+  return pick;
+}
+
+/**
+ * open variant and seek a few frames before splice_pts, decoder and
+ * resampler are kept so variants may differ in bitrate only
+ */
+static int _abr_switch(int variant, int64_t splice_pts) {
+  AbrState *abr = &g_mp3_player.abr;
+  const char *url = abr->variants[variant].url;
+  AVFormatContext *fmt_ctx = NULL, *old_ctx = g_mp3_player.fmt_ctx;
+  AVStream *st, *old_st = old_ctx->streams[g_mp3_player.demux_stream_idx];
+  HttpIo *http, *old_http;
+  int64_t ts, preroll;
+  int idx;
+  if (NULL == (http = HttpIoCreate(url))) {
+    return -1;
+  }
+  if (NULL == (fmt_ctx = avformat_alloc_context())) {
+    goto L_ERROR;
+  }
+  fmt_ctx->interrupt_callback = int_cb;
+  fmt_ctx->pb = HttpIoGetAVIO(http);
+  if (avformat_open_input(&fmt_ctx, url, av_find_input_format("mp3"),
+                          NULL) < 0 ||
+      avformat_find_stream_info(fmt_ctx, NULL) < 0 ||
+      0 > (idx = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1,
+                                     NULL, 0))) {
+    LOGW(MP3_PLAYER_TAG, "open variant %s failed", url);
+    goto L_ERROR;
+  }
+  st = fmt_ctx->streams[idx];
+  if (st->codecpar->sample_rate != old_st->codecpar->sample_rate ||
+      st->codecpar->channels != old_st->codecpar->channels) {
+    LOGW(MP3_PLAYER_TAG, "variant %s format differs, skip", url);
+    goto L_ERROR;
+  }
+  ts = av_rescale_q(splice_pts, old_st->time_base, st->time_base);
+  preroll = av_rescale_q(ABR_PREROLL_FRAMES *
+                         FFMAX(st->codecpar->frame_size, 1152),
+                         (AVRational){1, st->codecpar->sample_rate},
+                         st->time_base);
+  if (av_seek_frame(fmt_ctx, idx, FFMAX(ts - preroll, 0),
+                    AVSEEK_FLAG_BACKWARD) < 0) {
+    LOGW(MP3_PLAYER_TAG, "variant %s not seekable", url);
+    goto L_ERROR;
+  }
+  pthread_mutex_lock(&g_mp3_player.io_mutex);
+  if (g_mp3_player.abort_request) {
+    pthread_mutex_unlock(&g_mp3_player.io_mutex);
+    goto L_ERROR;
+  }
+  old_http = g_mp3_player.http;
+  g_mp3_player.fmt_ctx = fmt_ctx;
+  g_mp3_player.http = http;
+  g_mp3_player.demux_stream_idx = idx;
+  pthread_mutex_unlock(&g_mp3_player.io_mutex);
+  avformat_close_input(&old_ctx);
+  HttpIoDestroy(old_http);
+  LOGT(MP3_PLAYER_TAG, "switch variant %dkbps -> %dkbps",
+       abr->variants[abr->current].bitrate_kbps,
+       abr->variants[variant].bitrate_kbps);
+  abr->current = variant;
+  abr->splice_pts = ts;
+  abr->preroll = preroll;
+  return 0;
+L_ERROR:
+  avformat_close_input(&fmt_ctx);
+  HttpIoDestroy(http);
   return -1;
 }
 
-static int _decode_packet(int *decode_byte_len) {
-  int ret = 0;
-  int decoded = g_mp3_player.pkt.size;
-  int got_frame = 0;
-  int data_len;
-  if (g_mp3_player.pkt.stream_index == g_mp3_player.audio_stream_idx) {
-    if (0 == _swr_context_cache_check_and_process(decode_byte_len)) {
-      return 0;
-    }
-    ret = avcodec_decode_audio4(g_mp3_player.audio_dec_ctx, g_mp3_player.frame,
-                                &got_frame, &g_mp3_player.pkt);
-    if (ret < 0) {
-      *decode_byte_len = AUDIO_RETRIEVE_DATA_FINISHED;
-      LOGE(MP3_PLAYER_TAG, "Error decoding audio frame (%s)", av_err2str(ret));
-      return -1;
-    }
-    decoded = FFMIN(ret, g_mp3_player.pkt.size);
-    if (got_frame) {
-      if ((data_len = swr_convert(g_mp3_player.au_convert_ctx,
-                                  &g_mp3_player.out_buffer, AUDIO_OUT_SIZE / 2,
-                                  g_mp3_player.frame->data,
-                                  g_mp3_player.frame->nb_samples)) < 0) {
-        LOGE(MP3_PLAYER_TAG, "Could not convert input samples (error '%s')",
-             av_err2str(data_len));
-        return data_len;
-      }
-      data_len *= (av_get_bytes_per_sample(g_mp3_player.out_sample_fmt) *
-                   g_mp3_player.out_channels);
-      _write_databuffer((char *)g_mp3_player.out_buffer, data_len,
-                        decode_byte_len);
-    }
+/* 1 when switched, only after throughput asked for it long enough */
+static int _abr_check(int64_t next_pts) {
+  AbrState *abr = &g_mp3_player.abr;
+  int64_t bps, now = _now_ms();
+  int target, window_ms;
+  if (abr->count < 2 || NULL == g_mp3_player.http ||
+      AV_NOPTS_VALUE == next_pts ||
+      0 == (bps = HttpIoThroughput(g_mp3_player.http))) {
+    return 0;
   }
-  return decoded;
+  if ((target = _abr_pick(bps)) == abr->current) {
+    abr->target_since_ms = 0;
+    return 0;
+  }
+  if (target != abr->target || 0 == abr->target_since_ms) {
+    abr->target = target;
+    abr->target_since_ms = now;
+    return 0;
+  }
+  window_ms = target < abr->current ? g_mp3_player.abr_param.down_window_ms :
+                                      g_mp3_player.abr_param.up_window_ms;
+  if (now - abr->target_since_ms < window_ms) {
+    return 0;
+  }
+  LOGT(MP3_PLAYER_TAG, "throughput %lldkbps", (long long)(bps / 1000));
+  abr->target_since_ms = 0;
+  return 0 == _abr_switch(target, next_pts);
 }
 
-static int _audio_player_callback() {
-  int ret, decode_byte_len = 0;
-  if (MP3_PLAYING_STATE != g_mp3_player.state) {
+/**
+ * splice at frame boundary: drop packets before preroll, let decoder
+ * discard preroll samples through skip side data, sample accurate to pts
+ */
+static int _abr_splice(AVPacket *pkt) {
+  AbrState *abr = &g_mp3_player.abr;
+  AVStream *st = g_mp3_player.fmt_ctx->streams[g_mp3_player.demux_stream_idx];
+  uint8_t *side;
+  int64_t skip = 0;
+  if (AV_NOPTS_VALUE == abr->splice_pts) {
     return 0;
   }
-  _set_block_state(BLOCK_READ_FRAME);
-  if (0 == g_mp3_player.pkt.size) {
-    if ((ret = av_read_frame(g_mp3_player.fmt_ctx, &g_mp3_player.pkt)) < 0) {
-      LOGE(MP3_PLAYER_TAG, "Demuxing succeeded[%d-->%s]", ret, av_err2str(ret));
-      return AUDIO_RETRIEVE_DATA_FINISHED;
+  if (AV_NOPTS_VALUE != pkt->pts) {
+    if (pkt->pts + pkt->duration <= abr->splice_pts - abr->preroll) {
+      return -1;
     }
-    g_mp3_player.orig_pkt = g_mp3_player.pkt;
+    skip = av_rescale_q(abr->splice_pts - pkt->pts, st->time_base,
+                        (AVRational){1, st->codecpar->sample_rate});
   }
-  do {
-    if (g_mp3_player.pkt.size <= 0) {
+  abr->splice_pts = AV_NOPTS_VALUE;
+  if (skip < 0) {
+    LOGW(MP3_PLAYER_TAG, "variant starts %lld samples late",
+         (long long)-skip);
+  }
+  if (skip <= 0) {
+    return 0;
+  }
+  if (NULL != (side = av_packet_new_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES,
+                                              10))) {
+    AV_WL32(side, (uint32_t)skip);
+  }
+  return 0;
+}
+
+/* stop network policy parks demux here, server may drop us meanwhile */
+static void _demux_pause_point(void) {
+  int paused;
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  paused = g_mp3_player.demux_paused;
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  if (!paused) {
+    return;
+  }
+  av_read_pause(g_mp3_player.fmt_ctx);
+  if (NULL != g_mp3_player.http && 0 == HttpIoPause(g_mp3_player.http)) {
+    LOGT(MP3_PLAYER_TAG, "connection released while paused");
+  }
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  while (g_mp3_player.demux_paused && !g_mp3_player.abort_request) {
+    pthread_cond_wait(&g_mp3_player.pause_cond, &g_mp3_player.pause_mutex);
+  }
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  /* a dropped connection shows up as read error, reconnect resumes it */
+  av_read_play(g_mp3_player.fmt_ctx);
+}
+
+static void* __demux_tsk(void *args) {
+  AVPacket pkt;
+  int64_t resume_pos = -1, next_pts;
+  int ret, attempt = 0;
+  av_init_packet(&pkt);
+  pkt.data = NULL;
+  pkt.size = 0;
+  while (1) {
+    _demux_pause_point();
+    _set_block_state(BLOCK_READ_FRAME);
+    if ((ret = av_read_frame(g_mp3_player.fmt_ctx, &pkt)) < 0) {
+      if (_demux_premature_end(ret) &&
+          0 == _demux_reconnect(resume_pos, attempt++)) {
+        continue;
+      }
+      LOGT(MP3_PLAYER_TAG, "Demuxing succeeded[%d-->%s]", ret,
+           av_err2str(ret));
       break;
     }
-    ret = _decode_packet(&decode_byte_len);
-    if (ret < 0) {
+    _set_block_state(BLOCK_NULL);
+    if (pkt.stream_index != g_mp3_player.demux_stream_idx ||
+        0 != _abr_splice(&pkt)) {
+      av_packet_unref(&pkt);
+      continue;
+    }
+    attempt = 0;
+    if (0 <= pkt.pos) {
+      resume_pos = pkt.pos + pkt.size;
+    }
+    next_pts = (AV_NOPTS_VALUE != pkt.pts ? pkt.pts + pkt.duration :
+                AV_NOPTS_VALUE);
+    /* variants may number streams differently, decoder knows only one */
+    pkt.stream_index = g_mp3_player.audio_stream_idx;
+    if (0 != PacketQueuePut(g_mp3_player.pkt_queue, &pkt,
+                            _packet_duration_ms(&pkt))) {
+      av_packet_unref(&pkt);
       break;
     }
-    g_mp3_player.pkt.data += ret;
-    g_mp3_player.pkt.size -= ret;
-  } while (0);
-  if (0 == g_mp3_player.pkt.size) {
-    av_packet_unref(&g_mp3_player.orig_pkt);
-    memset(&g_mp3_player.orig_pkt, 0, sizeof(g_mp3_player.orig_pkt));
+    if (_abr_check(next_pts)) {
+      /* byte offsets of old variant mean nothing to the new one */
+      resume_pos = avio_tell(g_mp3_player.fmt_ctx->pb);
+    }
   }
-  return decode_byte_len;
+  _set_block_state(BLOCK_NULL);
+  PacketQueueEnd(g_mp3_player.pkt_queue);
+  return NULL;
 }
 
-int retrieve_done = 0;
+static int _demux_start_internal(void) {
+  PrebufferParam *param = &g_mp3_player.prebuffer_param;
+  /* pushed data is already local, start on first frame */
+  int start_ms = (NULL != g_mp3_player.feed ? 0 : param->start_ms);
+  g_mp3_player.pkt_queue = PacketQueueCreate(start_ms, param->low_ms,
+                                             param->high_ms);
+  if (NULL == g_mp3_player.pkt_queue) {
+    return -1;
+  }
+  if (0 != pthread_create(&g_mp3_player.demux_thread, NULL, __demux_tsk,
+                          NULL)) {
+    LOGE(MP3_PLAYER_TAG, "create demux thread failed");
+    PacketQueueDestroy(g_mp3_player.pkt_queue);
+    g_mp3_player.pkt_queue = NULL;
+    return -1;
+  }
+  return 0;
+}
 
-static void* __retrieve_tsk(void *args) {
-  while (1) {
-    if (AUDIO_RETRIEVE_DATA_FINISHED == _audio_player_callback()) break;
+/* jump over big ID3v2 tag (cover art) with one Range request */
+static int64_t _id3_skip(AVIOContext *pb) {
+  uint8_t header[ID3_HEADER_SIZE];
+  int64_t size;
+  if (!(pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+    return 0;
   }
-  retrieve_done = 1;
-  return NULL;
+  if (ID3_HEADER_SIZE != avio_read(pb, header, ID3_HEADER_SIZE)) {
+    avio_seek(pb, 0, SEEK_SET);
+    return 0;
+  }
+  size = Id3TagSize(header);
+  /* small tag costs less than a new request, let ffmpeg read through */
+  if (size < ID3_SKIP_MIN_SIZE || size >= avio_size(pb) ||
+      avio_seek(pb, size, SEEK_SET) < 0) {
+    avio_seek(pb, 0, SEEK_SET);
+    return 0;
+  }
+  LOGT(MP3_PLAYER_TAG, "skip id3v2 tag, %lld bytes", (long long)size);
+  return size;
 }
 
-static void _mp3_start_internal(void) {
-  pthread_t pid;
-  pthread_create(&pid, NULL, __retrieve_tsk, NULL);
-  pthread_detach(pid);
+/* hibernated play knows its stream, skip find_stream_info and seek */
+static int _resume_seek(void) {
+  ResumeRecord *resume = &g_mp3_player.resume;
+  AVFormatContext *fmt_ctx = g_mp3_player.fmt_ctx;
+  AVStream *st;
+  int ret;
+  if (resume->stream_idx >= (int)fmt_ctx->nb_streams) {
+    LOGE(MP3_PLAYER_TAG, "resume stream %d missing", resume->stream_idx);
+    return -1;
+  }
+  st = fmt_ctx->streams[resume->stream_idx];
+  if (avcodec_parameters_copy(st->codecpar, resume->codecpar) < 0) {
+    return -1;
+  }
+  _set_block_state(BLOCK_READ_FRAME);
+  if (0 <= resume->byte_pos) {
+    ret = av_seek_frame(fmt_ctx, -1, resume->byte_pos, AVSEEK_FLAG_BYTE);
+  } else {
+    ret = av_seek_frame(fmt_ctx, resume->stream_idx,
+                        av_rescale_q(resume->sample_pos, resume->time_base,
+                                     st->time_base), AVSEEK_FLAG_BACKWARD);
+  }
+  if (ret < 0) {
+    LOGE(MP3_PLAYER_TAG, "resume seek failed[%s]", av_err2str(ret));
+    return -1;
+  }
+  return 0;
 }
 
-static int _mp3_release_internal(void) {
-  if (0 != g_mp3_player.orig_pkt.size) {
-    av_packet_unref(&g_mp3_player.orig_pkt);
-    memset(&g_mp3_player.orig_pkt, 0, sizeof(g_mp3_player.orig_pkt));
+static int _mp3_open_input_internal(const char *url, AVIOContext *pb) {
+  AVInputFormat *fmt = NULL;
+  if (NULL == pb && NULL != g_mp3_player.shared_dir && _is_http_url(url)) {
+    /* players on this host share one download of url */
+    g_mp3_player.shared = SharedFetchOpen(url, g_mp3_player.shared_dir);
+    if (NULL != g_mp3_player.shared) {
+      pb = SharedFetchGetAVIO(g_mp3_player.shared);
+    } else {
+      LOGW(MP3_PLAYER_TAG, "shared fetch unavailable, fetch alone");
+    }
   }
-  if (g_mp3_player.audio_dec_ctx) {
-    avcodec_free_context(&g_mp3_player.audio_dec_ctx);
-    g_mp3_player.audio_dec_ctx = NULL;
+  if (NULL == pb && _range_io_enabled(url)) {
+    g_mp3_player.range = RangeIoCreate(url,
+                                       g_mp3_player.range_param.connections,
+                                       g_mp3_player.range_param.chunk_size,
+                                       g_mp3_player.range_param.memory_budget);
+    if (NULL != g_mp3_player.range) {
+      pb = RangeIoGetAVIO(g_mp3_player.range);
+    } else {
+      LOGW(MP3_PLAYER_TAG, "range io unavailable, use single connection");
+    }
   }
-  if (g_mp3_player.fmt_ctx) {
-    avformat_close_input(&g_mp3_player.fmt_ctx);
-    g_mp3_player.fmt_ctx = NULL;
+  if (NULL == pb && _is_http_url(url)) {
+    /* session keeps connection alive for next track on same host */
+    if (NULL != (g_mp3_player.http = HttpIoCreate(url))) {
+      pb = HttpIoGetAVIO(g_mp3_player.http);
+    } else {
+      LOGW(MP3_PLAYER_TAG, "http io unavailable, use ffmpeg http");
+    }
   }
-  if (g_mp3_player.frame) {
-    av_frame_free(&g_mp3_player.frame);
-    g_mp3_player.frame = NULL;
+  if (0 < g_mp3_player.decrypt_key_bits) {
+    /* file or ffmpeg protocol, decrypt wraps any byte source */
+    if (NULL == pb && avio_open2(&g_mp3_player.crypt_src, url,
+                                 AVIO_FLAG_READ, &int_cb, NULL) < 0) {
+      LOGE(MP3_PLAYER_TAG, "Could not open source file %s", url);
+      return -1;
+    }
+    g_mp3_player.crypt = CryptIoCreate(NULL != pb ? pb :
+                                       g_mp3_player.crypt_src,
+                                       g_mp3_player.decrypt_key,
+                                       g_mp3_player.decrypt_key_bits,
+                                       g_mp3_player.decrypt_iv);
+    if (NULL == g_mp3_player.crypt) {
+      return -1;
+    }
+    pb = CryptIoGetAVIO(g_mp3_player.crypt);
+  }
+  g_mp3_player.fmt_ctx = avformat_alloc_context();
+  if (NULL == g_mp3_player.fmt_ctx) {
+    LOGE(MP3_PLAYER_TAG, "Could not alloc context");
+    return -1;
   }
-  if (g_mp3_player.out_buffer) {
-    av_free(g_mp3_player.out_buffer);
-    g_mp3_player.out_buffer = NULL;
+  g_mp3_player.fmt_ctx->interrupt_callback = int_cb;
+  g_mp3_player.fmt_ctx->pb = pb;
+  if (NULL != g_mp3_player.feed) {
+    /* feed is always mp3, skip probe so decode starts on first frame */
+    g_mp3_player.fmt_ctx->probesize = FEED_PROBE_SIZE;
+    fmt = av_find_input_format("mp3");
+  }
+  if ((NULL != g_mp3_player.range || NULL != g_mp3_player.http) &&
+      0 < (g_mp3_player.id3_size = _id3_skip(pb))) {
+    /* probe only works from offset 0, tag says mp3 anyway */
+    fmt = av_find_input_format("mp3");
+    /* non-empty metadata stops mp3 demuxer seeking for ID3v1, on open only */
+    av_dict_set_int(&g_mp3_player.fmt_ctx->metadata, ID3_SKIP_MARK,
+                    g_mp3_player.id3_size, 0);
+    g_mp3_player.id3_url = av_strdup(url);
+  }
+  if (NULL != g_mp3_player.resume.codecpar) {
+    fmt = g_mp3_player.resume.iformat;
+  }
+  _set_block_state(BLOCK_OPEN_INPUT);
+  LOGT(MP3_PLAYER_TAG, "before avformat_open_input");
+  if (avformat_open_input(&g_mp3_player.fmt_ctx, url, fmt, NULL) < 0) {
+    LOGE(MP3_PLAYER_TAG, "Could not open source file %s", url);
+    return -1;
+  }
+  /* size lives in id3_size, keep the mark out of user visible metadata */
+  av_dict_set(&g_mp3_player.fmt_ctx->metadata, ID3_SKIP_MARK, NULL, 0);
+  if (NULL != g_mp3_player.resume.codecpar) {
+    return _resume_seek();
+  }
+  _set_block_state(BLOCK_READ_HEADER);
+  LOGT(MP3_PLAYER_TAG, "before avformat_find_stream_info");
+  if (avformat_find_stream_info(g_mp3_player.fmt_ctx, NULL) < 0) {
+    LOGE(MP3_PLAYER_TAG, "Could not find stream information");
+    return -1;
   }
-  avformat_network_deinit();
-  g_mp3_player.au_convert_ctx = NULL;
   return 0;
 }
 
-static void _mp3_stop_internal(void) {
+/* bytes of one frame as the sink sees it */
+static int _frame_bytes(const OutFormat *out) {
+  return (out->s24 ? 3 : av_get_bytes_per_sample(out->sample_fmt)) *
+         out->channels;
 }
 
-static int _mp3_fsm(Mp3Event event, void *param) {
-  int rc = -1;
-  switch (g_mp3_player.state) {
-    case MP3_IDLE_STATE:
-      if (MP3_PLAY_EVENT == event) {
-        _mp3_release_internal();
-        if (0 == _mp3_prepare_internal((char *)param)) {
-          _mp3_start_internal();
-          _mp3_set_state(MP3_PLAYING_STATE);
-          rc = 0;
-          break;
-        }
-        _mp3_release_internal();
-        break;
-      }
-      if (MP3_PREPARE_EVENT == event) {
-      }
-      break;
+static int _planes(const OutFormat *out) {
+  return av_sample_fmt_is_planar(out->sample_fmt) ? out->channels : 1;
+}
+
+/* plane pointers of data advanced by offset samples */
+static void _planes_at(const OutFormat *out, uint8_t **dst, uint8_t **data,
+                       int offset) {
+  int bytes = av_get_bytes_per_sample(out->sample_fmt) * offset;
+  int i, planes = _planes(out);
+  if (1 == planes) {
+    bytes *= out->channels;
+  }
+  for (i = 0; i < planes; i++) {
+    dst[i] = data[i] + bytes;
+  }
+}
+
+/**
+ * swr output as sink iov, one per plane. s24 is carried as s32 through
+ * swr and fifo, packed to 3 bytes in place right before the write
+ */
+static int _pack_iov(const OutFormat *out, struct iovec *iov, uint8_t **data,
+                     int offset, int samples) {
+  uint8_t *planes[AUDIO_SINK_IOV_MAX];
+  int i, n = _planes(out);
+  int count = (1 == n ? samples * out->channels : samples);
+  _planes_at(out, planes, data, offset);
+  for (i = 0; i < n; i++) {
+    if (out->s24) {
+      PcmPackS24(planes[i], (const int32_t *)planes[i], count);
+    }
+    iov[i].iov_base = planes[i];
+    iov[i].iov_len = count * (_frame_bytes(out) / out->channels);
+  }
+  return n;
+}
+
+static PcmFormat _pcm_format(const OutFormat *out) {
+  switch (av_get_packed_sample_fmt(out->sample_fmt)) {
+    case AV_SAMPLE_FMT_S16:
+      return PCM_FORMAT_S16;
+    case AV_SAMPLE_FMT_FLT:
+      return PCM_FORMAT_FLT;
+    case AV_SAMPLE_FMT_DBL:
+      return PCM_FORMAT_DBL;
+    default:
+      return PCM_FORMAT_S32;
+  }
+}
+
+static void _sink_format(const OutFormat *out, SinkFormat *format) {
+  enum AVSampleFormat packed = av_get_packed_sample_fmt(out->sample_fmt);
+  format->rate = out->rate;
+  format->channels = out->channels;
+  format->bit = _frame_bytes(out) / out->channels * 8;
+  format->is_float = (AV_SAMPLE_FMT_FLT == packed ||
+                      AV_SAMPLE_FMT_DBL == packed);
+  format->planar = av_sample_fmt_is_planar(out->sample_fmt);
+}
+
+/**
+ * output format for swr, any layout it can rematrix to incl mono to stereo
+ * upmix. s24 goes through swr as s32, packing happens on emit
+ */
+static int _out_format_init(AudioParam *param, OutFormat *out) {
+  int64_t layout = param->channel_layout;
+  enum AVSampleFormat fmt;
+  if (0 == layout) {
+    layout = av_get_default_channel_layout(param->channels);
+  }
+  if (param->channels <= 0 || AUDIO_SINK_IOV_MAX < param->channels ||
+      av_get_channel_layout_nb_channels(layout) != param->channels) {
+    LOGE(MP3_PLAYER_TAG, "channels=%d not match layout", param->channels);
+    return -1;
+  }
+  if (16 == param->bit && !param->is_float) {
+    fmt = AV_SAMPLE_FMT_S16;
+  } else if (24 == param->bit && !param->is_float) {
+    fmt = AV_SAMPLE_FMT_S32;
+  } else if (32 == param->bit) {
+    fmt = param->is_float ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S32;
+  } else if (64 == param->bit && param->is_float) {
+    fmt = AV_SAMPLE_FMT_DBL;
+  } else {
+    LOGE(MP3_PLAYER_TAG, "unsupported bit=%d, float=%d", param->bit,
+         param->is_float);
+    return -1;
+  }
+  out->channels = param->channels;
+  out->rate = param->rate;
+  out->layout = layout;
+  out->s24 = (24 == param->bit);
+  out->sample_fmt = (param->planar ? av_get_planar_sample_fmt(fmt) : fmt);
+  return 0;
+}
+
+/* grow swr output to hold samples */
+static int _samples_reserve(const OutFormat *out, uint8_t **data,
+                            int *capacity, int samples) {
+  if (samples <= *capacity) {
+    return 0;
+  }
+  av_freep(&data[0]);
+  *capacity = 0;
+  if (av_samples_alloc(data, NULL, out->channels, samples,
+                       out->sample_fmt, 0) < 0) {
+    LOGE(MP3_PLAYER_TAG, "alloc output %d samples failed", samples);
+    return -1;
+  }
+  *capacity = samples;
+  return 0;
+}
+
+static int _output_write(const struct iovec *iov, int iovcnt) {
+  static int total_len = 0;
+  int i, len = 0;
+  if (NULL != g_mp3_player.sink) {
+    if (0 < (len = AudioSinkWrite(g_mp3_player.sink, iov, iovcnt))) {
+      pthread_mutex_lock(&g_mp3_player.drift_mutex);
+      g_mp3_player.drift.written += len / _frame_bytes(&g_mp3_player.out);
+      pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+    }
+    return len;
+  }
+  for (i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+  total_len += len;
+  LOGT(MP3_PLAYER_TAG, "len=%d, total_len=%d, total=%ds",
+       len, total_len, total_len / 32000);
+  return len;
+}
+
+static int _emit(uint8_t **data, int offset, int samples) {
+  struct iovec iov[AUDIO_SINK_IOV_MAX];
+  return _output_write(iov, _pack_iov(&g_mp3_player.out, iov, data, offset,
+                                      samples));
+}
+
+static int _period_open_internal(void) {
+  g_mp3_player.period_frames = (int)((int64_t)g_mp3_player.out.rate *
+                                     g_mp3_player.period_ms / 1000);
+  if (0 >= g_mp3_player.period_frames) {
+    return 0;
+  }
+  g_mp3_player.period_fifo = av_audio_fifo_alloc(g_mp3_player.out.sample_fmt,
+                                                 g_mp3_player.out.channels,
+                                                 g_mp3_player.period_frames);
+  if (NULL == g_mp3_player.period_fifo ||
+      av_samples_alloc(g_mp3_player.period_data, NULL,
+                       g_mp3_player.out.channels, g_mp3_player.period_frames,
+                       g_mp3_player.out.sample_fmt, 0) < 0) {
+    LOGE(MP3_PLAYER_TAG, "alloc period fifo failed");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * cut output into exact periods, one sink write each. whole periods inside
+ * data go out in place, fifo only holds the tail and completes it with
+ * the next buffer
+ */
+static int _period_write(uint8_t **data, int samples) {
+  AVAudioFifo *fifo = g_mp3_player.period_fifo;
+  uint8_t *planes[AUDIO_SINK_IOV_MAX];
+  int period = g_mp3_player.period_frames, offset = 0;
+  if (0 < av_audio_fifo_size(fifo)) {
+    offset = FFMIN(period - av_audio_fifo_size(fifo), samples);
+    av_audio_fifo_write(fifo, (void **)data, offset);
+    if (av_audio_fifo_size(fifo) < period) {
+      return 0;
+    }
+    av_audio_fifo_read(fifo, (void **)g_mp3_player.period_data, period);
+    if (_emit(g_mp3_player.period_data, 0, period) < 0) {
+      return -1;
+    }
+  }
+  for (; samples - offset >= period; offset += period) {
+    if (_emit(data, offset, period) < 0) {
+      return -1;
+    }
+  }
+  if (offset < samples) {
+    _planes_at(&g_mp3_player.out, planes, data, offset);
+    av_audio_fifo_write(fifo, (void **)planes, samples - offset);
+  }
+  return 0;
+}
+
+/* last period of stream padded with silence, consumers see full periods */
+static void _period_flush(void) {
+  int size = av_audio_fifo_size(g_mp3_player.period_fifo);
+  if (0 >= size) {
+    return;
+  }
+  av_audio_fifo_read(g_mp3_player.period_fifo,
+                     (void **)g_mp3_player.period_data, size);
+  av_samples_set_silence(g_mp3_player.period_data, size,
+                         g_mp3_player.period_frames - size,
+                         g_mp3_player.out.channels,
+                         g_mp3_player.out.sample_fmt);
+  _emit(g_mp3_player.period_data, 0, g_mp3_player.period_frames);
+}
+
+static void _write_databuffer(uint8_t **data, int samples,
+                              int *actual_write_size) {
+  int ret;
+  if (NULL != g_mp3_player.period_fifo) {
+    ret = _period_write(data, samples);
+  } else {
+    ret = _emit(data, 0, samples);
+  }
+  *actual_write_size = (ret < 0 ? ret :
+                        samples * _frame_bytes(&g_mp3_player.out));
+}
+
+/**
+ * the single conversion pass, swr does format, layout and rate at once with
+ * its own SIMD kernels, in NULL drains samples swr kept back
+ */
+static int _convert_and_write(uint8_t **in, int in_count,
+                              int *decode_byte_len) {
+  struct SwrContext *ctx = g_mp3_player.au_convert_ctx;
+  int samples = swr_get_out_samples(ctx, in_count);
+  if (samples < 0 ||
+      0 != _samples_reserve(&g_mp3_player.out, g_mp3_player.out_data,
+                            &g_mp3_player.out_capacity, samples)) {
+    return -1;
+  }
+  if ((samples = swr_convert(ctx, g_mp3_player.out_data, samples,
+                             in, in_count)) <= 0) {
+    return samples;
+  }
+  PcmVolumeProcess(g_mp3_player.volume, g_mp3_player.out_data, samples);
+  _write_databuffer(g_mp3_player.out_data, samples, decode_byte_len);
+  return samples;
+}
+
+static void _drift_reset(void) {
+  DriftState *drift = &g_mp3_player.drift;
+  pthread_mutex_lock(&g_mp3_player.drift_mutex);
+  drift->written = 0;
+  drift->last_us = 0;
+  drift->target_depth = -1;
+  drift->correction = 0;
+  drift->carry = 0;
+  /* device drift outlives the track */
+  if (0 == drift->ratio) {
+    drift->ratio = 1.0;
+  }
+  pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+}
+
+/* limiter lookahead still holds the last frames at end of stream */
+static void _volume_flush(void) {
+  int delay = PcmVolumeDelay(g_mp3_player.volume), written;
+  if (0 >= delay ||
+      0 != _samples_reserve(&g_mp3_player.out, g_mp3_player.out_data,
+                            &g_mp3_player.out_capacity, delay)) {
+    return;
+  }
+  av_samples_set_silence(g_mp3_player.out_data, 0, delay,
+                         g_mp3_player.out.channels,
+                         g_mp3_player.out.sample_fmt);
+  PcmVolumeProcess(g_mp3_player.volume, g_mp3_player.out_data, delay);
+  _write_databuffer(g_mp3_player.out_data, delay, &written);
+}
+
+static int _branch_open(OutputBranch *branch) {
+  AVCodecContext *dec_ctx = g_mp3_player.audio_dec_ctx;
+  int64_t layout = av_get_default_channel_layout(dec_ctx->channels);
+  SinkFormat format;
+  branch->failed = 0;
+  branch->swr = swr_alloc_set_opts(NULL, branch->out.layout,
+                                   branch->out.sample_fmt, branch->out.rate,
+                                   layout, dec_ctx->sample_fmt,
+                                   dec_ctx->sample_rate, 0, NULL);
+  if (NULL == branch->swr || swr_init(branch->swr) < 0) {
+    LOGE(MP3_PLAYER_TAG, "init output swr failed");
+    return -1;
+  }
+  _sink_format(&branch->out, &format);
+  return AudioSinkOpen(branch->sink, &format);
+}
+
+static int _branches_open_internal(void) {
+  int i;
+  for (i = 0; i < g_mp3_player.branch_count; i++) {
+    if (0 != _branch_open(&g_mp3_player.branches[i])) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * every branch reads the same decoded frame planes, only its own converted
+ * copy is written. a failing branch is dropped, main output goes on
+ */
+static void _branches_write(uint8_t **in, int in_count) {
+  struct iovec iov[AUDIO_SINK_IOV_MAX];
+  OutputBranch *branch;
+  int i, samples;
+  for (i = 0; i < g_mp3_player.branch_count; i++) {
+    branch = &g_mp3_player.branches[i];
+    if (branch->failed) {
+      continue;
+    }
+    samples = swr_get_out_samples(branch->swr, in_count);
+    if (samples < 0 ||
+        0 != _samples_reserve(&branch->out, branch->data,
+                              &branch->capacity, samples) ||
+        (samples = swr_convert(branch->swr, branch->data, samples,
+                               in, in_count)) < 0 ||
+        (0 < samples &&
+         AudioSinkWrite(branch->sink, iov,
+                        _pack_iov(&branch->out, iov, branch->data, 0,
+                                  samples)) < 0)) {
+      LOGW(MP3_PLAYER_TAG, "output %d failed, dropped", i);
+      branch->failed = 1;
+    }
+  }
+}
+
+/* flush resampler delay and drain, end of stream */
+static void _branches_drain(void) {
+  int i;
+  _branches_write(NULL, 0);
+  for (i = 0; i < g_mp3_player.branch_count; i++) {
+    if (!g_mp3_player.branches[i].failed) {
+      AudioSinkDrain(g_mp3_player.branches[i].sink);
+    }
+  }
+}
+
+static void _branches_close(void) {
+  OutputBranch *branch;
+  int i;
+  for (i = 0; i < g_mp3_player.branch_count; i++) {
+    branch = &g_mp3_player.branches[i];
+    AudioSinkClose(branch->sink);
+    swr_free(&branch->swr);
+    av_freep(&branch->data[0]);
+    branch->capacity = 0;
+  }
+}
+
+static int _sink_open_internal(void) {
+  SinkFormat format;
+  _sink_format(&g_mp3_player.out, &format);
+  return AudioSinkOpen(g_mp3_player.sink, &format);
+}
+
+static int _mp3_prepare_internal(const char *url, AVIOContext *pb) {
+  g_mp3_player.url = av_strdup(url);
+  g_mp3_player.play_pos = -1;
+  g_mp3_player.play_pts = AV_NOPTS_VALUE;
+  /* hedged open hands over an input with stream info already found */
+  if (NULL == g_mp3_player.fmt_ctx &&
+      0 != _mp3_open_input_internal(url, pb)) {
+    return -1;
+  }
+  _set_block_state(BLOCK_READ_HEADER);
+  LOGT(MP3_PLAYER_TAG, "before _open_codec_context");
+  if (_open_codec_context(&g_mp3_player.audio_stream_idx,
+                         &g_mp3_player.audio_dec_ctx,
+                         g_mp3_player.fmt_ctx, AVMEDIA_TYPE_AUDIO) < 0) {
+    LOGE(MP3_PLAYER_TAG, "Open codec context failed");
+    return -1;
+  }
+  if (NULL == g_mp3_player.fmt_ctx->streams[g_mp3_player.audio_stream_idx]) {
+    LOGE(MP3_PLAYER_TAG, "Could not find audio stream");
+    return -1;
+  }
+  g_mp3_player.demux_stream_idx = g_mp3_player.audio_stream_idx;
+  g_mp3_player.abr.splice_pts = AV_NOPTS_VALUE;
+  _set_block_state(BLOCK_NULL);
+  LOGT(MP3_PLAYER_TAG, "before av_dump_format");
+  av_dump_format(g_mp3_player.fmt_ctx, 0, url, 0);
+  if (NULL == (g_mp3_player.frame = av_frame_alloc())) {
+    LOGE(MP3_PLAYER_TAG, "Could not allocate frame");
+    return -1;
+  }
+  av_init_packet(&g_mp3_player.pkt);
+  g_mp3_player.pkt.data = NULL;
+  g_mp3_player.pkt.size = 0;
+  LOGT(MP3_PLAYER_TAG, "before _choose_au_convert_ctx");
+  _choose_au_convert_ctx(av_get_default_channel_layout( \
+                         g_mp3_player.audio_dec_ctx->channels),
+                         g_mp3_player.audio_dec_ctx->sample_fmt,
+                         g_mp3_player.audio_dec_ctx->sample_rate);
+  /* restore after hibernate plays on into the sinks left open */
+  if (!g_mp3_player.sinks_kept) {
+    if (NULL != g_mp3_player.sink && 0 != _sink_open_internal()) {
+      return -1;
+    }
+    if (0 != _branches_open_internal()) {
+      return -1;
+    }
+    _drift_reset();
+  }
+  PcmVolumeSetLimiter(g_mp3_player.volume,
+                      0 < g_mp3_player.limiter_param.threshold ?
+                      &g_mp3_player.limiter_param : NULL);
+  if (0 != _period_open_internal()) {
+    return -1;
+  }
+  if (0 != _demux_start_internal()) {
+    LOGE(MP3_PLAYER_TAG, "start demux failed");
+    return -1;
+  }
+  LOGT(MP3_PLAYER_TAG, "prepare internal success");
+  return 0;
+}
+
+static int _mp3_prepare_mirrors_internal(MirrorList *list) {
+  HedgeOpenStats stats;
+  g_mp3_player.hedge = HedgeOpenCreate((const char **)list->urls,
+                                       list->count,
+                                       g_mp3_player.hedge_param.delay_ms,
+                                       OPEN_INPUT_TIMEOUT_S * 1000);
+  if (NULL == g_mp3_player.hedge) {
+    return -1;
+  }
+  g_mp3_player.fmt_ctx = HedgeOpenTakeInput(g_mp3_player.hedge,
+                                            &g_mp3_player.http, &int_cb);
+  HedgeOpenStatsGet(g_mp3_player.hedge, &stats);
+  LOGT(MP3_PLAYER_TAG, "mirror[%d] won, open=%dms", stats.winner,
+       stats.open_ms);
+  return _mp3_prepare_internal(list->urls[stats.winner], NULL);
+}
+
+static int _variant_cmp(const void *a, const void *b) {
+  return ((const Mp3Variant *)a)->bitrate_kbps -
+         ((const Mp3Variant *)b)->bitrate_kbps;
+}
+
+static void _variants_free(void) {
+  AbrState *abr = &g_mp3_player.abr;
+  int i;
+  for (i = 0; NULL != abr->variants && i < abr->count; i++) {
+    av_free(abr->variants[i].url);
+  }
+  av_freep(&abr->variants);
+  abr->count = 0;
+}
+
+static int _mp3_prepare_variants_internal(VariantList *list) {
+  AbrState *abr = &g_mp3_player.abr;
+  const char *url;
+  abr->variants = av_mallocz_array(list->count, sizeof(Mp3Variant));
+  if (NULL == abr->variants) {
+    return -1;
+  }
+  for (abr->count = 0; abr->count < list->count; abr->count++) {
+    abr->variants[abr->count].bitrate_kbps =
+        list->variants[abr->count].bitrate_kbps;
+    abr->variants[abr->count].url = av_strdup(list->variants[abr->count].url);
+    if (NULL == abr->variants[abr->count].url) {
+      return -1;
+    }
+  }
+  qsort(abr->variants, abr->count, sizeof(Mp3Variant), _variant_cmp);
+  /* throughput of last track decides, lowest variant on first play */
+  abr->current = _abr_pick(abr->last_bps);
+  abr->target_since_ms = 0;
+  url = abr->variants[abr->current].url;
+  LOGT(MP3_PLAYER_TAG, "start variant %dkbps, last throughput %lldkbps",
+       abr->variants[abr->current].bitrate_kbps,
+       (long long)(abr->last_bps / 1000));
+  /* throughput is measured on HttpIo, no range io for variants */
+  if (NULL == (g_mp3_player.http = HttpIoCreate(url))) {
+    LOGE(MP3_PLAYER_TAG, "open variant %s failed", url);
+    return -1;
+  }
+  return _mp3_prepare_internal(url, HttpIoGetAVIO(g_mp3_player.http));
+}
+
+/**
+ * stretch next frame by correction through swr. whole samples only,
+ * remainder carried so the long-run rate is exact
+ */
+static void _drift_compensate(int in_samples, int in_rate) {
+  DriftState *drift = &g_mp3_player.drift;
+  int out_samples = av_rescale(in_samples, g_mp3_player.out.rate,
+                               in_rate);
+  int delta;
+  pthread_mutex_lock(&g_mp3_player.drift_mutex);
+  drift->carry += out_samples * drift->correction;
+  delta = (int)drift->carry;
+  drift->carry -= delta;
+  pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+  if (0 != delta && 0 < out_samples) {
+    swr_set_compensation(g_mp3_player.au_convert_ctx, delta, out_samples);
+  }
+}
+
+static int _swr_context_cache_check_and_process(int *decode_byte_len) {
+  int cache_size = 0;
+  cache_size = swr_get_out_samples(g_mp3_player.au_convert_ctx, 0);
+  if (g_mp3_player.frame->nb_samples > 0 &&
+      cache_size >= g_mp3_player.frame->nb_samples) {
+    if (_convert_and_write(NULL, 0, decode_byte_len) <= 0) {
+      LOGW(MP3_PLAYER_TAG, "try read swr_cache, cannot get data, datasize=0");
+      goto L_END;
+    }
+    return 0;
+  }
+L_END:
+  return -1;
+}
+
+static int _decode_packet(int *decode_byte_len) {
+  int ret = 0;
+  int decoded = g_mp3_player.pkt.size;
+  int got_frame = 0;
+  int data_len;
+  if (g_mp3_player.pkt.stream_index == g_mp3_player.audio_stream_idx) {
+    if (0 == _swr_context_cache_check_and_process(decode_byte_len)) {
+      return 0;
+    }
+    ret = avcodec_decode_audio4(g_mp3_player.audio_dec_ctx, g_mp3_player.frame,
+                                &got_frame, &g_mp3_player.pkt);
+    if (ret < 0) {
+      *decode_byte_len = AUDIO_RETRIEVE_DATA_FINISHED;
+      LOGE(MP3_PLAYER_TAG, "Error decoding audio frame (%s)", av_err2str(ret));
+      return -1;
+    }
+    decoded = FFMIN(ret, g_mp3_player.pkt.size);
+    if (got_frame) {
+      _drift_compensate(g_mp3_player.frame->nb_samples,
+                        g_mp3_player.frame->sample_rate);
+      if ((data_len = _convert_and_write(g_mp3_player.frame->data,
+                                         g_mp3_player.frame->nb_samples,
+                                         decode_byte_len)) < 0) {
+        LOGE(MP3_PLAYER_TAG, "Could not convert input samples (error '%s')",
+             av_err2str(data_len));
+        return data_len;
+      }
+      _branches_write(g_mp3_player.frame->data,
+                      g_mp3_player.frame->nb_samples);
+    }
+  }
+  return decoded;
+}
+
+static int _audio_player_callback() {
+  int ret, decode_byte_len = 0;
+  if (MP3_PLAYING_STATE != g_mp3_player.state) {
+    return 0;
+  }
+  if (0 == g_mp3_player.pkt.size) {
+    if ((ret = PacketQueueGet(g_mp3_player.pkt_queue,
+                              &g_mp3_player.pkt)) < 0) {
+      LOGE(MP3_PLAYER_TAG, "prebuffer drained[%d-->%s]", ret, av_err2str(ret));
+      return AUDIO_RETRIEVE_DATA_FINISHED;
+    }
+    g_mp3_player.orig_pkt = g_mp3_player.pkt;
+    g_mp3_player.play_pos = g_mp3_player.pkt.pos;
+    g_mp3_player.play_pts = g_mp3_player.pkt.pts;
+  }
+  do {
+    if (g_mp3_player.pkt.size <= 0) {
+      break;
+    }
+    ret = _decode_packet(&decode_byte_len);
+    if (ret < 0) {
+      break;
+    }
+    g_mp3_player.pkt.data += ret;
+    g_mp3_player.pkt.size -= ret;
+  } while (0);
+  if (0 == g_mp3_player.pkt.size) {
+    /* whole packet went to swr, resume point moves past it */
+    if (0 <= g_mp3_player.orig_pkt.pos) {
+      g_mp3_player.play_pos = g_mp3_player.orig_pkt.pos +
+                              g_mp3_player.orig_pkt.size;
+    }
+    if (AV_NOPTS_VALUE != g_mp3_player.orig_pkt.pts) {
+      g_mp3_player.play_pts = g_mp3_player.orig_pkt.pts +
+                              g_mp3_player.orig_pkt.duration;
+    }
+    av_packet_unref(&g_mp3_player.orig_pkt);
+    memset(&g_mp3_player.orig_pkt, 0, sizeof(g_mp3_player.orig_pkt));
+  }
+  return decode_byte_len;
+}
+
+int retrieve_done = 0;
+
+/* park while paused instead of spinning, 0 keep going, -1 stale thread */
+static int _retrieve_wait(int gen) {
+  int rc;
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  while (MP3_PAUSED_STATE == g_mp3_player.state &&
+         gen == g_mp3_player.retrieve_gen) {
+    pthread_cond_wait(&g_mp3_player.pause_cond, &g_mp3_player.pause_mutex);
+  }
+  rc = (gen == g_mp3_player.retrieve_gen ? 0 : -1);
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  return rc;
+}
+
+static void* __retrieve_tsk(void *args) {
+  int gen = (int)(intptr_t)args;
+  while (1) {
+    if (0 != _retrieve_wait(gen)) {
+      return NULL;
+    }
+    if (AUDIO_RETRIEVE_DATA_FINISHED == _audio_player_callback()) break;
+  }
+  /* retired by release meanwhile, sink and buffers are going away */
+  if (0 != _retrieve_wait(gen)) {
+    return NULL;
+  }
+  _volume_flush();
+  if (NULL != g_mp3_player.period_fifo) {
+    _period_flush();
+  }
+  if (NULL != g_mp3_player.sink) {
+    AudioSinkDrain(g_mp3_player.sink);
+  }
+  _branches_drain();
+  retrieve_done = 1;
+  return NULL;
+}
+
+static void _mp3_start_internal(void) {
+  int gen;
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  gen = ++g_mp3_player.retrieve_gen;
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  if (0 != pthread_create(&g_mp3_player.retrieve_thread, NULL, __retrieve_tsk,
+                          (void *)(intptr_t)gen)) {
+    LOGE(MP3_PLAYER_TAG, "create retrieve thread failed");
+    return;
+  }
+  g_mp3_player.retrieve_running = 1;
+}
+
+/* sinks and packet queue are aborted, wait out the tail before freeing */
+static void _retrieve_join(void) {
+  if (!g_mp3_player.retrieve_running) {
+    return;
+  }
+  pthread_join(g_mp3_player.retrieve_thread, NULL);
+  g_mp3_player.retrieve_running = 0;
+}
+
+static void _mp3_pause_internal(void) {
+  PauseParam *param = &g_mp3_player.pause_param;
+  if (MP3_PAUSE_STOP_NETWORK == param->policy) {
+    pthread_mutex_lock(&g_mp3_player.pause_mutex);
+    g_mp3_player.demux_paused = 1;
+    pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+    return;
+  }
+  /* nobody drains while paused, let prebuffer grow to byte budget */
+  if (g_mp3_player.pkt_queue) {
+    PacketQueueSetHighWater(g_mp3_player.pkt_queue, INT_MAX,
+                            param->memory_budget);
+  }
+}
+
+static void _mp3_resume_internal(void) {
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  g_mp3_player.demux_paused = 0;
+  pthread_cond_broadcast(&g_mp3_player.pause_cond);
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  /* demux stays blocked until decoder drains below usual watermark */
+  if (g_mp3_player.pkt_queue) {
+    PacketQueueSetHighWater(g_mp3_player.pkt_queue,
+                            g_mp3_player.prebuffer_param.high_ms, 0);
+  }
+}
+
+/* producer may block in a write holding feed_mutex, abort wakes it first */
+static void _feed_free(void) {
+  if (NULL == g_mp3_player.feed) {
+    return;
+  }
+  FeedIoAbort(g_mp3_player.feed);
+  pthread_mutex_lock(&g_mp3_player.feed_mutex);
+  FeedIoDestroy(g_mp3_player.feed);
+  g_mp3_player.feed = NULL;
+  pthread_mutex_unlock(&g_mp3_player.feed_mutex);
+}
+
+static int _mp3_release_internal(void) {
+  int i;
+  /* prepare thread releases by itself on failure, it cannot join itself */
+  if (g_mp3_player.prepare_running &&
+      !pthread_equal(pthread_self(), g_mp3_player.prepare_thread)) {
+    pthread_mutex_lock(&g_mp3_player.pause_mutex);
+    g_mp3_player.prepare_cancel = 1;
+    pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+    if (g_mp3_player.feed) {
+      FeedIoAbort(g_mp3_player.feed);
+    }
+    pthread_join(g_mp3_player.prepare_thread, NULL);
+    g_mp3_player.prepare_running = 0;
+  }
+  /* retire retrieve thread, wake demux parked in pause */
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  g_mp3_player.retrieve_gen++;
+  g_mp3_player.demux_paused = 0;
+  pthread_cond_broadcast(&g_mp3_player.pause_cond);
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  /* demux thread may swap http on variant switch */
+  pthread_mutex_lock(&g_mp3_player.io_mutex);
+  g_mp3_player.abort_request = 1;
+  if (g_mp3_player.range) {
+    RangeIoAbort(g_mp3_player.range);
+  }
+  if (g_mp3_player.http) {
+    HttpIoAbort(g_mp3_player.http);
+  }
+  if (g_mp3_player.shared) {
+    SharedFetchAbort(g_mp3_player.shared);
+  }
+  /* kept sinks must stay usable, paused retrieve thread does not write */
+  if (g_mp3_player.sink && !g_mp3_player.sinks_kept) {
+    AudioSinkAbort(g_mp3_player.sink);
+  }
+  for (i = 0; i < g_mp3_player.branch_count && !g_mp3_player.sinks_kept;
+       i++) {
+    AudioSinkAbort(g_mp3_player.branches[i].sink);
+  }
+  pthread_mutex_unlock(&g_mp3_player.io_mutex);
+  if (g_mp3_player.pkt_queue) {
+    PacketQueueAbort(g_mp3_player.pkt_queue);
+    pthread_join(g_mp3_player.demux_thread, NULL);
+  }
+  _retrieve_join();
+  if (g_mp3_player.pkt_queue) {
+    PacketQueueDestroy(g_mp3_player.pkt_queue);
+    g_mp3_player.pkt_queue = NULL;
+  }
+  if (0 != g_mp3_player.orig_pkt.size) {
+    av_packet_unref(&g_mp3_player.orig_pkt);
+    memset(&g_mp3_player.orig_pkt, 0, sizeof(g_mp3_player.orig_pkt));
+  }
+  if (g_mp3_player.audio_dec_ctx) {
+    avcodec_free_context(&g_mp3_player.audio_dec_ctx);
+    g_mp3_player.audio_dec_ctx = NULL;
+  }
+  if (g_mp3_player.fmt_ctx) {
+    avformat_close_input(&g_mp3_player.fmt_ctx);
+    g_mp3_player.fmt_ctx = NULL;
+  }
+  if (g_mp3_player.frame) {
+    av_frame_free(&g_mp3_player.frame);
+    g_mp3_player.frame = NULL;
+  }
+  av_freep(&g_mp3_player.out_data[0]);
+  g_mp3_player.out_capacity = 0;
+  if (g_mp3_player.period_fifo) {
+    av_audio_fifo_free(g_mp3_player.period_fifo);
+    g_mp3_player.period_fifo = NULL;
+  }
+  av_freep(&g_mp3_player.period_data[0]);
+  if (!g_mp3_player.sinks_kept) {
+    if (g_mp3_player.sink) {
+      AudioSinkClose(g_mp3_player.sink);
+    }
+    _branches_close();
+  }
+  if (g_mp3_player.crypt) {
+    CryptIoDestroy(g_mp3_player.crypt);
+    g_mp3_player.crypt = NULL;
+  }
+  avio_closep(&g_mp3_player.crypt_src);
+  if (g_mp3_player.shared) {
+    SharedFetchClose(g_mp3_player.shared);
+    g_mp3_player.shared = NULL;
+  }
+  _feed_free();
+  if (g_mp3_player.range) {
+    RangeIoDestroy(g_mp3_player.range);
+    g_mp3_player.range = NULL;
+  }
+  if (g_mp3_player.http) {
+    if (0 < HttpIoThroughput(g_mp3_player.http)) {
+      g_mp3_player.abr.last_bps = HttpIoThroughput(g_mp3_player.http);
+    }
+    HttpIoDestroy(g_mp3_player.http);
+    g_mp3_player.http = NULL;
+  }
+  _variants_free();
+  if (g_mp3_player.hedge) {
+    HedgeOpenDestroy(g_mp3_player.hedge);
+    g_mp3_player.hedge = NULL;
+  }
+  av_freep(&g_mp3_player.id3_url);
+  av_freep(&g_mp3_player.url);
+  av_dict_free(&g_mp3_player.metadata);
+  /* tag fetch of this play may still run outside fsm_mutex, cancel it */
+  g_mp3_player.meta_gen++;
+  g_mp3_player.id3_size = 0;
+  g_mp3_player.au_convert_ctx = NULL;
+  g_mp3_player.abort_request = 0;
+  return 0;
+}
+
+static void _mp3_stop_internal(void) {
+}
+
+static void _resume_record_free(void) {
+  av_freep(&g_mp3_player.resume.url);
+  avcodec_parameters_free(&g_mp3_player.resume.codecpar);
+}
+
+static int _resume_record_build(void) {
+  ResumeRecord *resume = &g_mp3_player.resume;
+  AVFormatContext *fmt_ctx = g_mp3_player.fmt_ctx;
+  AVStream *st;
+  /* pushed data and variant switching can not be reopened by url */
+  if (NULL == fmt_ctx || NULL == fmt_ctx->pb || NULL == g_mp3_player.url ||
+      NULL != g_mp3_player.feed || 0 < g_mp3_player.abr.count ||
+      !(fmt_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+    return -1;
+  }
+  if (g_mp3_player.play_pos < 0 && AV_NOPTS_VALUE == g_mp3_player.play_pts) {
+    return -1;
+  }
+  st = fmt_ctx->streams[g_mp3_player.demux_stream_idx];
+  if (NULL == (resume->codecpar = avcodec_parameters_alloc()) ||
+      avcodec_parameters_copy(resume->codecpar, st->codecpar) < 0 ||
+      NULL == (resume->url = av_strdup(g_mp3_player.url))) {
+    _resume_record_free();
+    return -1;
+  }
+  resume->iformat = fmt_ctx->iformat;
+  resume->stream_idx = g_mp3_player.demux_stream_idx;
+  resume->time_base = st->time_base;
+  resume->byte_pos = g_mp3_player.play_pos;
+  resume->sample_pos = g_mp3_player.play_pts;
+  return 0;
+}
+
+/* keep only resume record, input, decoder, swr cache and socket all go */
+static void _mp3_hibernate_internal(void) {
+  if (0 != _resume_record_build()) {
+    LOGW(MP3_PLAYER_TAG, "input can not be reopened, stay awake");
+    return;
+  }
+  /* reopening would truncate a wav sink and restart drift, pacing, tap */
+  g_mp3_player.sinks_kept = 1;
+  _mp3_release_internal();
+  _convert_ctx_list_free();
+  LOGT(MP3_PLAYER_TAG, "hibernate at byte %lld",
+       (long long)g_mp3_player.resume.byte_pos);
+}
+
+static int _mp3_restore_internal(void) {
+  int rc;
+  LOGT(MP3_PLAYER_TAG, "restore %s at byte %lld", g_mp3_player.resume.url,
+       (long long)g_mp3_player.resume.byte_pos);
+  rc = _mp3_prepare_internal(g_mp3_player.resume.url, NULL);
+  /* owned by this play again, a failed restore closes them on release */
+  g_mp3_player.sinks_kept = 0;
+  _resume_record_free();
+  return rc;
+}
+
+static int _hibernate_pending(int gen) {
+  return MP3_PAUSED_STATE == g_mp3_player.state &&
+         gen == g_mp3_player.hibernate_gen &&
+         NULL == g_mp3_player.resume.codecpar;
+}
+
+static void* __hibernate_tsk(void *args) {
+  int gen = (int)(intptr_t)args;
+  int64_t until_ms = _now_ms() + g_mp3_player.hibernate_param.idle_ms;
+  struct timespec ts;
+  int pending;
+  ts.tv_sec = until_ms / 1000;
+  ts.tv_nsec = (until_ms % 1000) * 1000000;
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  while ((pending = _hibernate_pending(gen)) && _now_ms() < until_ms) {
+    pthread_cond_timedwait(&g_mp3_player.pause_cond,
+                           &g_mp3_player.pause_mutex, &ts);
+  }
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  if (!pending) {
+    return NULL;
+  }
+  /* user may resume or stop meanwhile, fsm decides under its lock */
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  if (_hibernate_pending(gen)) {
+    _mp3_hibernate_internal();
+  }
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  return NULL;
+}
+
+static void _hibernate_arm(void) {
+  pthread_t pid;
+  int gen;
+  if (0 >= g_mp3_player.hibernate_param.idle_ms) {
+    return;
+  }
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  gen = ++g_mp3_player.hibernate_gen;
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  if (0 == pthread_create(&pid, NULL, __hibernate_tsk, (void *)(intptr_t)gen)) {
+    pthread_detach(pid);
+  }
+}
+
+/* release joins us holding fsm_mutex, give up once it cancelled us */
+static int _prepare_lock_fsm(void) {
+  int cancel;
+  while (0 != pthread_mutex_trylock(&g_mp3_player.fsm_mutex)) {
+    pthread_mutex_lock(&g_mp3_player.pause_mutex);
+    cancel = g_mp3_player.prepare_cancel;
+    pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+    if (cancel) {
+      return -1;
+    }
+    usleep(1000 * 10);
+  }
+  return 0;
+}
+
+static void* __feed_prepare_tsk(void *args) {
+  int rc = _mp3_prepare_internal(FEED_URL_NAME,
+                                 FeedIoGetAVIO(g_mp3_player.feed));
+  if (0 != _prepare_lock_fsm()) {
+    LOGW(MP3_PLAYER_TAG, "feed prepare cancelled");
+    return NULL;
+  }
+  if (0 == rc) {
+    _mp3_start_internal();
+    _mp3_set_state(MP3_PLAYING_STATE);
+  } else {
+    /* producer sees -1 from Mp3Feed, next stop or play starts clean */
+    _mp3_release_internal();
+    _mp3_set_state(MP3_IDLE_STATE);
+  }
+  pthread_cond_broadcast(&g_mp3_player.fsm_cond);
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  return NULL;
+}
+
+static int _mp3_feed_begin_internal(void) {
+  FeedIo *feed;
+  if (NULL == (feed = FeedIoCreate(FEED_FIFO_SIZE))) {
+    LOGE(MP3_PLAYER_TAG, "create feed io failed");
+    return -1;
+  }
+  pthread_mutex_lock(&g_mp3_player.feed_mutex);
+  g_mp3_player.feed = feed;
+  pthread_mutex_unlock(&g_mp3_player.feed_mutex);
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  g_mp3_player.prepare_cancel = 0;
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  _mp3_set_state(MP3_PREPARING_STATE);
+  if (0 != pthread_create(&g_mp3_player.prepare_thread, NULL,
+                          __feed_prepare_tsk, NULL)) {
+    LOGE(MP3_PLAYER_TAG, "create feed prepare thread failed");
+    _feed_free();
+    _mp3_set_state(MP3_IDLE_STATE);
+    return -1;
+  }
+  g_mp3_player.prepare_running = 1;
+  return 0;
+}
+
+static int _mp3_fsm(Mp3Event event, void *param) {
+  int rc = -1;
+  /* hibernate timer enters from its own thread */
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  switch (g_mp3_player.state) {
+    case MP3_IDLE_STATE:
+      if (MP3_PLAY_EVENT == event) {
+        _mp3_release_internal();
+        if (0 == _mp3_prepare_internal((char *)param, NULL)) {
+          _mp3_start_internal();
+          _mp3_set_state(MP3_PLAYING_STATE);
+          rc = 0;
+          break;
+        }
+        _mp3_release_internal();
+        break;
+      }
+      if (MP3_PLAY_MIRRORS_EVENT == event) {
+        _mp3_release_internal();
+        if (0 == _mp3_prepare_mirrors_internal((MirrorList *)param)) {
+          _mp3_start_internal();
+          _mp3_set_state(MP3_PLAYING_STATE);
+          rc = 0;
+          break;
+        }
+        _mp3_release_internal();
+        break;
+      }
+      if (MP3_PLAY_VARIANTS_EVENT == event) {
+        _mp3_release_internal();
+        if (0 == _mp3_prepare_variants_internal((VariantList *)param)) {
+          _mp3_start_internal();
+          _mp3_set_state(MP3_PLAYING_STATE);
+          rc = 0;
+          break;
+        }
+        _mp3_release_internal();
+        break;
+      }
+      if (MP3_PREPARE_EVENT == event) {
+      }
+      if (MP3_FEED_EVENT == event) {
+        _mp3_release_internal();
+        rc = _mp3_feed_begin_internal();
+      }
+      break;
     case MP3_PREPARING_STATE:
       if (MP3_START_EVENT == event || MP3_RESUME_EVENT == event) {
+        /* prepare thread needs fsm_mutex to leave preparing */
         while (MP3_PREPARING_STATE == g_mp3_player.state) {
-          sleep(0);
           LOGT(MP3_PLAYER_TAG, "waiting while mp3 is preparing");
+          pthread_cond_wait(&g_mp3_player.fsm_cond, &g_mp3_player.fsm_mutex);
         }
         if (MP3_PREPARED_STATE == g_mp3_player.state) {
           _mp3_start_internal();
           _mp3_set_state(MP3_PLAYING_STATE);
           rc = 0;
         }
+      } else if (MP3_STOP_EVENT == event) {
+        _mp3_release_internal();
+        _mp3_set_state(MP3_IDLE_STATE);
+        rc = 0;
       }
       break;
     case MP3_PREPARED_STATE:
@@ -520,8 +1989,9 @@ static int _mp3_fsm(Mp3Event event, void *param) {
       break;
     case MP3_PLAYING_STATE:
       if (MP3_PAUSE_EVENT == event) {
-        _mp3_stop_internal();
+        _mp3_pause_internal();
         _mp3_set_state(MP3_PAUSED_STATE);
+        _hibernate_arm();
         rc = 0;
       } else if (MP3_STOP_EVENT == event) {
         _mp3_stop_internal();
@@ -531,12 +2001,25 @@ static int _mp3_fsm(Mp3Event event, void *param) {
       }
       break;
     case MP3_PAUSED_STATE:
-      if (MP3_RESUME_EVENT == event) {
-        _mp3_start_internal();
+      if (MP3_RESUME_EVENT == event &&
+          NULL != g_mp3_player.resume.codecpar) {
+        if (0 == _mp3_restore_internal()) {
+          _mp3_start_internal();
+          _mp3_set_state(MP3_PLAYING_STATE);
+          rc = 0;
+          break;
+        }
+        _mp3_release_internal();
+        _mp3_set_state(MP3_IDLE_STATE);
+      } else if (MP3_RESUME_EVENT == event) {
+        /* retrieve thread of this play is parked, no new one */
+        _mp3_resume_internal();
         _mp3_set_state(MP3_PLAYING_STATE);
         rc = 0;
       } else if (MP3_STOP_EVENT == event) {
+        g_mp3_player.sinks_kept = 0;
         _mp3_release_internal();
+        _resume_record_free();
         _mp3_set_state(MP3_IDLE_STATE);
         rc = 0;
       }
@@ -547,6 +2030,9 @@ static int _mp3_fsm(Mp3Event event, void *param) {
   LOGT(MP3_PLAYER_TAG, "event %s, state %s, result %s",
        _event2string(event), _state2string(g_mp3_player.state),
        rc == 0 ? "OK" : "FAILED");
+  /* start parked in preparing rechecks state */
+  pthread_cond_broadcast(&g_mp3_player.fsm_cond);
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
   return rc;
 }
 
@@ -575,30 +2061,490 @@ int Mp3Stop(void) {
   return _mp3_fsm(MP3_STOP_EVENT, NULL);
 }
 
-int Mp3Init(AudioParam *param) {
-  g_mp3_player.out_channels = param->channels;
-  g_mp3_player.out_sample_rate = param->rate;
-  if (param->channels == 1) {
-    g_mp3_player.out_channel_layout = AV_CH_LAYOUT_MONO;
+int Mp3PlayMirrors(char **urls, int count) {
+  MirrorList list = {urls, count};
+  if (NULL == urls || count <= 0) {
+    return -1;
+  }
+  return _mp3_fsm(MP3_PLAY_MIRRORS_EVENT, (void *)&list);
+}
+
+int Mp3PlayVariants(Mp3Variant *variants, int count) {
+  VariantList list = {variants, count};
+  if (NULL == variants || count <= 0) {
+    return -1;
+  }
+  return _mp3_fsm(MP3_PLAY_VARIANTS_EVENT, (void *)&list);
+}
+
+int Mp3FeedBegin(void) {
+  return _mp3_fsm(MP3_FEED_EVENT, NULL);
+}
+
+int Mp3Feed(char *data, int len) {
+  int rc = -1;
+  /* release aborts the feed, then waits here before destroying it */
+  pthread_mutex_lock(&g_mp3_player.feed_mutex);
+  if (NULL == g_mp3_player.feed) {
+    LOGE(MP3_PLAYER_TAG, "feed not begin");
   } else {
-    g_mp3_player.out_channel_layout = AV_CH_LAYOUT_STEREO;
+    rc = FeedIoWrite(g_mp3_player.feed, data, len) < 0 ? -1 : 0;
   }
-  if (param->bit == 16) {
-    g_mp3_player.out_sample_fmt = AV_SAMPLE_FMT_S16;
+  pthread_mutex_unlock(&g_mp3_player.feed_mutex);
+  return rc;
+}
+
+int Mp3FeedEnd(void) {
+  int rc = -1;
+  pthread_mutex_lock(&g_mp3_player.feed_mutex);
+  if (NULL == g_mp3_player.feed) {
+    LOGE(MP3_PLAYER_TAG, "feed not begin");
   } else {
-    g_mp3_player.out_sample_fmt = AV_SAMPLE_FMT_S32;
+    rc = FeedIoEnd(g_mp3_player.feed);
+  }
+  pthread_mutex_unlock(&g_mp3_player.feed_mutex);
+  return rc;
+}
+
+int Mp3SetRangeParam(RangeParam *param) {
+  g_mp3_player.range_param = *param;
+  LOGT(MP3_PLAYER_TAG, "connections=%d, chunk_size=%d, memory_budget=%d",
+       param->connections, param->chunk_size, param->memory_budget);
+  return 0;
+}
+
+int Mp3SetPrebufferParam(PrebufferParam *param) {
+  PrebufferParam *dst = &g_mp3_player.prebuffer_param;
+  /* keep low < start <= high, otherwise demux and decode wait each other */
+  dst->high_ms = FFMAX(param->high_ms, 1);
+  dst->start_ms = av_clip(param->start_ms, 0, dst->high_ms);
+  dst->low_ms = av_clip(param->low_ms, 0, FFMAX(dst->start_ms - 1, 0));
+  LOGT(MP3_PLAYER_TAG, "start=%dms, low=%dms, high=%dms", dst->start_ms,
+       dst->low_ms, dst->high_ms);
+  return 0;
+}
+
+int Mp3GetPrebufferStats(PrebufferStats *stats) {
+  PacketQueueStats queue_stats;
+  /* release destroys the queue under fsm_mutex */
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  if (NULL == g_mp3_player.pkt_queue) {
+    pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+    return -1;
   }
+  PacketQueueStatsGet(g_mp3_player.pkt_queue, &queue_stats);
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  stats->buffered_ms = queue_stats.buffered_ms;
+  stats->rebuffer_count = queue_stats.rebuffer_count;
+  stats->stall_ms = (int)queue_stats.stall_ms;
   return 0;
 }
 
-int Mp3Final(void) {
-  ConvertCtxNode *head = g_mp3_player.convert_ctx_list;
-  ConvertCtxNode *node = head;
-  while (NULL != node) {
-    head = node->next;
-    _destroy_convert_ctx_node(node);
-    node = head;
+int Mp3SetReconnectParam(ReconnectParam *param) {
+  g_mp3_player.reconnect_param = *param;
+  LOGT(MP3_PLAYER_TAG, "max_retries=%d, base_delay=%dms, max_delay=%dms",
+       param->max_retries, param->base_delay_ms, param->max_delay_ms);
+  return 0;
+}
+
+int Mp3SetHedgeParam(HedgeParam *param) {
+  g_mp3_player.hedge_param = *param;
+  LOGT(MP3_PLAYER_TAG, "hedge delay=%dms", param->delay_ms);
+  return 0;
+}
+
+int Mp3SetDecryptKey(const unsigned char *key, int key_bits,
+                     const unsigned char *iv) {
+  if (NULL == key) {
+    g_mp3_player.decrypt_key_bits = 0;
+    return 0;
+  }
+  if (128 != key_bits && 192 != key_bits && 256 != key_bits) {
+    LOGE(MP3_PLAYER_TAG, "invalid aes key bits %d", key_bits);
+    return -1;
+  }
+  memcpy(g_mp3_player.decrypt_key, key, key_bits / 8);
+  memcpy(g_mp3_player.decrypt_iv, iv, CRYPT_IV_SIZE);
+  g_mp3_player.decrypt_key_bits = key_bits;
+  return 0;
+}
+
+int Mp3SetSharedCacheDir(const char *dir) {
+  av_freep(&g_mp3_player.shared_dir);
+  if (NULL != dir && NULL == (g_mp3_player.shared_dir = av_strdup(dir))) {
+    return -1;
+  }
+  LOGT(MP3_PLAYER_TAG, "shared cache dir %s", NULL != dir ? dir : "off");
+  return 0;
+}
+
+int Mp3SetAbrParam(AbrParam *param) {
+  g_mp3_player.abr_param = *param;
+  LOGT(MP3_PLAYER_TAG, "margin=%d%%, down=%dms, up=%dms",
+       param->margin_percent, param->down_window_ms, param->up_window_ms);
+  return 0;
+}
+
+int Mp3SetPauseParam(PauseParam *param) {
+  g_mp3_player.pause_param = *param;
+  if (0 >= g_mp3_player.pause_param.memory_budget) {
+    g_mp3_player.pause_param.memory_budget = PAUSE_MEMORY_BUDGET;
+  }
+  LOGT(MP3_PLAYER_TAG, "pause policy=%s, memory_budget=%d",
+       MP3_PAUSE_STOP_NETWORK == param->policy ? "stop network" :
+       "keep filling", g_mp3_player.pause_param.memory_budget);
+  return 0;
+}
+
+int Mp3SetHibernateParam(HibernateParam *param) {
+  g_mp3_player.hibernate_param = *param;
+  LOGT(MP3_PLAYER_TAG, "hibernate after %dms paused", param->idle_ms);
+  return 0;
+}
+
+int Mp3SetSink(AudioSink *sink) {
+  g_mp3_player.sink = sink;
+  LOGT(MP3_PLAYER_TAG, "sink %s", NULL != sink ? "set" : "cleared");
+  return 0;
+}
+
+int Mp3SetDriftParam(DriftParam *param) {
+  pthread_mutex_lock(&g_mp3_player.drift_mutex);
+  g_mp3_player.drift_param = *param;
+  if (0 >= g_mp3_player.drift_param.max_ppm) {
+    g_mp3_player.drift_param.max_ppm = DRIFT_MAX_PPM;
+  }
+  pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+  LOGT(MP3_PLAYER_TAG, "drift target=%dms, max=%dppm", param->target_ms,
+       g_mp3_player.drift_param.max_ppm);
+  return 0;
+}
+
+/**
+ * rate is smoothed over reports at least DRIFT_MIN_INTERVAL_US apart,
+ * depth error against target is worked off over DRIFT_SETTLE_S
+ */
+int Mp3ReportSinkClock(int64_t played_frames, int64_t mono_us) {
+  DriftState *drift = &g_mp3_player.drift;
+  int rate = g_mp3_player.out.rate;
+  double inst, max;
+  pthread_mutex_lock(&g_mp3_player.drift_mutex);
+  drift->depth = drift->written - played_frames;
+  if (drift->target_depth < 0) {
+    drift->target_depth = (0 < g_mp3_player.drift_param.target_ms ?
+                           (int64_t)rate *
+                           g_mp3_player.drift_param.target_ms / 1000 :
+                           drift->depth);
+  }
+  if (0 != drift->last_us && mono_us - drift->last_us < DRIFT_MIN_INTERVAL_US) {
+    pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+    return 0;
+  }
+  if (0 != drift->last_us) {
+    inst = (double)(played_frames - drift->last_played) * 1000000 /
+           ((double)(mono_us - drift->last_us) * rate);
+    drift->ratio += (inst - drift->ratio) * DRIFT_SMOOTH;
+  }
+  drift->last_played = played_frames;
+  drift->last_us = mono_us;
+  max = g_mp3_player.drift_param.max_ppm / 1000000.0;
+  drift->correction = av_clipd(drift->ratio - 1.0 -
+                               (double)(drift->depth - drift->target_depth) /
+                               ((double)rate * DRIFT_SETTLE_S), -max, max);
+  pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+  return 0;
+}
+
+int Mp3GetDriftStats(DriftStats *stats) {
+  DriftState *drift = &g_mp3_player.drift;
+  pthread_mutex_lock(&g_mp3_player.drift_mutex);
+  stats->drift_ppm = (int)((drift->ratio - 1.0) * 1000000);
+  stats->correction_ppm = (int)(drift->correction * 1000000);
+  stats->depth_ms = (int)(drift->depth * 1000 /
+                          FFMAX(g_mp3_player.out.rate, 1));
+  pthread_mutex_unlock(&g_mp3_player.drift_mutex);
+  return 0;
+}
+
+/* retrieve thread walks branches unlocked, only touch them while idle */
+static int _branches_idle_lock(void) {
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  if (MP3_IDLE_STATE != g_mp3_player.state) {
+    pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+    LOGE(MP3_PLAYER_TAG, "outputs busy, state %s",
+         _state2string(g_mp3_player.state));
+    return -1;
+  }
+  return 0;
+}
+
+int Mp3AddOutput(AudioParam *param, AudioSink *sink) {
+  OutputBranch *branch;
+  int rc = -1;
+  if (0 != _branches_idle_lock()) {
+    return -1;
+  }
+  if (NULL == sink || OUTPUT_BRANCH_MAX <= g_mp3_player.branch_count) {
+    LOGE(MP3_PLAYER_TAG, "add output failed, count=%d",
+         g_mp3_player.branch_count);
+    goto L_END;
+  }
+  branch = &g_mp3_player.branches[g_mp3_player.branch_count];
+  memset(branch, 0, sizeof(OutputBranch));
+  if (0 != _out_format_init(param, &branch->out)) {
+    goto L_END;
+  }
+  branch->sink = sink;
+  LOGT(MP3_PLAYER_TAG, "output %d: rate=%d, channels=%d",
+       g_mp3_player.branch_count, branch->out.rate, branch->out.channels);
+  rc = g_mp3_player.branch_count++;
+L_END:
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  return rc;
+}
+
+int Mp3ClearOutputs(void) {
+  if (0 != _branches_idle_lock()) {
+    return -1;
+  }
+  /* release closed them already, this only forgets the sinks */
+  g_mp3_player.branch_count = 0;
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  return 0;
+}
+
+int Mp3SetVolume(float gain) {
+  return Mp3Fade(gain, -1, (int64_t)g_mp3_player.out.rate * VOLUME_RAMP_MS /
+                 1000, PCM_FADE_LINEAR);
+}
+
+float Mp3GetVolume(void) {
+  if (NULL == g_mp3_player.volume) {
+    return 1;
+  }
+  return PcmVolumeGetLevel(g_mp3_player.volume);
+}
+
+int Mp3Fade(float target, int64_t start, int64_t duration,
+            PcmFadeCurve curve) {
+  FadeRequest *pending = &g_mp3_player.fade_pending;
+  pthread_mutex_lock(&g_mp3_player.pause_mutex);
+  if (MP3_PLAYING_STATE == g_mp3_player.state ||
+      MP3_PAUSED_STATE == g_mp3_player.state) {
+    PcmVolumeFade(g_mp3_player.volume, target, start, duration, curve);
+  } else {
+    pending->valid = 1;
+    pending->target = target;
+    pending->start = start;
+    pending->duration = duration;
+    pending->curve = curve;
+  }
+  pthread_mutex_unlock(&g_mp3_player.pause_mutex);
+  LOGT(MP3_PLAYER_TAG, "fade to %f at %"PRId64" over %"PRId64, target,
+       start, duration);
+  return 0;
+}
+
+int Mp3SetLimiter(PcmLimiterParam *param) {
+  g_mp3_player.limiter_param = *param;
+  return 0;
+}
+
+int Mp3SetOutputPeriod(int period_ms) {
+  g_mp3_player.period_ms = FFMAX(period_ms, 0);
+  LOGT(MP3_PLAYER_TAG, "output period %dms", g_mp3_player.period_ms);
+  return 0;
+}
+
+int Mp3GetMirrorStats(MirrorStats *stats) {
+  HedgeOpenStats hedge_stats;
+  /* release frees the hedge under fsm_mutex */
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  if (NULL == g_mp3_player.hedge) {
+    pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+    return -1;
+  }
+  HedgeOpenStatsGet(g_mp3_player.hedge, &hedge_stats);
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  stats->winner = hedge_stats.winner;
+  stats->open_ms = hedge_stats.open_ms;
+  stats->saved_ms = hedge_stats.saved_ms;
+  stats->saved_is_bound = hedge_stats.saved_is_bound;
+  return 0;
+}
+
+/* stop or next play cancels a tag fetch running outside fsm_mutex */
+static int _id3_interrupt_cb(void *ctx) {
+  Id3Fetch *fetch = (Id3Fetch *)ctx;
+  return g_mp3_player.abort_request || fetch->gen != g_mp3_player.meta_gen;
+}
+
+static int _id3_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  Id3Fetch *fetch = (Id3Fetch *)opaque;
+  int ret;
+  if (fetch->pos >= fetch->end) {
+    return AVERROR_EOF;
+  }
+  if (NULL == fetch->conn) {
+    fetch->conn = NetSessionRequest(fetch->url, fetch->pos, fetch->end,
+                                    &fetch->int_cb);
+    if (NULL == fetch->conn) {
+      return AVERROR(EIO);
+    }
+  }
+  buf_size = (int)FFMIN(buf_size, fetch->end - fetch->pos);
+  if (0 < (ret = HttpConnRead(fetch->conn, buf, buf_size))) {
+    fetch->pos += ret;
+  }
+  return ret;
+}
+
+/* skipped frames like cover art become a new Range request, not a read */
+static int64_t _id3_seek(void *opaque, int64_t offset, int whence) {
+  Id3Fetch *fetch = (Id3Fetch *)opaque;
+  if (whence & AVSEEK_SIZE) {
+    return fetch->end;
+  }
+  if (SEEK_SET != (whence & ~AVSEEK_FORCE) || offset < 0) {
+    return AVERROR(EINVAL);
   }
+  if (offset != fetch->pos) {
+    NetSessionRelease(fetch->conn);
+    fetch->conn = NULL;
+    fetch->pos = offset;
+  }
+  return offset;
+}
+
+/* bytes 0..id3_size only, runs without any player lock */
+static void _id3_fetch(Id3Fetch *fetch, AVDictionary **metadata) {
+  AVIOContext *pb;
+  uint8_t *buffer;
+  fetch->int_cb.callback = _id3_interrupt_cb;
+  fetch->int_cb.opaque = fetch;
+  if (NULL == (buffer = av_malloc(ID3_FETCH_BUF_SIZE))) {
+    return;
+  }
+  pb = avio_alloc_context(buffer, ID3_FETCH_BUF_SIZE, 0, fetch,
+                          _id3_read_packet, NULL, _id3_seek);
+  if (NULL == pb) {
+    av_free(buffer);
+    return;
+  }
+  if (0 != Id3TagParse(pb, metadata)) {
+    LOGW(MP3_PLAYER_TAG, "fetch id3v2 tag failed");
+  }
+  NetSessionRelease(fetch->conn);
+  fetch->conn = NULL;
+  av_freep(&pb->buffer);
+  avio_context_free(&pb);
+}
+
+int Mp3GetMetadata(const char *key, char *value, int len) {
+  AVDictionary *metadata, *fetched = NULL;
+  AVDictionaryEntry *entry;
+  Id3Fetch fetch;
+  int rc = -1;
+  memset(&fetch, 0, sizeof(fetch));
+  /* tag was skipped on open, fetch text frames on first request only */
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  if (NULL != g_mp3_player.fmt_ctx && NULL != g_mp3_player.id3_url) {
+    fetch.url = av_strdup(g_mp3_player.id3_url);
+    fetch.end = g_mp3_player.id3_size;
+    fetch.gen = g_mp3_player.meta_gen;
+  }
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  if (NULL != fetch.url) {
+    _id3_fetch(&fetch, &fetched);
+  }
+  pthread_mutex_lock(&g_mp3_player.fsm_mutex);
+  /* publish once, only into the play it was fetched for */
+  if (NULL != fetch.url && fetch.gen == g_mp3_player.meta_gen &&
+      NULL != g_mp3_player.id3_url) {
+    av_dict_free(&g_mp3_player.metadata);
+    g_mp3_player.metadata = fetched;
+    fetched = NULL;
+    av_freep(&g_mp3_player.id3_url);
+  }
+  if (NULL == g_mp3_player.fmt_ctx) {
+    goto L_END;
+  }
+  metadata = (0 < g_mp3_player.id3_size ? g_mp3_player.metadata :
+              g_mp3_player.fmt_ctx->metadata);
+  if (NULL != (entry = av_dict_get(metadata, key, NULL, 0))) {
+    av_strlcpy(value, entry->value, len);
+    rc = 0;
+  }
+L_END:
+  pthread_mutex_unlock(&g_mp3_player.fsm_mutex);
+  av_dict_free(&fetched);
+  av_free(fetch.url);
+  return rc;
+}
+
+int Mp3Init(AudioParam *param) {
+  OutFormat *out = &g_mp3_player.out;
+  pthread_condattr_t attr;
+  av_register_all();
+  NetSessionInit();
+  pthread_mutex_init(&g_mp3_player.io_mutex, NULL);
+  pthread_mutex_init(&g_mp3_player.pause_mutex, NULL);
+  pthread_mutex_init(&g_mp3_player.fsm_mutex, NULL);
+  pthread_cond_init(&g_mp3_player.fsm_cond, NULL);
+  pthread_mutex_init(&g_mp3_player.feed_mutex, NULL);
+  pthread_mutex_init(&g_mp3_player.drift_mutex, NULL);
+  if (0 == g_mp3_player.drift_param.max_ppm) {
+    g_mp3_player.drift_param.max_ppm = DRIFT_MAX_PPM;
+  }
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&g_mp3_player.pause_cond, &attr);
+  pthread_condattr_destroy(&attr);
+  if (0 == g_mp3_player.pause_param.memory_budget) {
+    g_mp3_player.pause_param.memory_budget = PAUSE_MEMORY_BUDGET;
+  }
+  if (0 == g_mp3_player.prebuffer_param.high_ms) {
+    g_mp3_player.prebuffer_param.start_ms = PREBUFFER_START_MS;
+    g_mp3_player.prebuffer_param.low_ms = PREBUFFER_LOW_MS;
+    g_mp3_player.prebuffer_param.high_ms = PREBUFFER_HIGH_MS;
+  }
+  if (0 == g_mp3_player.abr_param.down_window_ms) {
+    g_mp3_player.abr_param.margin_percent = ABR_MARGIN_PERCENT;
+    g_mp3_player.abr_param.down_window_ms = ABR_DOWN_WINDOW_MS;
+    g_mp3_player.abr_param.up_window_ms = ABR_UP_WINDOW_MS;
+  }
+  if (0 == g_mp3_player.hedge_param.delay_ms) {
+    g_mp3_player.hedge_param.delay_ms = HEDGE_DELAY_MS;
+  }
+  if (0 == g_mp3_player.reconnect_param.max_delay_ms) {
+    g_mp3_player.reconnect_param.max_retries = RECONNECT_MAX_RETRIES;
+    g_mp3_player.reconnect_param.base_delay_ms = RECONNECT_BASE_DELAY_MS;
+    g_mp3_player.reconnect_param.max_delay_ms = RECONNECT_MAX_DELAY_MS;
+  }
+  if (0 != _out_format_init(param, out)) {
+    return -1;
+  }
+  g_mp3_player.volume = PcmVolumeCreate(_pcm_format(out),
+                                        av_sample_fmt_is_planar(
+                                            out->sample_fmt),
+                                        out->channels, out->rate);
+  return NULL != g_mp3_player.volume ? 0 : -1;
+}
+
+int Mp3Final(void) {
+  _convert_ctx_list_free();
+  PcmVolumeDestroy(g_mp3_player.volume);
+  g_mp3_player.volume = NULL;
+  av_freep(&g_mp3_player.shared_dir);
+  pthread_mutex_destroy(&g_mp3_player.io_mutex);
+  pthread_cond_destroy(&g_mp3_player.pause_cond);
+  pthread_mutex_destroy(&g_mp3_player.pause_mutex);
+  pthread_cond_destroy(&g_mp3_player.fsm_cond);
+  pthread_mutex_destroy(&g_mp3_player.fsm_mutex);
+  pthread_mutex_destroy(&g_mp3_player.feed_mutex);
+  pthread_mutex_destroy(&g_mp3_player.drift_mutex);
+  _resume_record_free();
+  NetSessionFinal();
   return 0;
 }
 
@@ -28,20 +28,157 @@
 extern "C" {
 #endif
 
+#include "uni_audio_sink.h"
+#include "uni_pcm_volume.h"
+
 typedef struct {
-  int channels;
-  int rate;
-  int bit; /*16, 32*/
+  int       channels;
+  int       rate;
+  int       bit;            /* 16, 24 (3 bytes packed), 32, 64 float only */
+  int       is_float;       /* bit 32 or 64 */
+  int       planar;         /* one buffer per channel, see SinkFormat */
+  long long channel_layout; /* AV_CH_LAYOUT_*, 0 default of channels */
 } AudioParam;
 
+typedef struct {
+  int connections;   /* concurrent http Range requests, <= 1 disable */
+  int chunk_size;    /* bytes per Range request */
+  int memory_budget; /* max bytes fetched ahead of demuxer */
+} RangeParam;
+
+typedef struct {
+  int start_ms;      /* playback starts once this much audio is buffered */
+  int low_ms;        /* rebuffer when buffered audio falls below, 0 = empty */
+  int high_ms;       /* stop fetching network above */
+} PrebufferParam;
+
+typedef struct {
+  int buffered_ms;
+  int rebuffer_count;
+  int stall_ms;
+} PrebufferStats;
+
+typedef struct {
+  int max_retries;   /* consecutive reconnect attempts, 0 disable */
+  int base_delay_ms; /* backoff before first attempt, doubled each retry */
+  int max_delay_ms;
+} ReconnectParam;
+
+typedef struct {
+  int delay_ms;      /* open next mirror when none decoded a frame by then */
+} HedgeParam;
+
+typedef struct {
+  int winner;        /* index into mirror list now playing */
+  int open_ms;       /* play call to first decodable frame */
+  int saved_ms;      /* primary mirror latency minus open_ms, -1 unknown */
+  int saved_is_bound; /* primary cut off while opening, saved_ms at least */
+} MirrorStats;
+
+typedef struct {
+  char *url;
+  int  bitrate_kbps;
+} Mp3Variant;
+
+typedef struct {
+  int margin_percent; /* throughput above bitrate needed to pick variant */
+  int down_window_ms; /* sustained drop before switching down */
+  int up_window_ms;   /* sustained headroom before switching up */
+} AbrParam;
+
+typedef enum {
+  MP3_PAUSE_KEEP_FILLING = 0, /* prebuffer up to budget, instant resume */
+  MP3_PAUSE_STOP_NETWORK      /* stop fetching, resume reconnects */
+} Mp3PausePolicy;
+
+typedef struct {
+  Mp3PausePolicy policy;
+  int            memory_budget; /* bytes buffered while paused, filling */
+} PauseParam;
+
+typedef struct {
+  int idle_ms;       /* paused this long frees decoder and input, 0 never */
+} HibernateParam;
+
+typedef struct {
+  int target_ms;     /* sink buffer depth to hold, 0 keeps first observed */
+  int max_ppm;       /* cap of rate correction, inaudible below ~1000 */
+} DriftParam;
+
+typedef struct {
+  int drift_ppm;     /* sink clock against nominal rate, + runs fast */
+  int correction_ppm;
+  int depth_ms;      /* sink buffer depth at last report */
+} DriftStats;
+
 int Mp3Play(char *filename);
+/* urls ordered by preference, slow primary is hedged by the next mirror */
+int Mp3PlayMirrors(char **urls, int count);
+/* same track at several bitrates, switches on measured throughput */
+int Mp3PlayVariants(Mp3Variant *variants, int count);
 int Mp3Prepare(char *filename);
 int Mp3Start(void);
 int Mp3Pause(void);
 int Mp3Resume(void);
 int Mp3Stop(void);
 
+/* push mode, playback starts once the first mp3 frame is fed */
+int Mp3FeedBegin(void);
+int Mp3Feed(char *data, int len);
+int Mp3FeedEnd(void);
+
 int Mp3Init(AudioParam *param);
+int Mp3SetRangeParam(RangeParam *param);
+int Mp3SetPrebufferParam(PrebufferParam *param);
+int Mp3GetPrebufferStats(PrebufferStats *stats);
+int Mp3SetReconnectParam(ReconnectParam *param);
+/* key like "title", "artist", "album", 0 on success */
+int Mp3GetMetadata(const char *key, char *value, int len);
+int Mp3SetHedgeParam(HedgeParam *param);
+int Mp3SetAbrParam(AbrParam *param);
+int Mp3SetPauseParam(PauseParam *param);
+int Mp3SetHibernateParam(HibernateParam *param);
+/* pcm goes to sink from next play, opened per play, NULL discards */
+int Mp3SetSink(AudioSink *sink);
+int Mp3SetDriftParam(DriftParam *param);
+/* sink gets exact period_ms chunks from next play, 0 as decoded */
+int Mp3SetOutputPeriod(int period_ms);
+/**
+ * extra rendition of the same decode, e.g. 16k mono for aec or asr next to
+ * 48k stereo speaker. own swr and sink, up to 4, from next play. period
+ * and drift apply to main output only. idle only, return output index or -1
+ */
+int Mp3AddOutput(AudioParam *param, AudioSink *sink);
+/* drop added outputs while idle, sinks stay owned by caller */
+int Mp3ClearOutputs(void);
+/* software gain on main output, linear, ramped over 10ms against zipper */
+int Mp3SetVolume(float gain);
+float Mp3GetVolume(void);
+/**
+ * sample accurate fade to target, start and duration in output frames of
+ * current play, start -1 now. before play it applies to the next one,
+ * start 0 gives a fade in
+ */
+int Mp3Fade(float target, int64_t start, int64_t duration,
+            PcmFadeCurve curve);
+/* peak limiter after gain from next play, output delayed by lookahead */
+int Mp3SetLimiter(PcmLimiterParam *param);
+/**
+ * sink clock observation, played_frames consumed by device since sink
+ * opened for this play, at CLOCK_MONOTONIC mono_us. output is resampled
+ * by the estimated drift so sink buffer depth stays flat
+ */
+int Mp3ReportSinkClock(int64_t played_frames, int64_t mono_us);
+int Mp3GetDriftStats(DriftStats *stats);
+/* http plays of same url by any process on host download once, NULL off */
+int Mp3SetSharedCacheDir(const char *dir);
+/**
+ * AES-CTR key for next plays, iv is 16-byte counter block of byte 0.
+ * key_bits 128, 192 or 256, NULL key back to plain input
+ */
+int Mp3SetDecryptKey(const unsigned char *key, int key_bits,
+                     const unsigned char *iv);
+int Mp3GetMirrorStats(MirrorStats *stats);
 int Mp3Final(void);
 
 int Mp3CheckIsPlaying(void);
@@ -0,0 +1,616 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_net_session.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.15
+ *
+ **************************************************************************/
+#include "uni_net_session.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include "uni_log.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NET_SESSION_TAG      "net_session"
+#define NET_POOL_SIZE        (8)
+#define NET_IDLE_TIMEOUT_S   (15)
+#define NET_MAX_REDIRECT     (5)
+#define NET_RW_TIMEOUT_MS    (5000)
+#define NET_POLL_MS          (100)
+#define NET_RECV_LEN         (16 * 1024)
+#define NET_PROTO_LEN        (16)
+#define NET_HOST_LEN         (256)
+#define NET_URL_LEN          (2048)
+#define NET_KEY_LEN          (NET_HOST_LEN + 32)
+
+typedef struct {
+  char proto[NET_PROTO_LEN];
+  char host[NET_HOST_LEN];
+  int  port;
+  char path[NET_URL_LEN];
+  char key[NET_KEY_LEN];
+} UrlParts;
+
+struct HttpConn {
+  char            key[NET_KEY_LEN];
+  int             fd;
+  int             error;
+  uint8_t         recv_buf[NET_RECV_LEN];
+  int             recv_pos;
+  int             recv_len;
+  AVIOInterruptCB user_cb;
+  int             reused;
+  int             status;
+  int64_t         range_start;
+  int64_t         total_size;
+  int64_t         body_left;
+  int64_t         chunk_left;
+  int             chunked;
+  int             accept_ranges;
+  int             keep_alive;
+  int             eof;
+  int             idle_since;
+  char            location[NET_URL_LEN];
+  struct HttpConn *next;
+};
+
+static struct {
+  int             ref;
+  HttpConn        *idle;
+  int             idle_count;
+  pthread_mutex_t mutex;
+} g_net_session = {0, NULL, 0, PTHREAD_MUTEX_INITIALIZER};
+
+static int _split_url(const char *url, UrlParts *parts) {
+  av_url_split(parts->proto, sizeof(parts->proto), NULL, 0,
+               parts->host, sizeof(parts->host), &parts->port,
+               parts->path, sizeof(parts->path), url);
+  /* plain sockets only, https is left to ffmpeg tls */
+  if (0 != strcmp(parts->proto, "http")) {
+    return -1;
+  }
+  parts->port = parts->port < 0 ? 80 : parts->port;
+  if ('\0' == parts->host[0]) {
+    return -1;
+  }
+  if ('\0' == parts->path[0]) {
+    av_strlcpy(parts->path, "/", sizeof(parts->path));
+  }
+  snprintf(parts->key, sizeof(parts->key), "%s://%s:%d", parts->proto,
+           parts->host, parts->port);
+  return 0;
+}
+
+static void _conn_close(HttpConn *conn) {
+  if (NULL != conn) {
+    if (0 <= conn->fd) {
+      close(conn->fd);
+    }
+    av_free(conn);
+  }
+}
+
+/* poll in short slices so user callback can abort, rw timeout overall */
+static int _conn_wait(HttpConn *conn, short events) {
+  struct pollfd pfd;
+  int waited_ms = 0, ret;
+  pfd.fd = conn->fd;
+  pfd.events = events;
+  while (1) {
+    if (NULL != conn->user_cb.callback &&
+        conn->user_cb.callback(conn->user_cb.opaque)) {
+      return AVERROR_EXIT;
+    }
+    if (0 < (ret = poll(&pfd, 1, NET_POLL_MS))) {
+      return 0;
+    }
+    if (ret < 0 && EINTR != errno) {
+      return AVERROR(errno);
+    }
+    if ((waited_ms += NET_POLL_MS) >= NET_RW_TIMEOUT_MS) {
+      return AVERROR(ETIMEDOUT);
+    }
+  }
+}
+
+/* 0 connected, AVERROR_EXIT aborted by user, else try next address */
+static int _conn_try(HttpConn *conn, const struct addrinfo *ai) {
+  int err = 0, ret;
+  socklen_t len = sizeof(err);
+  conn->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+  if (conn->fd < 0 || (0 != connect(conn->fd, ai->ai_addr, ai->ai_addrlen) &&
+                       EINPROGRESS != errno)) {
+    ret = AVERROR(errno);
+  } else if (0 == (ret = _conn_wait(conn, POLLOUT)) &&
+             0 != getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len)) {
+    ret = AVERROR(errno);
+  } else if (0 == ret && 0 != err) {
+    ret = AVERROR(err);
+  }
+  if (0 != ret) {
+    LOGW(NET_SESSION_TAG, "connect %s failed[%s]", conn->key, av_err2str(ret));
+    if (0 <= conn->fd) {
+      close(conn->fd);
+    }
+    conn->fd = -1;
+  }
+  return ret;
+}
+
+static HttpConn* _conn_connect(UrlParts *parts, const AVIOInterruptCB *int_cb) {
+  struct addrinfo hints, *ai = NULL, *cur;
+  HttpConn *conn;
+  char service[16];
+  int ret = AVERROR(EHOSTUNREACH);
+  if (NULL == (conn = av_mallocz(sizeof(HttpConn)))) {
+    return NULL;
+  }
+  conn->fd = -1;
+  av_strlcpy(conn->key, parts->key, sizeof(conn->key));
+  if (NULL != int_cb) {
+    conn->user_cb = *int_cb;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%d", parts->port);
+  if (0 != getaddrinfo(parts->host, service, &hints, &ai)) {
+    LOGE(NET_SESSION_TAG, "resolve %s failed", parts->host);
+    goto L_ERROR;
+  }
+  /* first record may be v6 on a v4 only box or a dead mirror, walk all */
+  for (cur = ai; NULL != cur && AVERROR_EXIT != ret; cur = cur->ai_next) {
+    if (0 == (ret = _conn_try(conn, cur))) {
+      break;
+    }
+  }
+  if (0 != ret) {
+    LOGE(NET_SESSION_TAG, "connect %s failed", conn->key);
+    goto L_ERROR;
+  }
+  freeaddrinfo(ai);
+  LOGT(NET_SESSION_TAG, "new connection %s", conn->key);
+  return conn;
+L_ERROR:
+  if (NULL != ai) {
+    freeaddrinfo(ai);
+  }
+  _conn_close(conn);
+  return NULL;
+}
+
+static int _conn_send(HttpConn *conn, const char *buf, int len) {
+  int sent = 0, ret;
+  while (sent < len) {
+    ret = send(conn->fd, buf + sent, len - sent, MSG_NOSIGNAL);
+    if (0 < ret) {
+      sent += ret;
+      continue;
+    }
+    if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) &&
+        0 == (ret = _conn_wait(conn, POLLOUT))) {
+      continue;
+    }
+    conn->error = 1;
+    return -1;
+  }
+  return 0;
+}
+
+/* recv at most size, 0 when peer closed, marks conn broken on error */
+static int _conn_recv(HttpConn *conn, uint8_t *buf, int size) {
+  int ret;
+  while (1) {
+    if (0 <= (ret = recv(conn->fd, buf, size, 0))) {
+      return ret;
+    }
+    if ((EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) ||
+        0 != (ret = _conn_wait(conn, POLLIN))) {
+      conn->error = 1;
+      return AVERROR_EXIT == ret ? ret : AVERROR(EIO);
+    }
+  }
+}
+
+static int _conn_getc(HttpConn *conn) {
+  int ret;
+  if (conn->recv_pos == conn->recv_len) {
+    if ((ret = _conn_recv(conn, conn->recv_buf, NET_RECV_LEN)) <= 0) {
+      return -1;
+    }
+    conn->recv_pos = 0;
+    conn->recv_len = ret;
+  }
+  return conn->recv_buf[conn->recv_pos++];
+}
+
+static HttpConn* _pool_take(const char *key) {
+  HttpConn *conn, **prev;
+  int now = time(NULL);
+  pthread_mutex_lock(&g_net_session.mutex);
+  prev = &g_net_session.idle;
+  while (NULL != (conn = *prev)) {
+    if (now - conn->idle_since >= NET_IDLE_TIMEOUT_S) {
+      *prev = conn->next;
+      g_net_session.idle_count--;
+      _conn_close(conn);
+      continue;
+    }
+    if (0 == strcmp(conn->key, key)) {
+      *prev = conn->next;
+      g_net_session.idle_count--;
+      conn->next = NULL;
+      conn->reused = 1;
+      break;
+    }
+    prev = &conn->next;
+  }
+  pthread_mutex_unlock(&g_net_session.mutex);
+  return conn;
+}
+
+static void _pool_put(HttpConn *conn) {
+  pthread_mutex_lock(&g_net_session.mutex);
+  if (0 == g_net_session.ref || NET_POOL_SIZE <= g_net_session.idle_count) {
+    pthread_mutex_unlock(&g_net_session.mutex);
+    _conn_close(conn);
+    return;
+  }
+  memset(&conn->user_cb, 0, sizeof(conn->user_cb));
+  conn->idle_since = time(NULL);
+  conn->next = g_net_session.idle;
+  g_net_session.idle = conn;
+  g_net_session.idle_count++;
+  pthread_mutex_unlock(&g_net_session.mutex);
+}
+
+static void _pool_clear(void) {
+  HttpConn *conn;
+  pthread_mutex_lock(&g_net_session.mutex);
+  while (NULL != (conn = g_net_session.idle)) {
+    g_net_session.idle = conn->next;
+    _conn_close(conn);
+  }
+  g_net_session.idle_count = 0;
+  pthread_mutex_unlock(&g_net_session.mutex);
+}
+
+static int _read_line(HttpConn *conn, char *buf, int len) {
+  int i = 0, c;
+  while (1) {
+    if ((c = _conn_getc(conn)) < 0) {
+      return -1;
+    }
+    if ('\n' == c) {
+      break;
+    }
+    if (i < len - 1) {
+      buf[i++] = c;
+    }
+  }
+  if (0 < i && '\r' == buf[i - 1]) {
+    i--;
+  }
+  buf[i] = '\0';
+  return i;
+}
+
+static int _send_request(HttpConn *conn, UrlParts *parts, int64_t offset,
+                         int64_t end_offset) {
+  char req[NET_URL_LEN + NET_KEY_LEN + 256];
+  int len;
+  len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\n", parts->path);
+  if (80 == parts->port) {
+    len += snprintf(req + len, sizeof(req) - len, "Host: %s\r\n",
+                    parts->host);
+  } else {
+    len += snprintf(req + len, sizeof(req) - len, "Host: %s:%d\r\n",
+                    parts->host, parts->port);
+  }
+  len += snprintf(req + len, sizeof(req) - len, "User-Agent: uni_mp3_player"
+                  "\r\nAccept: */*\r\nConnection: keep-alive\r\n");
+  if (0 < end_offset) {
+    len += snprintf(req + len, sizeof(req) - len,
+                    "Range: bytes=%lld-%lld\r\n", (long long)offset,
+                    (long long)end_offset - 1);
+  } else if (0 < offset) {
+    len += snprintf(req + len, sizeof(req) - len, "Range: bytes=%lld-\r\n",
+                    (long long)offset);
+  }
+  len += snprintf(req + len, sizeof(req) - len, "\r\n");
+  if (len >= (int)sizeof(req)) {
+    LOGE(NET_SESSION_TAG, "request too long %s", parts->path);
+    return -1;
+  }
+  return _conn_send(conn, req, len);
+}
+
+static void _parse_header(HttpConn *conn, const char *line,
+                          int64_t *content_length) {
+  const char *p, *q;
+  if (av_stristart(line, "Content-Length:", &p)) {
+    *content_length = strtoll(p, NULL, 10);
+  } else if (av_stristart(line, "Content-Range:", &p)) {
+    if (NULL != (q = av_stristr(p, "bytes "))) {
+      conn->range_start = strtoll(q + 6, NULL, 10);
+    }
+    if (NULL != (p = strchr(p, '/')) && '*' != p[1]) {
+      conn->total_size = strtoll(p + 1, NULL, 10);
+    }
+  } else if (av_stristart(line, "Transfer-Encoding:", &p)) {
+    conn->chunked = (NULL != av_stristr(p, "chunked"));
+  } else if (av_stristart(line, "Accept-Ranges:", &p)) {
+    conn->accept_ranges = (NULL != av_stristr(p, "bytes"));
+  } else if (av_stristart(line, "Connection:", &p)) {
+    if (NULL != av_stristr(p, "close")) {
+      conn->keep_alive = 0;
+    } else if (NULL != av_stristr(p, "keep-alive")) {
+      conn->keep_alive = 1;
+    }
+  } else if (av_stristart(line, "Location:", &p)) {
+    while (' ' == *p) {
+      p++;
+    }
+    av_strlcpy(conn->location, p, sizeof(conn->location));
+  }
+}
+
+static int _read_response(HttpConn *conn) {
+  char line[NET_URL_LEN];
+  int64_t content_length = -1;
+  int minor = 0;
+  if (_read_line(conn, line, sizeof(line)) < 0 ||
+      2 != sscanf(line, "HTTP/1.%d %d", &minor, &conn->status)) {
+    return -1;
+  }
+  conn->keep_alive = (1 == minor);
+  conn->total_size = -1;
+  conn->range_start = -1;
+  conn->chunked = 0;
+  conn->chunk_left = 0;
+  conn->accept_ranges = 0;
+  conn->eof = 0;
+  conn->location[0] = '\0';
+  while (1) {
+    if (_read_line(conn, line, sizeof(line)) < 0) {
+      return -1;
+    }
+    if ('\0' == line[0]) {
+      break;
+    }
+    _parse_header(conn, line, &content_length);
+  }
+  if (206 == conn->status) {
+    conn->accept_ranges = 1;
+  } else if (200 == conn->status) {
+    conn->total_size = content_length;
+  }
+  if (conn->chunked) {
+    conn->body_left = -1;
+  } else if (204 == conn->status || 304 == conn->status) {
+    conn->body_left = 0;
+  } else {
+    conn->body_left = content_length;
+    /* no length, body ends when server closes */
+    conn->keep_alive = conn->keep_alive && 0 <= content_length;
+  }
+  conn->eof = (0 == conn->body_left);
+  return 0;
+}
+
+static HttpConn* _request_once(const char *url, int64_t offset,
+                               int64_t end_offset,
+                               const AVIOInterruptCB *int_cb) {
+  UrlParts parts;
+  HttpConn *conn;
+  if (0 != _split_url(url, &parts)) {
+    LOGE(NET_SESSION_TAG, "unsupported url %s", url);
+    return NULL;
+  }
+  while (1) {
+    if (NULL == (conn = _pool_take(parts.key)) &&
+        NULL == (conn = _conn_connect(&parts, int_cb))) {
+      return NULL;
+    }
+    if (NULL != int_cb) {
+      conn->user_cb = *int_cb;
+    }
+    if (0 == _send_request(conn, &parts, offset, end_offset) &&
+        0 == _read_response(conn)) {
+      return conn;
+    }
+    /* server may drop idle kept-alive connection, retry on a new one */
+    if (!conn->reused) {
+      LOGE(NET_SESSION_TAG, "request %s failed", url);
+      _conn_close(conn);
+      return NULL;
+    }
+    LOGW(NET_SESSION_TAG, "reused connection %s dropped", conn->key);
+    _conn_close(conn);
+  }
+}
+
+static void _resolve_location(char *url, int len, const char *location) {
+  UrlParts parts;
+  char *p;
+  if (NULL != strstr(location, "://")) {
+    av_strlcpy(url, location, len);
+    return;
+  }
+  if ('/' == location[0]) {
+    _split_url(url, &parts);
+    av_strlcpy(url, parts.key, len);
+    av_strlcat(url, location, len);
+    return;
+  }
+  if (NULL != (p = strrchr(url, '/'))) {
+    p[1] = '\0';
+  }
+  av_strlcat(url, location, len);
+}
+
+HttpConn* NetSessionRequest(const char *url, int64_t offset,
+                            int64_t end_offset, const AVIOInterruptCB *int_cb) {
+  char cur[NET_URL_LEN];
+  HttpConn *conn;
+  int i;
+  av_strlcpy(cur, url, sizeof(cur));
+  for (i = 0; i <= NET_MAX_REDIRECT; i++) {
+    if (NULL == (conn = _request_once(cur, offset, end_offset, int_cb))) {
+      return NULL;
+    }
+    if (300 <= conn->status && conn->status < 400 &&
+        '\0' != conn->location[0]) {
+      _resolve_location(cur, sizeof(cur), conn->location);
+      LOGT(NET_SESSION_TAG, "redirect to %s", cur);
+      NetSessionRelease(conn);
+      continue;
+    }
+    if (conn->status < 200 || 300 <= conn->status) {
+      LOGE(NET_SESSION_TAG, "%s http status %d", cur, conn->status);
+      NetSessionRelease(conn);
+      return NULL;
+    }
+    /* server ignoring Range would restart body from byte 0 */
+    if (0 < offset && (206 != conn->status || offset != conn->range_start)) {
+      LOGE(NET_SESSION_TAG, "%s range %lld not honored, status %d", cur,
+           (long long)offset, conn->status);
+      NetSessionRelease(conn);
+      return NULL;
+    }
+    return conn;
+  }
+  LOGE(NET_SESSION_TAG, "too many redirect %s", url);
+  return NULL;
+}
+
+void NetSessionRelease(HttpConn *conn) {
+  if (NULL == conn) {
+    return;
+  }
+  /* bytes past body mean a confused peer, do not reuse */
+  if (conn->keep_alive && conn->eof && !conn->error &&
+      conn->recv_pos == conn->recv_len) {
+    _pool_put(conn);
+    return;
+  }
+  _conn_close(conn);
+}
+
+static int _read_chunk_size(HttpConn *conn) {
+  char line[64];
+  if (_read_line(conn, line, sizeof(line)) < 0) {
+    return -1;
+  }
+  conn->chunk_left = strtoll(line, NULL, 16);
+  if (0 == conn->chunk_left) {
+    /* skip trailer */
+    while (0 < _read_line(conn, line, sizeof(line))) {
+    }
+    conn->eof = 1;
+  }
+  return 0;
+}
+
+int HttpConnRead(HttpConn *conn, uint8_t *buf, int size) {
+  char crlf[4];
+  int ret;
+  if (conn->eof) {
+    return AVERROR_EOF;
+  }
+  if (conn->chunked) {
+    if (0 == conn->chunk_left && 0 != _read_chunk_size(conn)) {
+      return AVERROR(EIO);
+    }
+    if (conn->eof) {
+      return AVERROR_EOF;
+    }
+    size = (int)FFMIN(size, conn->chunk_left);
+  } else if (0 <= conn->body_left) {
+    size = (int)FFMIN(size, conn->body_left);
+  }
+  if (conn->recv_pos < conn->recv_len) {
+    ret = FFMIN(size, conn->recv_len - conn->recv_pos);
+    memcpy(buf, conn->recv_buf + conn->recv_pos, ret);
+    conn->recv_pos += ret;
+  } else {
+    ret = _conn_recv(conn, buf, size);
+  }
+  if (ret <= 0) {
+    if (0 == ret && !conn->chunked && conn->body_left < 0) {
+      conn->eof = 1;
+      return AVERROR_EOF;
+    }
+    return ret < 0 ? ret : AVERROR(EIO);
+  }
+  if (conn->chunked) {
+    conn->chunk_left -= ret;
+    if (0 == conn->chunk_left && _read_line(conn, crlf, sizeof(crlf)) < 0) {
+      return AVERROR(EIO);
+    }
+  } else if (0 <= conn->body_left) {
+    conn->body_left -= ret;
+    conn->eof = (0 == conn->body_left);
+  }
+  return ret;
+}
+
+int64_t HttpConnTotalSize(HttpConn *conn) {
+  return conn->total_size;
+}
+
+int HttpConnAcceptRanges(HttpConn *conn) {
+  return conn->accept_ranges;
+}
+
+int NetSessionInit(void) {
+  /* https and ffmpeg fallbacks still open tcp/tls on several threads */
+  pthread_mutex_lock(&g_net_session.mutex);
+  if (0 == g_net_session.ref++) {
+    avformat_network_init();
+  }
+  pthread_mutex_unlock(&g_net_session.mutex);
+  return 0;
+}
+
+int NetSessionFinal(void) {
+  int last;
+  pthread_mutex_lock(&g_net_session.mutex);
+  last = (0 < g_net_session.ref && 0 == --g_net_session.ref);
+  pthread_mutex_unlock(&g_net_session.mutex);
+  if (last) {
+    _pool_clear();
+    avformat_network_deinit();
+  }
+  return 0;
+}
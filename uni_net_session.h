@@ -0,0 +1,60 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_net_session.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.15
+ *
+ **************************************************************************/
+#ifndef NET_SESSION_INC_UNI_NET_SESSION_H_
+#define NET_SESSION_INC_UNI_NET_SESSION_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct HttpConn HttpConn;
+
+/* network subsystem stays initialized between Init and Final */
+int       NetSessionInit(void);
+int       NetSessionFinal(void);
+
+/**
+ * send GET url on a kept-alive connection of same scheme://host:port when
+ * one is idle in pool, otherwise connect. end_offset <= 0 means to the end,
+ * offset > 0 fails unless server answers 206 from exactly offset. plain
+ * http only, NULL for https so caller falls back to ffmpeg tls. int_cb is
+ * polled while blocking, may be NULL
+ */
+HttpConn* NetSessionRequest(const char *url, int64_t offset,
+                            int64_t end_offset, const AVIOInterruptCB *int_cb);
+/* give connection back to pool when body fully read, otherwise close it */
+void      NetSessionRelease(HttpConn *conn);
+
+/* read response body, AVERROR_EOF at end of body */
+int       HttpConnRead(HttpConn *conn, uint8_t *buf, int size);
+/* whole resource size from Content-Range or Content-Length, -1 unknown */
+int64_t   HttpConnTotalSize(HttpConn *conn);
+int       HttpConnAcceptRanges(HttpConn *conn);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* NET_SESSION_INC_UNI_NET_SESSION_H_ */
@@ -0,0 +1,215 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_packet_queue.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.22
+ *
+ **************************************************************************/
+#include "uni_packet_queue.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include "uni_log.h"
+#include <pthread.h>
+#include <time.h>
+
+#define PACKET_QUEUE_TAG     "packet_queue"
+
+typedef struct PacketNode {
+  AVPacket          pkt;
+  int               duration_ms;
+  struct PacketNode *next;
+} PacketNode;
+
+struct PacketQueue {
+  PacketNode      *first;
+  PacketNode      *last;
+  int             duration_ms;
+  int             bytes;
+  int             start_ms;
+  int             low_ms;
+  int             high_ms;
+  int             high_bytes;
+  int             buffering;
+  int             eof;
+  int             aborted;
+  int             rebuffer_count;
+  int64_t         stall_ms;
+  int64_t         stall_begin_ms;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
+static int64_t _now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+PacketQueue* PacketQueueCreate(int start_ms, int low_ms, int high_ms) {
+  PacketQueue *queue;
+  if (NULL == (queue = av_mallocz(sizeof(PacketQueue)))) {
+    LOGE(PACKET_QUEUE_TAG, "alloc packet queue failed");
+    return NULL;
+  }
+  queue->start_ms = start_ms;
+  queue->low_ms = low_ms;
+  queue->high_ms = high_ms;
+  queue->buffering = 1;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  return queue;
+}
+
+void PacketQueueDestroy(PacketQueue *queue) {
+  PacketNode *node;
+  if (NULL == queue) {
+    return;
+  }
+  while (NULL != (node = queue->first)) {
+    queue->first = node->next;
+    av_packet_unref(&node->pkt);
+    av_free(node);
+  }
+  pthread_cond_destroy(&queue->cond);
+  pthread_mutex_destroy(&queue->mutex);
+  av_free(queue);
+}
+
+int PacketQueuePut(PacketQueue *queue, AVPacket *pkt, int duration_ms) {
+  PacketNode *node;
+  if (NULL == (node = av_malloc(sizeof(PacketNode)))) {
+    return -1;
+  }
+  av_packet_move_ref(&node->pkt, pkt);
+  node->duration_ms = duration_ms;
+  node->next = NULL;
+  pthread_mutex_lock(&queue->mutex);
+  /* above high watermark, stop fetching until decoder drains */
+  while ((queue->duration_ms >= queue->high_ms ||
+          (0 < queue->high_bytes && queue->bytes >= queue->high_bytes)) &&
+         !queue->aborted) {
+    pthread_cond_wait(&queue->cond, &queue->mutex);
+  }
+  if (queue->aborted) {
+    pthread_mutex_unlock(&queue->mutex);
+    av_packet_move_ref(pkt, &node->pkt);
+    av_free(node);
+    return -1;
+  }
+  if (NULL == queue->last) {
+    queue->first = node;
+  } else {
+    queue->last->next = node;
+  }
+  queue->last = node;
+  queue->duration_ms += duration_ms;
+  queue->bytes += node->pkt.size;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+static void _stall_end(PacketQueue *queue) {
+  queue->buffering = 0;
+  if (0 != queue->stall_begin_ms) {
+    queue->stall_ms += _now_ms() - queue->stall_begin_ms;
+    queue->stall_begin_ms = 0;
+    LOGT(PACKET_QUEUE_TAG, "rebuffer done, buffered=%dms, stall=%lldms",
+         queue->duration_ms, (long long)queue->stall_ms);
+  }
+}
+
+int PacketQueueGet(PacketQueue *queue, AVPacket *pkt) {
+  PacketNode *node;
+  pthread_mutex_lock(&queue->mutex);
+  while (!queue->aborted) {
+    if (queue->buffering) {
+      if (queue->duration_ms >= queue->start_ms || queue->eof) {
+        _stall_end(queue);
+      } else {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+      }
+      continue;
+    }
+    if (!queue->eof &&
+        (NULL == queue->first || queue->duration_ms < queue->low_ms)) {
+      queue->buffering = 1;
+      queue->rebuffer_count++;
+      queue->stall_begin_ms = _now_ms();
+      LOGW(PACKET_QUEUE_TAG, "rebuffer[%d], buffered=%dms",
+           queue->rebuffer_count, queue->duration_ms);
+      continue;
+    }
+    if (NULL == (node = queue->first)) {
+      break;
+    }
+    if (NULL == (queue->first = node->next)) {
+      queue->last = NULL;
+    }
+    queue->duration_ms -= node->duration_ms;
+    queue->bytes -= node->pkt.size;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    av_packet_move_ref(pkt, &node->pkt);
+    av_free(node);
+    return 0;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return AVERROR_EOF;
+}
+
+int PacketQueueSetHighWater(PacketQueue *queue, int high_ms,
+                            int high_bytes) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->high_ms = high_ms;
+  queue->high_bytes = high_bytes;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+int PacketQueueEnd(PacketQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->eof = 1;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+int PacketQueueAbort(PacketQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->aborted = 1;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
+
+int PacketQueueStatsGet(PacketQueue *queue, PacketQueueStats *stats) {
+  pthread_mutex_lock(&queue->mutex);
+  stats->buffered_ms = queue->duration_ms;
+  stats->buffered_bytes = queue->bytes;
+  stats->rebuffer_count = queue->rebuffer_count;
+  stats->stall_ms = queue->stall_ms;
+  if (0 != queue->stall_begin_ms) {
+    stats->stall_ms += _now_ms() - queue->stall_begin_ms;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_packet_queue.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.22
+ *
+ **************************************************************************/
+#ifndef PACKET_QUEUE_INC_UNI_PACKET_QUEUE_H_
+#define PACKET_QUEUE_INC_UNI_PACKET_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+
+typedef struct PacketQueue PacketQueue;
+
+typedef struct {
+  int     buffered_ms;
+  int     buffered_bytes;
+  int     rebuffer_count;
+  int64_t stall_ms;
+} PacketQueueStats;
+
+/**
+ * compressed packet prebuffer measured in ms of playable audio.
+ * Get holds back until start_ms buffered, rebuffers once below low_ms,
+ * Put blocks while high_ms or more buffered
+ */
+PacketQueue* PacketQueueCreate(int start_ms, int low_ms, int high_ms);
+void         PacketQueueDestroy(PacketQueue *queue);
+
+/* take ownership of pkt, -1 when aborted */
+int          PacketQueuePut(PacketQueue *queue, AVPacket *pkt,
+                            int duration_ms);
+/* 0 with pkt filled, AVERROR_EOF when drained after End or on Abort */
+int          PacketQueueGet(PacketQueue *queue, AVPacket *pkt);
+/* move high watermark, high_bytes > 0 also caps buffered bytes */
+int          PacketQueueSetHighWater(PacketQueue *queue, int high_ms,
+                                     int high_bytes);
+int          PacketQueueEnd(PacketQueue *queue);
+int          PacketQueueAbort(PacketQueue *queue);
+int          PacketQueueStatsGet(PacketQueue *queue, PacketQueueStats *stats);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* PACKET_QUEUE_INC_UNI_PACKET_QUEUE_H_ */
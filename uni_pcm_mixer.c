@@ -0,0 +1,425 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_mixer.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.03
+ *
+ **************************************************************************/
+#include "uni_pcm_mixer.h"
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include "uni_pcm_ops.h"
+#include <pthread.h>
+#include <string.h>
+
+#define PCM_MIXER_TAG     "pcm_mixer"
+#define MIXER_BLOCK_BYTES (4096)
+#define DUCK_LEVEL        (0.3f)
+#define DUCK_ATTACK_MS    (50)
+#define DUCK_RELEASE_MS   (400)
+
+struct PcmMixerInput {
+  PcmMixer      *mixer;
+  MixerRole     role;
+  float         gain;
+  uint8_t       *data;
+  int           capacity;   /* bytes, whole frames */
+  int64_t       read_pos;
+  int64_t       write_pos;
+  int           opened;
+  int           draining;   /* partial last block may go out */
+  int           active;     /* written since open or last drain, ducks */
+  int           aborted;
+  AudioSink     *sink;
+  PcmMixerInput *next;
+};
+
+struct PcmMixer {
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;       /* mixer waits for input */
+  pthread_cond_t  space_cond; /* inputs wait for room or drain */
+  SinkFormat      format;
+  PcmFormat       pcm;
+  int             frame_bytes;
+  int             block;      /* frames per mix */
+  uint8_t         *out;
+  AudioSink       *output;
+  PcmMixerInput   *inputs;
+  DuckParam       duck_param;
+  float           duck;       /* music gain from ducking now */
+  int             quit;
+  pthread_t       thread;
+};
+
+static int _avail(PcmMixerInput *input) {
+  return (int)(input->write_pos - input->read_pos);
+}
+
+/* frames input gives to next mix, full blocks until it drains */
+static int _take(PcmMixerInput *input) {
+  PcmMixer *mixer = input->mixer;
+  int frames = _avail(input) / mixer->frame_bytes;
+  if (!input->opened) {
+    return 0;
+  }
+  if (frames >= mixer->block) {
+    return mixer->block;
+  }
+  return input->draining ? frames : 0;
+}
+
+static int _ready(PcmMixer *mixer) {
+  PcmMixerInput *input;
+  for (input = mixer->inputs; NULL != input; input = input->next) {
+    if (0 < _take(input)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* music gain moves linearly to target, full swing takes attack or release */
+static float _duck_step(PcmMixer *mixer, float target, int frames) {
+  DuckParam *param = &mixer->duck_param;
+  int ms = target < mixer->duck ? param->attack_ms : param->release_ms;
+  float range = FFMAX(1 - param->level, 0.001f);
+  float delta = 0 < ms ? range * frames * 1000 / mixer->format.rate / ms :
+                         range;
+  if (target < mixer->duck) {
+    return FFMAX(mixer->duck - delta, target);
+  }
+  return FFMIN(mixer->duck + delta, target);
+}
+
+static void _mix_input(PcmMixer *mixer, PcmMixerInput *input, int frames,
+                       float gain, float step) {
+  int off = input->read_pos % input->capacity;
+  int bytes = frames * mixer->frame_bytes;
+  int first = FFMIN(bytes, input->capacity - off);
+  int bps = PcmBytes(mixer->pcm), channels = mixer->format.channels;
+  PcmMix(mixer->pcm, mixer->out, input->data + off, first / bps, channels,
+         gain, step);
+  if (first < bytes) {
+    PcmMix(mixer->pcm, mixer->out + first, input->data, (bytes - first) / bps,
+           channels, gain + step * (first / mixer->frame_bytes), step);
+  }
+  input->read_pos += bytes;
+}
+
+/* one block into mixer->out with mutex held, no allocation */
+static int _mix(PcmMixer *mixer) {
+  PcmMixerInput *input;
+  int frames = 0, prompt = 0, n;
+  float g0 = mixer->duck, g1, step;
+  for (input = mixer->inputs; NULL != input; input = input->next) {
+    frames = FFMAX(frames, _take(input));
+    /* an open but drained prompt sink must not hold music down */
+    prompt |= (input->opened && MIXER_ROLE_PROMPT == input->role &&
+               (input->active || mixer->frame_bytes <= _avail(input)));
+  }
+  g1 = _duck_step(mixer, prompt ? mixer->duck_param.level : 1, frames);
+  step = (g1 - g0) / frames;
+  memset(mixer->out, 0, frames * mixer->frame_bytes);
+  for (input = mixer->inputs; NULL != input; input = input->next) {
+    if (0 == (n = _take(input))) {
+      continue;
+    }
+    if (MIXER_ROLE_MUSIC == input->role) {
+      _mix_input(mixer, input, n, input->gain * g0, input->gain * step);
+    } else {
+      _mix_input(mixer, input, n, input->gain, 0);
+    }
+  }
+  mixer->duck = g1;
+  pthread_cond_broadcast(&mixer->space_cond);
+  return frames;
+}
+
+static void* __mixer_tsk(void *args) {
+  PcmMixer *mixer = (PcmMixer *)args;
+  struct iovec iov;
+  pthread_mutex_lock(&mixer->mutex);
+  while (!mixer->quit) {
+    if (!_ready(mixer)) {
+      pthread_cond_wait(&mixer->cond, &mixer->mutex);
+      continue;
+    }
+    iov.iov_base = mixer->out;
+    iov.iov_len = _mix(mixer) * mixer->frame_bytes;
+    /* output may block for a while, inputs keep filling meanwhile */
+    pthread_mutex_unlock(&mixer->mutex);
+    if (AudioSinkWrite(mixer->output, &iov, 1) < 0) {
+      LOGW(PCM_MIXER_TAG, "output write failed");
+    }
+    pthread_mutex_lock(&mixer->mutex);
+  }
+  pthread_mutex_unlock(&mixer->mutex);
+  return NULL;
+}
+
+static int _input_open(void *opaque, const SinkFormat *format) {
+  PcmMixerInput *input = (PcmMixerInput *)opaque;
+  PcmMixer *mixer = input->mixer;
+  if (format->rate != mixer->format.rate ||
+      format->channels != mixer->format.channels ||
+      format->bit != mixer->format.bit ||
+      format->is_float != mixer->format.is_float || format->planar) {
+    LOGE(PCM_MIXER_TAG, "input format %d/%d/%d not mixer format",
+         format->rate, format->channels, format->bit);
+    return -1;
+  }
+  pthread_mutex_lock(&mixer->mutex);
+  input->read_pos = input->write_pos = 0;
+  input->opened = 1;
+  input->active = 0;
+  input->aborted = 0;
+  pthread_mutex_unlock(&mixer->mutex);
+  return 0;
+}
+
+static int _input_write(void *opaque, const struct iovec *iov, int iovcnt) {
+  PcmMixerInput *input = (PcmMixerInput *)opaque;
+  PcmMixer *mixer = input->mixer;
+  const uint8_t *src;
+  int i, left, n, off, total = 0;
+  pthread_mutex_lock(&mixer->mutex);
+  for (i = 0; i < iovcnt; i++) {
+    src = iov[i].iov_base;
+    left = iov[i].iov_len;
+    while (0 < left) {
+      while (input->capacity == _avail(input) && !input->aborted) {
+        pthread_cond_wait(&mixer->space_cond, &mixer->mutex);
+      }
+      if (input->aborted) {
+        pthread_mutex_unlock(&mixer->mutex);
+        return -1;
+      }
+      off = input->write_pos % input->capacity;
+      n = FFMIN(left, FFMIN(input->capacity - _avail(input),
+                            input->capacity - off));
+      memcpy(input->data + off, src, n);
+      input->write_pos += n;
+      input->active = 1;
+      src += n;
+      left -= n;
+      total += n;
+      pthread_cond_signal(&mixer->cond);
+    }
+  }
+  pthread_mutex_unlock(&mixer->mutex);
+  return total;
+}
+
+/* let the partial tail out and wait until mixed */
+static int _input_drain(void *opaque) {
+  PcmMixerInput *input = (PcmMixerInput *)opaque;
+  PcmMixer *mixer = input->mixer;
+  int ret;
+  pthread_mutex_lock(&mixer->mutex);
+  input->draining = 1;
+  pthread_cond_signal(&mixer->cond);
+  while (mixer->frame_bytes <= _avail(input) && !input->aborted) {
+    pthread_cond_wait(&mixer->space_cond, &mixer->mutex);
+  }
+  input->draining = 0;
+  /* tail is mixed, music ramps back up from next block */
+  input->active = 0;
+  ret = input->aborted ? -1 : 0;
+  pthread_mutex_unlock(&mixer->mutex);
+  return ret;
+}
+
+/* unplayed data is dropped, ducking releases */
+static void _input_close(void *opaque) {
+  PcmMixerInput *input = (PcmMixerInput *)opaque;
+  pthread_mutex_lock(&input->mixer->mutex);
+  input->opened = 0;
+  input->draining = 0;
+  input->active = 0;
+  input->read_pos = input->write_pos;
+  pthread_cond_broadcast(&input->mixer->space_cond);
+  pthread_mutex_unlock(&input->mixer->mutex);
+}
+
+static void _input_abort(void *opaque) {
+  PcmMixerInput *input = (PcmMixerInput *)opaque;
+  pthread_mutex_lock(&input->mixer->mutex);
+  input->aborted = 1;
+  pthread_cond_broadcast(&input->mixer->space_cond);
+  pthread_mutex_unlock(&input->mixer->mutex);
+}
+
+static const AudioSinkOps g_input_ops = {
+  .name  = "mixer_input",
+  .open  = _input_open,
+  .write = _input_write,
+  .drain = _input_drain,
+  .close = _input_close,
+  .abort = _input_abort,
+};
+
+static int _pcm_format(const SinkFormat *format, PcmFormat *pcm) {
+  if (format->planar) {
+    return -1;
+  }
+  if (16 == format->bit && !format->is_float) {
+    *pcm = PCM_FORMAT_S16;
+  } else if (32 == format->bit) {
+    *pcm = format->is_float ? PCM_FORMAT_FLT : PCM_FORMAT_S32;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+PcmMixer* PcmMixerCreate(AudioSink *output, const SinkFormat *format) {
+  PcmMixer *mixer;
+  if (NULL == (mixer = av_mallocz(sizeof(PcmMixer)))) {
+    LOGE(PCM_MIXER_TAG, "alloc mixer failed");
+    return NULL;
+  }
+  if (0 != _pcm_format(format, &mixer->pcm)) {
+    LOGE(PCM_MIXER_TAG, "mixer takes interleaved s16, s32 or float");
+    av_free(mixer);
+    return NULL;
+  }
+  mixer->format = *format;
+  mixer->frame_bytes = PcmBytes(mixer->pcm) * format->channels;
+  mixer->block = FFMAX(MIXER_BLOCK_BYTES / mixer->frame_bytes, 1);
+  mixer->output = output;
+  mixer->duck = 1;
+  mixer->duck_param.level = DUCK_LEVEL;
+  mixer->duck_param.attack_ms = DUCK_ATTACK_MS;
+  mixer->duck_param.release_ms = DUCK_RELEASE_MS;
+  if (NULL == (mixer->out = av_malloc(mixer->block * mixer->frame_bytes))) {
+    LOGE(PCM_MIXER_TAG, "alloc mix block failed");
+    av_free(mixer);
+    return NULL;
+  }
+  if (0 != AudioSinkOpen(output, format)) {
+    av_free(mixer->out);
+    av_free(mixer);
+    return NULL;
+  }
+  pthread_mutex_init(&mixer->mutex, NULL);
+  pthread_cond_init(&mixer->cond, NULL);
+  pthread_cond_init(&mixer->space_cond, NULL);
+  if (0 != pthread_create(&mixer->thread, NULL, __mixer_tsk, mixer)) {
+    LOGE(PCM_MIXER_TAG, "create mixer thread failed");
+    AudioSinkClose(output);
+    pthread_cond_destroy(&mixer->cond);
+    pthread_cond_destroy(&mixer->space_cond);
+    pthread_mutex_destroy(&mixer->mutex);
+    av_free(mixer->out);
+    av_free(mixer);
+    return NULL;
+  }
+  LOGT(PCM_MIXER_TAG, "mixer rate=%d, channels=%d, block=%d frames",
+       format->rate, format->channels, mixer->block);
+  return mixer;
+}
+
+void PcmMixerDestroy(PcmMixer *mixer) {
+  if (NULL == mixer) {
+    return;
+  }
+  pthread_mutex_lock(&mixer->mutex);
+  mixer->quit = 1;
+  pthread_cond_signal(&mixer->cond);
+  pthread_mutex_unlock(&mixer->mutex);
+  AudioSinkAbort(mixer->output);
+  pthread_join(mixer->thread, NULL);
+  AudioSinkClose(mixer->output);
+  while (NULL != mixer->inputs) {
+    PcmMixerRemoveInput(mixer->inputs);
+  }
+  pthread_cond_destroy(&mixer->cond);
+  pthread_cond_destroy(&mixer->space_cond);
+  pthread_mutex_destroy(&mixer->mutex);
+  av_free(mixer->out);
+  av_free(mixer);
+}
+
+int PcmMixerSetDuck(PcmMixer *mixer, const DuckParam *param) {
+  pthread_mutex_lock(&mixer->mutex);
+  mixer->duck_param = *param;
+  mixer->duck_param.level = av_clipf(param->level, 0, 1);
+  pthread_mutex_unlock(&mixer->mutex);
+  return 0;
+}
+
+PcmMixerInput* PcmMixerAddInput(PcmMixer *mixer, MixerRole role,
+                                int capacity_ms) {
+  PcmMixerInput *input;
+  int frames = (int)((int64_t)mixer->format.rate * capacity_ms / 1000);
+  if (NULL == (input = av_mallocz(sizeof(PcmMixerInput)))) {
+    LOGE(PCM_MIXER_TAG, "alloc input failed");
+    return NULL;
+  }
+  input->mixer = mixer;
+  input->role = role;
+  input->gain = 1;
+  input->capacity = FFMAX(frames, 2 * mixer->block) * mixer->frame_bytes;
+  if (NULL == (input->data = av_malloc(input->capacity)) ||
+      NULL == (input->sink = AudioSinkCreate(&g_input_ops, input))) {
+    LOGE(PCM_MIXER_TAG, "alloc input buffer %d failed", input->capacity);
+    av_free(input->data);
+    av_free(input);
+    return NULL;
+  }
+  pthread_mutex_lock(&mixer->mutex);
+  input->next = mixer->inputs;
+  mixer->inputs = input;
+  pthread_mutex_unlock(&mixer->mutex);
+  return input;
+}
+
+/* producer must be done with the input sink */
+void PcmMixerRemoveInput(PcmMixerInput *input) {
+  PcmMixer *mixer;
+  PcmMixerInput **p;
+  if (NULL == input) {
+    return;
+  }
+  mixer = input->mixer;
+  pthread_mutex_lock(&mixer->mutex);
+  for (p = &mixer->inputs; NULL != *p; p = &(*p)->next) {
+    if (*p == input) {
+      *p = input->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mixer->mutex);
+  AudioSinkDestroy(input->sink);
+  av_free(input->data);
+  av_free(input);
+}
+
+AudioSink* PcmMixerInputSink(PcmMixerInput *input) {
+  return input->sink;
+}
+
+int PcmMixerSetGain(PcmMixerInput *input, float gain) {
+  pthread_mutex_lock(&input->mixer->mutex);
+  input->gain = FFMAX(gain, 0);
+  pthread_mutex_unlock(&input->mixer->mutex);
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_mixer.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.03
+ *
+ **************************************************************************/
+#ifndef PCM_MIXER_INC_UNI_PCM_MIXER_H_
+#define PCM_MIXER_INC_UNI_PCM_MIXER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uni_audio_sink.h"
+
+typedef struct PcmMixer PcmMixer;
+typedef struct PcmMixerInput PcmMixerInput;
+
+typedef enum {
+  MIXER_ROLE_MUSIC = 0, /* ducked while a prompt plays */
+  MIXER_ROLE_PROMPT,     /* ducks music from write until drained */
+} MixerRole;
+
+typedef struct {
+  float level;        /* music gain while ducked, 1.0 disable */
+  int   attack_ms;
+  int   release_ms;
+} DuckParam;
+
+/**
+ * mix several pcm streams into one output sink. every input is an
+ * AudioSink, e.g. Mp3SetSink for music and a tts or prompt source for
+ * voice, all in the mixer format, interleaved s16, s32 or float. a mixer
+ * thread mixes blocks of about 4KB with saturating SIMD adds, buffers are
+ * allocated up front. output write blocking is the clock
+ */
+PcmMixer*      PcmMixerCreate(AudioSink *output, const SinkFormat *format);
+/* stops mixer thread and closes output, inputs must be removed first */
+void           PcmMixerDestroy(PcmMixer *mixer);
+int            PcmMixerSetDuck(PcmMixer *mixer, const DuckParam *param);
+
+/* capacity_ms of buffering, writes block when full */
+PcmMixerInput* PcmMixerAddInput(PcmMixer *mixer, MixerRole role,
+                                int capacity_ms);
+void           PcmMixerRemoveInput(PcmMixerInput *input);
+AudioSink*     PcmMixerInputSink(PcmMixerInput *input);
+int            PcmMixerSetGain(PcmMixerInput *input, float gain);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* PCM_MIXER_INC_UNI_PCM_MIXER_H_ */
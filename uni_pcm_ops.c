@@ -0,0 +1,326 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_ops.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.30
+ *
+ **************************************************************************/
+#include "uni_pcm_ops.h"
+
+#include <libavutil/common.h>
+#include <math.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define S32_MAX_FLT (2147483520.0f) /* largest float below 2^31 */
+
+int PcmBytes(PcmFormat format) {
+  static const int bytes[] = {2, 4, 4, 8};
+  return bytes[format];
+}
+
+void PcmPackS24(uint8_t *dst, const int32_t *src, int samples) {
+  int i = 0;
+  uint32_t v;
+#if defined(__SSSE3__)
+  /* 4 samples per shuffle, 16-byte store runs 4 bytes past the 12 packed,
+   * still behind unread src since dst advances 3 bytes per 4 read */
+  const __m128i shuf = _mm_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15,
+                                     -1, -1, -1, -1);
+  for (; i + 4 <= samples; i += 4) {
+    __m128i v4 = _mm_loadu_si128((const __m128i *)(src + i));
+    _mm_storeu_si128((__m128i *)(dst + 3 * i), _mm_shuffle_epi8(v4, shuf));
+  }
+#endif
+  for (; i < samples; i++) {
+    v = (uint32_t)src[i];
+    dst[3 * i] = v >> 8;
+    dst[3 * i + 1] = v >> 16;
+    dst[3 * i + 2] = v >> 24;
+  }
+}
+
+#if defined(__SSE2__)
+/**
+ * gain of lanes base .. base + 3, each lane owns frame (lane / channels).
+ * vector path needs a whole number of frames per 4 lanes, or no ramp
+ */
+static int _lanes_ok(int channels, float step) {
+  return 0 == step || 1 == channels || 2 == channels || 4 == channels;
+}
+
+static __m128 _lane_gain(int base, int channels, float gain, float step) {
+  return _mm_setr_ps(gain + step * ((base + 0) / channels),
+                     gain + step * ((base + 1) / channels),
+                     gain + step * ((base + 2) / channels),
+                     gain + step * ((base + 3) / channels));
+}
+#endif
+
+static int _gain_s16(int16_t *buf, int samples, int channels, float gain,
+                     float step) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (_lanes_ok(channels, step)) {
+    __m128 g_lo = _lane_gain(0, channels, gain, step);
+    __m128 g_hi = _lane_gain(4, channels, gain, step);
+    __m128 inc = _mm_set1_ps(step * (8 / channels));
+    for (; i + 8 <= samples; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g_lo));
+      hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g_hi));
+      _mm_storeu_si128((__m128i *)(buf + i), _mm_packs_epi32(lo, hi));
+      g_lo = _mm_add_ps(g_lo, inc);
+      g_hi = _mm_add_ps(g_hi, inc);
+    }
+  }
+#endif
+  return i;
+}
+
+static int _gain_s32(int32_t *buf, int samples, int channels, float gain,
+                     float step) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (_lanes_ok(channels, step)) {
+    __m128 g = _lane_gain(0, channels, gain, step);
+    __m128 inc = _mm_set1_ps(step * (4 / channels));
+    __m128 hi = _mm_set1_ps(S32_MAX_FLT), lo = _mm_set1_ps(-S32_MAX_FLT);
+    for (; i + 4 <= samples; i += 4) {
+      __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(buf + i)));
+      v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, g), lo), hi);
+      _mm_storeu_si128((__m128i *)(buf + i), _mm_cvtps_epi32(v));
+      g = _mm_add_ps(g, inc);
+    }
+  }
+#endif
+  return i;
+}
+
+static int _gain_flt(float *buf, int samples, int channels, float gain,
+                     float step) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (_lanes_ok(channels, step)) {
+    __m128 g = _lane_gain(0, channels, gain, step);
+    __m128 inc = _mm_set1_ps(step * (4 / channels));
+    for (; i + 4 <= samples; i += 4) {
+      _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i), g));
+      g = _mm_add_ps(g, inc);
+    }
+  }
+#endif
+  return i;
+}
+
+void PcmGain(PcmFormat format, void *buf, int samples, int channels,
+             float gain, float step) {
+  int i;
+  long r;
+  float g, v;
+  switch (format) {
+    case PCM_FORMAT_S16:
+      i = _gain_s16((int16_t *)buf, samples, channels, gain, step);
+      for (; i < samples; i++) {
+        g = gain + step * (i / channels);
+        r = lrintf(((int16_t *)buf)[i] * g);
+        ((int16_t *)buf)[i] = r > 32767 ? 32767 : (r < -32768 ? -32768 : r);
+      }
+      break;
+    case PCM_FORMAT_S32:
+      i = _gain_s32((int32_t *)buf, samples, channels, gain, step);
+      for (; i < samples; i++) {
+        g = gain + step * (i / channels);
+        v = ((int32_t *)buf)[i] * g;
+        v = v > S32_MAX_FLT ? S32_MAX_FLT : (v < -S32_MAX_FLT ?
+                                             -S32_MAX_FLT : v);
+        ((int32_t *)buf)[i] = (int32_t)lrintf(v);
+      }
+      break;
+    case PCM_FORMAT_FLT:
+      i = _gain_flt((float *)buf, samples, channels, gain, step);
+      for (; i < samples; i++) {
+        ((float *)buf)[i] *= gain + step * (i / channels);
+      }
+      break;
+    case PCM_FORMAT_DBL:
+      for (i = 0; i < samples; i++) {
+        ((double *)buf)[i] *= gain + step * (i / channels);
+      }
+      break;
+  }
+}
+
+static int _mix_s16(int16_t *dst, const int16_t *src, int samples,
+                    int channels, float gain, float step) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (_lanes_ok(channels, step)) {
+    __m128 g_lo = _lane_gain(0, channels, gain, step);
+    __m128 g_hi = _lane_gain(4, channels, gain, step);
+    __m128 inc = _mm_set1_ps(step * (8 / channels));
+    for (; i + 8 <= samples; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g_lo));
+      hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g_hi));
+      v = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(dst + i)),
+                         _mm_packs_epi32(lo, hi));
+      _mm_storeu_si128((__m128i *)(dst + i), v);
+      g_lo = _mm_add_ps(g_lo, inc);
+      g_hi = _mm_add_ps(g_hi, inc);
+    }
+  }
+#endif
+  return i;
+}
+
+static int _mix_flt(float *dst, const float *src, int samples, int channels,
+                    float gain, float step) {
+  int i = 0;
+#if defined(__SSE2__)
+  if (_lanes_ok(channels, step)) {
+    __m128 g = _lane_gain(0, channels, gain, step);
+    __m128 inc = _mm_set1_ps(step * (4 / channels));
+    for (; i + 4 <= samples; i += 4) {
+      _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                                        _mm_mul_ps(_mm_loadu_ps(src + i),
+                                                   g)));
+      g = _mm_add_ps(g, inc);
+    }
+  }
+#endif
+  return i;
+}
+
+void PcmMix(PcmFormat format, void *dst, const void *src, int samples,
+            int channels, float gain, float step) {
+  int i;
+  long r;
+  double v;
+  switch (format) {
+    case PCM_FORMAT_S16:
+      i = _mix_s16((int16_t *)dst, (const int16_t *)src, samples, channels,
+                   gain, step);
+      for (; i < samples; i++) {
+        r = ((int16_t *)dst)[i] + lrintf(((const int16_t *)src)[i] *
+                                         (gain + step * (i / channels)));
+        ((int16_t *)dst)[i] = r > 32767 ? 32767 : (r < -32768 ? -32768 : r);
+      }
+      break;
+    case PCM_FORMAT_S32:
+      for (i = 0; i < samples; i++) {
+        v = ((int32_t *)dst)[i] + (double)((const int32_t *)src)[i] *
+            (gain + step * (i / channels));
+        v = v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v);
+        ((int32_t *)dst)[i] = (int32_t)lrint(v);
+      }
+      break;
+    case PCM_FORMAT_FLT:
+      i = _mix_flt((float *)dst, (const float *)src, samples, channels, gain,
+                   step);
+      for (; i < samples; i++) {
+        ((float *)dst)[i] += ((const float *)src)[i] *
+                             (gain + step * (i / channels));
+      }
+      break;
+    case PCM_FORMAT_DBL:
+      for (i = 0; i < samples; i++) {
+        ((double *)dst)[i] += ((const double *)src)[i] *
+                              (gain + step * (i / channels));
+      }
+      break;
+  }
+}
+
+#if defined(__SSE2__)
+static float _hmax(__m128 v) {
+  float f[4];
+  _mm_storeu_ps(f, v);
+  return fmaxf(fmaxf(f[0], f[1]), fmaxf(f[2], f[3]));
+}
+#endif
+
+float PcmPeak(PcmFormat format, const void *buf, int samples) {
+  int i = 0;
+  float peak = 0;
+#if defined(__SSE2__)
+  int j;
+  __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 m = _mm_setzero_ps();
+  __m128i m16 = _mm_setzero_si128();
+  int16_t p16[8];
+#endif
+  switch (format) {
+    case PCM_FORMAT_S16:
+#if defined(__SSE2__)
+      /* saturating negate, -32768 reads as 32767 */
+      for (; i + 8 <= samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)((int16_t *)buf + i));
+        v = _mm_max_epi16(v, _mm_subs_epi16(_mm_setzero_si128(), v));
+        m16 = _mm_max_epi16(m16, v);
+      }
+      _mm_storeu_si128((__m128i *)p16, m16);
+      for (j = 0; j < 8; j++) {
+        peak = fmaxf(peak, p16[j]);
+      }
+#endif
+      for (; i < samples; i++) {
+        peak = fmaxf(peak, FFABS((float)((const int16_t *)buf)[i]));
+      }
+      return peak / 32768.0f;
+    case PCM_FORMAT_S32:
+#if defined(__SSE2__)
+      for (; i + 4 <= samples; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)((int32_t *)buf + i));
+        m = _mm_max_ps(m, _mm_and_ps(_mm_cvtepi32_ps(v), abs));
+      }
+      peak = _hmax(m);
+#endif
+      for (; i < samples; i++) {
+        /* cast before abs, INT32_MIN has no int magnitude */
+        peak = fmaxf(peak, FFABS((float)((const int32_t *)buf)[i]));
+      }
+      return peak / 2147483648.0f;
+    case PCM_FORMAT_FLT:
+#if defined(__SSE2__)
+      for (; i + 4 <= samples; i += 4) {
+        m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps((const float *)buf + i),
+                                     abs));
+      }
+      peak = _hmax(m);
+#endif
+      for (; i < samples; i++) {
+        peak = fmaxf(peak, fabsf(((const float *)buf)[i]));
+      }
+      return peak;
+    case PCM_FORMAT_DBL:
+      for (; i < samples; i++) {
+        peak = fmaxf(peak, fabs(((const double *)buf)[i]));
+      }
+      return peak;
+  }
+  return peak;
+}
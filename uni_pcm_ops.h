@@ -0,0 +1,63 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_ops.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.30
+ *
+ **************************************************************************/
+#ifndef PCM_OPS_INC_UNI_PCM_OPS_H_
+#define PCM_OPS_INC_UNI_PCM_OPS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * sample kernels swresample has no counterpart for. each has a SIMD body
+ * picked at build time (-mssse3 and up) and a scalar tail
+ */
+
+typedef enum {
+  PCM_FORMAT_S16 = 0,
+  PCM_FORMAT_S32,
+  PCM_FORMAT_FLT,
+  PCM_FORMAT_DBL,
+} PcmFormat;
+
+int   PcmBytes(PcmFormat format);
+/* top 24 bits of s32 to 3-byte little endian, dst may alias src */
+void  PcmPackS24(uint8_t *dst, const int32_t *src, int samples);
+/**
+ * in place buf[i] *= gain + step * (i / channels), so one call ramps a
+ * whole interleaved chunk. integers round and saturate
+ */
+void  PcmGain(PcmFormat format, void *buf, int samples, int channels,
+              float gain, float step);
+/* largest magnitude, full scale 1.0 */
+float PcmPeak(PcmFormat format, const void *buf, int samples);
+/* dst[i] += src[i] * (gain + step * (i / channels)), integers saturate */
+void  PcmMix(PcmFormat format, void *dst, const void *src, int samples,
+             int channels, float gain, float step);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* PCM_OPS_INC_UNI_PCM_OPS_H_ */
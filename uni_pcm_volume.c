@@ -0,0 +1,309 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_volume.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.02
+ *
+ **************************************************************************/
+#include "uni_pcm_volume.h"
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#define PCM_VOLUME_TAG "pcm_volume"
+#define VOLUME_BLOCK   (32)  /* frames per envelope segment */
+
+struct PcmVolume {
+  pthread_mutex_t mutex;
+  PcmFormat       format;
+  int             channels;
+  int             rate;
+  int             planes;
+  int             plane_samples; /* samples of one frame in one plane */
+  int             frame_bytes;   /* bytes of one frame in one plane */
+  int64_t         in_pos;
+  /* fade, level is from before start, to after start + duration */
+  float           from;
+  float           to;
+  int64_t         start;
+  int64_t         duration;
+  PcmFadeCurve    curve;
+  /* limiter, output delayed by blocks of lookahead */
+  float           threshold;
+  float           release_coef;
+  int             blocks;
+  int             delay;
+  uint8_t         *line;         /* delay line, planes back to back */
+  uint8_t         *tmp;
+  float           *peaks;        /* input block peaks, blocks + 1 ring */
+  float           cur_peak;
+  float           gain;
+  float           gain_start;
+  float           gain_end;
+};
+
+static float _level_at(PcmVolume *vol, int64_t pos) {
+  double t;
+  if (pos < vol->start) {
+    return vol->from;
+  }
+  if (pos >= vol->start + vol->duration) {
+    return vol->to;
+  }
+  t = (double)(pos - vol->start) / vol->duration;
+  if (PCM_FADE_EQUAL_POWER == vol->curve) {
+    t = vol->to > vol->from ? sin(t * M_PI / 2) : 1 - cos(t * M_PI / 2);
+  }
+  return vol->from + (vol->to - vol->from) * t;
+}
+
+/* shorten n so [pos, pos + n) does not cross a fade edge */
+static int _fade_span(PcmVolume *vol, int64_t pos, int n) {
+  int64_t end = vol->start + vol->duration;
+  if (pos < vol->start) {
+    return (int)FFMIN(n, vol->start - pos);
+  }
+  if (pos < end) {
+    return (int)FFMIN(n, FFMIN(VOLUME_BLOCK, end - pos));
+  }
+  return n;
+}
+
+static void _ramp(PcmVolume *vol, uint8_t **data, int offset, int n,
+                  float g0, float g1) {
+  int p;
+  if (1.0f == g0 && 1.0f == g1) {
+    return;
+  }
+  for (p = 0; p < vol->planes; p++) {
+    PcmGain(vol->format, data[p] + offset * vol->frame_bytes,
+            n * vol->plane_samples, vol->plane_samples, g0, (g1 - g0) / n);
+  }
+}
+
+static void _fade(PcmVolume *vol, uint8_t **data, int frames) {
+  int off, n;
+  for (off = 0; off < frames; off += n) {
+    n = _fade_span(vol, vol->in_pos, frames - off);
+    _ramp(vol, data, off, n, _level_at(vol, vol->in_pos),
+          _level_at(vol, vol->in_pos + n));
+    vol->in_pos += n;
+  }
+}
+
+/* gain that keeps the peak of input block under threshold after level */
+static float _target(PcmVolume *vol, int64_t block) {
+  float peak;
+  if (block < 0) {
+    return 1;
+  }
+  peak = vol->peaks[block % (vol->blocks + 1)] *
+         FFMAX(_level_at(vol, block * VOLUME_BLOCK),
+               _level_at(vol, (block + 1) * VOLUME_BLOCK));
+  return peak > vol->threshold ? vol->threshold / peak : 1;
+}
+
+/**
+ * envelope of output block ob. ends low enough to meet every target in
+ * lookahead by ramping straight at it, else releases towards unity
+ */
+static void _plan(PcmVolume *vol, int64_t ob) {
+  float g = FFMIN(vol->gain, _target(vol, ob)), end, t;
+  int k;
+  end = g + (1 - g) * vol->release_coef;
+  end = FFMIN(end, FFMIN(_target(vol, ob), _target(vol, ob + 1)));
+  for (k = 2; k < vol->blocks; k++) {
+    if ((t = _target(vol, ob + k)) < g) {
+      end = FFMIN(end, g + (t - g) / k);
+    }
+  }
+  vol->gain_start = g;
+  vol->gain_end = end;
+  vol->gain = end;
+}
+
+/* swap chunk with delay line, then one gain pass over what comes out */
+static void _limit(PcmVolume *vol, uint8_t **data, int frames) {
+  int off, n, o, p, bytes, slot;
+  float g0, g1, step;
+  uint8_t *src, *line;
+  int64_t out;
+  for (off = 0; off < frames; off += n) {
+    o = vol->in_pos % VOLUME_BLOCK;
+    out = vol->in_pos - vol->delay;
+    n = _fade_span(vol, out, FFMIN(frames - off, VOLUME_BLOCK - o));
+    if (0 == o) {
+      _plan(vol, vol->in_pos / VOLUME_BLOCK - vol->blocks);
+    }
+    slot = (vol->in_pos % vol->delay) * vol->frame_bytes;
+    bytes = n * vol->frame_bytes;
+    for (p = 0; p < vol->planes; p++) {
+      src = data[p] + off * vol->frame_bytes;
+      line = vol->line + (size_t)p * vol->delay * vol->frame_bytes;
+      vol->cur_peak = FFMAX(vol->cur_peak,
+                            PcmPeak(vol->format, src,
+                                    n * vol->plane_samples));
+      memcpy(vol->tmp, src, bytes);
+      memcpy(src, line + slot, bytes);
+      memcpy(line + slot, vol->tmp, bytes);
+    }
+    if (0 <= out) {
+      step = (vol->gain_end - vol->gain_start) / VOLUME_BLOCK;
+      g0 = (vol->gain_start + step * o) * _level_at(vol, out);
+      g1 = (vol->gain_start + step * (o + n)) * _level_at(vol, out + n);
+      _ramp(vol, data, off, n, g0, g1);
+    }
+    vol->in_pos += n;
+    if (0 == vol->in_pos % VOLUME_BLOCK) {
+      vol->peaks[(vol->in_pos / VOLUME_BLOCK - 1) % (vol->blocks + 1)] =
+          vol->cur_peak;
+      vol->cur_peak = 0;
+    }
+  }
+}
+
+static void _reset_locked(PcmVolume *vol) {
+  vol->in_pos = 0;
+  vol->from = vol->to;
+  vol->start = 0;
+  vol->duration = 0;
+  vol->cur_peak = 0;
+  vol->gain = 1;
+  if (0 < vol->delay) {
+    memset(vol->line, 0, (size_t)vol->planes * vol->delay * vol->frame_bytes);
+    memset(vol->peaks, 0, (vol->blocks + 1) * sizeof(float));
+  }
+}
+
+PcmVolume* PcmVolumeCreate(PcmFormat format, int planar, int channels,
+                           int rate) {
+  PcmVolume *vol;
+  if (NULL == (vol = av_mallocz(sizeof(PcmVolume)))) {
+    LOGE(PCM_VOLUME_TAG, "alloc volume failed");
+    return NULL;
+  }
+  pthread_mutex_init(&vol->mutex, NULL);
+  vol->format = format;
+  vol->channels = channels;
+  vol->rate = rate;
+  vol->planes = planar ? channels : 1;
+  vol->plane_samples = planar ? 1 : channels;
+  vol->frame_bytes = PcmBytes(format) * vol->plane_samples;
+  vol->from = 1;
+  vol->to = 1;
+  vol->gain = 1;
+  return vol;
+}
+
+void PcmVolumeDestroy(PcmVolume *vol) {
+  if (NULL == vol) {
+    return;
+  }
+  pthread_mutex_destroy(&vol->mutex);
+  av_free(vol->line);
+  av_free(vol->tmp);
+  av_free(vol->peaks);
+  av_free(vol);
+}
+
+int PcmVolumeSetLimiter(PcmVolume *vol, const PcmLimiterParam *param) {
+  int64_t frames;
+  int ret = 0;
+  pthread_mutex_lock(&vol->mutex);
+  av_freep(&vol->line);
+  av_freep(&vol->tmp);
+  av_freep(&vol->peaks);
+  vol->blocks = 0;
+  vol->delay = 0;
+  if (NULL != param && 0 < param->threshold) {
+    frames = (int64_t)vol->rate * FFMAX(param->lookahead_ms, 0) / 1000;
+    vol->blocks = FFMAX(2, (int)((frames + VOLUME_BLOCK - 1) / VOLUME_BLOCK));
+    vol->delay = vol->blocks * VOLUME_BLOCK;
+    vol->threshold = param->threshold;
+    /* about 95% recovered after release_ms */
+    frames = (int64_t)vol->rate * param->release_ms / 1000;
+    vol->release_coef = 0 < frames ?
+                        1 - exp(-3.0 * VOLUME_BLOCK / frames) : 1;
+    vol->line = av_malloc((size_t)vol->planes * vol->delay *
+                          vol->frame_bytes);
+    vol->tmp = av_malloc(VOLUME_BLOCK * vol->frame_bytes);
+    vol->peaks = av_malloc((vol->blocks + 1) * sizeof(float));
+    if (NULL == vol->line || NULL == vol->tmp || NULL == vol->peaks) {
+      LOGE(PCM_VOLUME_TAG, "alloc limiter failed");
+      av_freep(&vol->line);
+      av_freep(&vol->tmp);
+      av_freep(&vol->peaks);
+      vol->blocks = 0;
+      vol->delay = 0;
+      ret = -1;
+    }
+  }
+  _reset_locked(vol);
+  pthread_mutex_unlock(&vol->mutex);
+  LOGT(PCM_VOLUME_TAG, "limiter threshold=%f, delay=%d frames",
+       vol->threshold, vol->delay);
+  return ret;
+}
+
+void PcmVolumeReset(PcmVolume *vol) {
+  pthread_mutex_lock(&vol->mutex);
+  _reset_locked(vol);
+  pthread_mutex_unlock(&vol->mutex);
+}
+
+int PcmVolumeFade(PcmVolume *vol, float target, int64_t start,
+                  int64_t duration, PcmFadeCurve curve) {
+  int64_t now;
+  pthread_mutex_lock(&vol->mutex);
+  now = FFMAX(vol->in_pos - vol->delay, 0);
+  vol->from = _level_at(vol, now);
+  vol->to = FFMAX(target, 0);
+  vol->start = FFMAX(start, now);
+  vol->duration = FFMAX(duration, 0);
+  vol->curve = curve;
+  pthread_mutex_unlock(&vol->mutex);
+  return 0;
+}
+
+float PcmVolumeGetLevel(PcmVolume *vol) {
+  float level;
+  pthread_mutex_lock(&vol->mutex);
+  level = _level_at(vol, FFMAX(vol->in_pos - vol->delay, 0));
+  pthread_mutex_unlock(&vol->mutex);
+  return level;
+}
+
+int PcmVolumeProcess(PcmVolume *vol, uint8_t **data, int frames) {
+  pthread_mutex_lock(&vol->mutex);
+  if (0 < vol->delay) {
+    _limit(vol, data, frames);
+  } else {
+    _fade(vol, data, frames);
+  }
+  pthread_mutex_unlock(&vol->mutex);
+  return frames;
+}
+
+int PcmVolumeDelay(PcmVolume *vol) {
+  return vol->delay;
+}
@@ -0,0 +1,71 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_pcm_volume.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.05.02
+ *
+ **************************************************************************/
+#ifndef PCM_VOLUME_INC_UNI_PCM_VOLUME_H_
+#define PCM_VOLUME_INC_UNI_PCM_VOLUME_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uni_pcm_ops.h"
+#include <stdint.h>
+
+typedef struct PcmVolume PcmVolume;
+
+typedef enum {
+  PCM_FADE_LINEAR = 0,
+  PCM_FADE_EQUAL_POWER,  /* sin up, cos down, constant power crossfades */
+} PcmFadeCurve;
+
+typedef struct {
+  float threshold;    /* peak ceiling, full scale 1.0, <= 0 disable */
+  int   lookahead_ms; /* output delay, gain reduction ramps in over it */
+  int   release_ms;   /* time to recover most of the reduction */
+} PcmLimiterParam;
+
+/**
+ * software volume on the last pcm buffer before the sink. gain, fade and
+ * limiter gain are folded into one piecewise linear envelope, applied by a
+ * single in place PcmGain pass, none at all at unity. positions are frames
+ * since reset on the output timeline
+ */
+PcmVolume* PcmVolumeCreate(PcmFormat format, int planar, int channels,
+                           int rate);
+void       PcmVolumeDestroy(PcmVolume *vol);
+/* NULL disables, resets */
+int        PcmVolumeSetLimiter(PcmVolume *vol, const PcmLimiterParam *param);
+/* new stream, running fade jumps to its target, level is kept */
+void       PcmVolumeReset(PcmVolume *vol);
+/* from current level to target over duration frames from start, -1 now */
+int        PcmVolumeFade(PcmVolume *vol, float target, int64_t start,
+                         int64_t duration, PcmFadeCurve curve);
+float      PcmVolumeGetLevel(PcmVolume *vol);
+/* in place, output lags input by PcmVolumeDelay frames */
+int        PcmVolumeProcess(PcmVolume *vol, uint8_t **data, int frames);
+int        PcmVolumeDelay(PcmVolume *vol);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* PCM_VOLUME_INC_UNI_PCM_VOLUME_H_ */
@@ -0,0 +1,397 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_range_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.12
+ *
+ **************************************************************************/
+#include "uni_range_io.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include "uni_net_session.h"
+#include "uni_log.h"
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+
+#define RANGE_IO_TAG          "range_io"
+#define RANGE_AVIO_BUF_SIZE   (32 * 1024)
+#define RANGE_FETCH_RETRY     (2)
+
+typedef enum {
+  SLOT_FREE = 0,
+  SLOT_FETCHING,
+  SLOT_READY,
+  SLOT_FAILED
+} SlotState;
+
+typedef struct {
+  uint8_t   *buf;
+  int64_t   chunk;
+  int       len;
+  SlotState state;
+} RangeSlot;
+
+struct RangeIo {
+  char            *url;
+  int64_t         size;
+  int             chunk_size;
+  int64_t         chunk_count;
+  int             slot_count;
+  RangeSlot       *slots;
+  int             worker_count;
+  pthread_t       *workers;
+  int64_t         pos;
+  int64_t         next_fetch;
+  int             aborted;
+  AVIOInterruptCB int_cb;
+  AVIOContext     *avio;
+  pthread_mutex_t mutex;
+  pthread_cond_t  ready;
+  pthread_cond_t  free;
+};
+
+static int _range_interrupt_cb(void *ctx) {
+  return ((RangeIo *)ctx)->aborted;
+}
+
+/* each chunk on a kept-alive session connection, no connect per request */
+static int _fetch_chunk_once(RangeIo *io, int64_t chunk, uint8_t *buf) {
+  HttpConn *conn;
+  int64_t offset = chunk * io->chunk_size;
+  int want = (int)FFMIN(io->chunk_size, io->size - offset);
+  int len = 0, ret;
+  conn = NetSessionRequest(io->url, offset, offset + want, &io->int_cb);
+  if (NULL == conn) {
+    LOGW(RANGE_IO_TAG, "request chunk[%lld] failed", (long long)chunk);
+    return AVERROR(EIO);
+  }
+  while (len < want) {
+    if ((ret = HttpConnRead(conn, buf + len, want - len)) <= 0) {
+      break;
+    }
+    len += ret;
+  }
+  NetSessionRelease(conn);
+  if (len != want) {
+    LOGW(RANGE_IO_TAG, "chunk[%lld] short read %d/%d", (long long)chunk,
+         len, want);
+    return AVERROR(EIO);
+  }
+  return len;
+}
+
+static int _fetch_chunk(RangeIo *io, int64_t chunk, uint8_t *buf) {
+  int i, ret = AVERROR(EIO);
+  for (i = 0; i <= RANGE_FETCH_RETRY && !io->aborted; i++) {
+    if (0 <= (ret = _fetch_chunk_once(io, chunk, buf))) {
+      break;
+    }
+  }
+  return ret;
+}
+
+static RangeSlot* _find_slot(RangeIo *io, int64_t chunk) {
+  int i;
+  for (i = 0; i < io->slot_count; i++) {
+    if (SLOT_FREE != io->slots[i].state && chunk == io->slots[i].chunk) {
+      return &io->slots[i];
+    }
+  }
+  return NULL;
+}
+
+static int _chunk_in_window(RangeIo *io, int64_t chunk) {
+  int64_t first = io->pos / io->chunk_size;
+  return chunk >= first && chunk < first + io->slot_count;
+}
+
+/* pick next missing chunk inside read window and a slot to hold it */
+static RangeSlot* _acquire_slot(RangeIo *io) {
+  RangeSlot *slot;
+  int64_t first = io->pos / io->chunk_size;
+  int i;
+  io->next_fetch = FFMAX(io->next_fetch, first);
+  while (io->next_fetch < io->chunk_count &&
+         _chunk_in_window(io, io->next_fetch)) {
+    if (NULL != _find_slot(io, io->next_fetch)) {
+      io->next_fetch++;
+      continue;
+    }
+    for (i = 0; i < io->slot_count; i++) {
+      slot = &io->slots[i];
+      if (SLOT_FREE == slot->state ||
+          (SLOT_FETCHING != slot->state &&
+           !_chunk_in_window(io, slot->chunk))) {
+        slot->chunk = io->next_fetch++;
+        slot->state = SLOT_FETCHING;
+        return slot;
+      }
+    }
+    return NULL;
+  }
+  return NULL;
+}
+
+static void* __range_worker_tsk(void *args) {
+  RangeIo *io = (RangeIo *)args;
+  RangeSlot *slot;
+  int64_t chunk;
+  int len;
+  pthread_mutex_lock(&io->mutex);
+  while (!io->aborted) {
+    if (NULL == (slot = _acquire_slot(io))) {
+      pthread_cond_wait(&io->free, &io->mutex);
+      continue;
+    }
+    chunk = slot->chunk;
+    pthread_mutex_unlock(&io->mutex);
+    len = _fetch_chunk(io, chunk, slot->buf);
+    pthread_mutex_lock(&io->mutex);
+    slot->len = len;
+    slot->state = len < 0 ? SLOT_FAILED : SLOT_READY;
+    pthread_cond_broadcast(&io->ready);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return NULL;
+}
+
+static int _range_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  RangeIo *io = (RangeIo *)opaque;
+  RangeSlot *slot;
+  int64_t chunk;
+  int offset, len;
+  pthread_mutex_lock(&io->mutex);
+  if (io->pos >= io->size) {
+    pthread_mutex_unlock(&io->mutex);
+    return AVERROR_EOF;
+  }
+  chunk = io->pos / io->chunk_size;
+  offset = (int)(io->pos % io->chunk_size);
+  while (!io->aborted &&
+         (NULL == (slot = _find_slot(io, chunk)) ||
+          SLOT_FETCHING == slot->state)) {
+    pthread_cond_wait(&io->ready, &io->mutex);
+  }
+  if (io->aborted) {
+    pthread_mutex_unlock(&io->mutex);
+    return AVERROR_EOF;
+  }
+  if (SLOT_FAILED == slot->state || offset >= slot->len) {
+    pthread_mutex_unlock(&io->mutex);
+    LOGE(RANGE_IO_TAG, "chunk[%lld] unavailable", (long long)chunk);
+    return AVERROR(EIO);
+  }
+  len = FFMIN(buf_size, slot->len - offset);
+  memcpy(buf, slot->buf + offset, len);
+  io->pos += len;
+  if (offset + len == slot->len) {
+    slot->state = SLOT_FREE;
+    pthread_cond_broadcast(&io->free);
+  }
+  pthread_mutex_unlock(&io->mutex);
+  return len;
+}
+
+static int64_t _range_seek(void *opaque, int64_t offset, int whence) {
+  RangeIo *io = (RangeIo *)opaque;
+  int64_t pos;
+  int i;
+  if (whence & AVSEEK_SIZE) {
+    return io->size;
+  }
+  pthread_mutex_lock(&io->mutex);
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = io->pos + offset;
+      break;
+    case SEEK_END:
+      pos = io->size + offset;
+      break;
+    default:
+      pthread_mutex_unlock(&io->mutex);
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0 || pos > io->size) {
+    pthread_mutex_unlock(&io->mutex);
+    return AVERROR(EINVAL);
+  }
+  io->pos = pos;
+  io->next_fetch = pos / io->chunk_size;
+  /* seek is how player retries, give failed chunks another fetch */
+  for (i = 0; i < io->slot_count; i++) {
+    if (SLOT_FAILED == io->slots[i].state) {
+      io->slots[i].state = SLOT_FREE;
+    }
+  }
+  pthread_cond_broadcast(&io->free);
+  pthread_mutex_unlock(&io->mutex);
+  return pos;
+}
+
+static int _probe_size(RangeIo *io) {
+  HttpConn *conn;
+  uint8_t byte;
+  int accept_ranges;
+  /* one byte Range request, small enough to keep connection for chunk 0 */
+  if (NULL == (conn = NetSessionRequest(io->url, 0, 1, &io->int_cb))) {
+    LOGE(RANGE_IO_TAG, "open %s failed", io->url);
+    return -1;
+  }
+  io->size = HttpConnTotalSize(conn);
+  accept_ranges = HttpConnAcceptRanges(conn);
+  HttpConnRead(conn, &byte, sizeof(byte));
+  NetSessionRelease(conn);
+  if (io->size <= 0 || !accept_ranges) {
+    LOGW(RANGE_IO_TAG, "range not supported, size=%lld",
+         (long long)io->size);
+    return -1;
+  }
+  return 0;
+}
+
+static void _free_slots(RangeIo *io) {
+  int i;
+  if (NULL == io->slots) {
+    return;
+  }
+  for (i = 0; i < io->slot_count; i++) {
+    av_free(io->slots[i].buf);
+  }
+  av_freep(&io->slots);
+}
+
+static int _alloc_slots(RangeIo *io) {
+  int i;
+  if (NULL == (io->slots = av_mallocz_array(io->slot_count,
+                                            sizeof(RangeSlot)))) {
+    return -1;
+  }
+  for (i = 0; i < io->slot_count; i++) {
+    if (NULL == (io->slots[i].buf = av_malloc(io->chunk_size))) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int _start_workers(RangeIo *io) {
+  int i;
+  if (NULL == (io->workers = av_mallocz_array(io->worker_count,
+                                              sizeof(pthread_t)))) {
+    return -1;
+  }
+  for (i = 0; i < io->worker_count; i++) {
+    if (0 != pthread_create(&io->workers[i], NULL, __range_worker_tsk, io)) {
+      io->worker_count = i;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+RangeIo* RangeIoCreate(const char *url, int connections, int chunk_size,
+                       int memory_budget) {
+  RangeIo *io;
+  unsigned char *buffer;
+  if (NULL == (io = av_mallocz(sizeof(RangeIo)))) {
+    LOGE(RANGE_IO_TAG, "alloc range io failed");
+    return NULL;
+  }
+  pthread_mutex_init(&io->mutex, NULL);
+  pthread_cond_init(&io->ready, NULL);
+  pthread_cond_init(&io->free, NULL);
+  io->url = av_strdup(url);
+  io->chunk_size = chunk_size;
+  io->int_cb.callback = _range_interrupt_cb;
+  io->int_cb.opaque = io;
+  if (NULL == io->url || 0 != _probe_size(io)) {
+    goto L_ERROR;
+  }
+  io->chunk_count = (io->size + chunk_size - 1) / chunk_size;
+  /* budget wins over connection count, one slot per in-flight request */
+  io->slot_count = FFMAX(1, memory_budget / chunk_size);
+  io->slot_count = (int)FFMIN(io->slot_count, io->chunk_count);
+  io->worker_count = FFMAX(1, FFMIN(connections, io->slot_count));
+  if (0 != _alloc_slots(io)) {
+    LOGE(RANGE_IO_TAG, "alloc %d slots failed", io->slot_count);
+    goto L_ERROR;
+  }
+  if (NULL == (buffer = av_malloc(RANGE_AVIO_BUF_SIZE))) {
+    LOGE(RANGE_IO_TAG, "alloc avio buffer failed");
+    goto L_ERROR;
+  }
+  io->avio = avio_alloc_context(buffer, RANGE_AVIO_BUF_SIZE, 0, io,
+                                _range_read_packet, NULL, _range_seek);
+  if (NULL == io->avio) {
+    LOGE(RANGE_IO_TAG, "alloc avio context failed");
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  if (0 != _start_workers(io)) {
+    LOGE(RANGE_IO_TAG, "start range workers failed");
+    goto L_ERROR;
+  }
+  LOGT(RANGE_IO_TAG, "size=%lld, chunk=%d, slots=%d, connections=%d",
+       (long long)io->size, io->chunk_size, io->slot_count, io->worker_count);
+  return io;
+L_ERROR:
+  RangeIoDestroy(io);
+  return NULL;
+}
+
+void RangeIoDestroy(RangeIo *io) {
+  int i;
+  if (NULL == io) {
+    return;
+  }
+  RangeIoAbort(io);
+  for (i = 0; NULL != io->workers && i < io->worker_count; i++) {
+    pthread_join(io->workers[i], NULL);
+  }
+  av_freep(&io->workers);
+  if (NULL != io->avio) {
+    av_freep(&io->avio->buffer);
+    avio_context_free(&io->avio);
+  }
+  _free_slots(io);
+  av_freep(&io->url);
+  pthread_cond_destroy(&io->free);
+  pthread_cond_destroy(&io->ready);
+  pthread_mutex_destroy(&io->mutex);
+  av_free(io);
+}
+
+AVIOContext* RangeIoGetAVIO(RangeIo *io) {
+  return io->avio;
+}
+
+int RangeIoAbort(RangeIo *io) {
+  pthread_mutex_lock(&io->mutex);
+  io->aborted = 1;
+  pthread_cond_broadcast(&io->ready);
+  pthread_cond_broadcast(&io->free);
+  pthread_mutex_unlock(&io->mutex);
+  return 0;
+}
@@ -0,0 +1,50 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_range_io.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.12
+ *
+ **************************************************************************/
+#ifndef RANGE_IO_INC_UNI_RANGE_IO_H_
+#define RANGE_IO_INC_UNI_RANGE_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct RangeIo RangeIo;
+
+/**
+ * fetch url ahead with several concurrent http Range requests of chunk_size
+ * bytes, at most memory_budget bytes buffered, chunks handed out in order.
+ * return NULL when server has no Content-Length or rejects Range request
+ */
+RangeIo*     RangeIoCreate(const char *url, int connections, int chunk_size,
+                           int memory_budget);
+void         RangeIoDestroy(RangeIo *io);
+AVIOContext* RangeIoGetAVIO(RangeIo *io);
+/* wake up reader and cancel all in-flight request, used on stop */
+int          RangeIoAbort(RangeIo *io);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* RANGE_IO_INC_UNI_RANGE_IO_H_ */
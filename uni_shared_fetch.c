@@ -0,0 +1,364 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_shared_fetch.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.27
+ *
+ **************************************************************************/
+#include "uni_shared_fetch.h"
+
+#include <libavutil/avstring.h>
+#include <libavutil/error.h>
+#include <libavutil/md5.h>
+#include <libavutil/mem.h>
+#include "uni_net_session.h"
+#include "uni_log.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SHARED_FETCH_TAG     "shared_fetch"
+#define SHARED_HEADER_SIZE   (4096)
+#define SHARED_MAGIC         (0x53464348)
+#define SHARED_AVIO_BUF_SIZE (32 * 1024)
+#define SHARED_COPY_SIZE     (32 * 1024)
+#define SHARED_WAIT_MS       (100)
+
+typedef enum {
+  SHARED_IDLE = 0,
+  SHARED_FETCHING,
+  SHARED_DONE,
+  SHARED_FAILED
+} SharedState;
+
+/* first page of cache file, mapped by every opener */
+typedef struct {
+  uint32_t magic;
+  int32_t  seq;      /* futex word, bumped on every append and state change */
+  int32_t  state;
+  int32_t  reserved;
+  int64_t  size;     /* -1 until server told, atomic like written */
+  int64_t  written;
+} SharedHeader;
+
+struct SharedFetch {
+  char            *url;
+  int             fd;
+  SharedHeader    *hdr;
+  int             writer;
+  int             fetching;
+  pthread_t       fetch_thread;
+  int64_t         pos;
+  int             aborted;
+  AVIOInterruptCB int_cb;
+  AVIOContext     *avio;
+};
+
+static int _shared_interrupt_cb(void *ctx) {
+  return ((SharedFetch *)ctx)->aborted;
+}
+
+static void _futex_wait(int32_t *addr, int32_t val, int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+/* shared futex on MAP_SHARED file page wakes readers in every process */
+static void _notify(SharedHeader *hdr) {
+  __atomic_add_fetch(&hdr->seq, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void _set_state(SharedHeader *hdr, SharedState state) {
+  __atomic_store_n(&hdr->state, state, __ATOMIC_RELEASE);
+  _notify(hdr);
+}
+
+static int _append(SharedFetch *sf, const uint8_t *buf, int len,
+                   int64_t offset) {
+  int ret;
+  while (0 < len) {
+    if ((ret = pwrite(sf->fd, buf, len, SHARED_HEADER_SIZE + offset)) <= 0) {
+      return -1;
+    }
+    buf += ret;
+    len -= ret;
+    offset += ret;
+  }
+  return 0;
+}
+
+static void* __shared_fetch_tsk(void *args) {
+  SharedFetch *sf = (SharedFetch *)args;
+  SharedHeader *hdr = sf->hdr;
+  uint8_t *buf;
+  HttpConn *conn;
+  int64_t offset = hdr->written, size;
+  int ret = AVERROR(EIO);
+  _set_state(hdr, SHARED_FETCHING);
+  if (NULL == (buf = av_malloc(SHARED_COPY_SIZE))) {
+    goto L_END;
+  }
+  conn = NetSessionRequest(sf->url, offset, 0, &sf->int_cb);
+  if (NULL == conn && 0 < offset && !sf->aborted) {
+    /* session refuses a resume the server did not honor, start over */
+    LOGW(SHARED_FETCH_TAG, "resume refused, restart %s", sf->url);
+    offset = 0;
+    __atomic_store_n(&hdr->written, 0, __ATOMIC_RELEASE);
+    conn = NetSessionRequest(sf->url, 0, 0, &sf->int_cb);
+  }
+  if (NULL == conn) {
+    goto L_END;
+  }
+  size = HttpConnTotalSize(conn);
+  __atomic_store_n(&hdr->size, size, __ATOMIC_RELEASE);
+  LOGT(SHARED_FETCH_TAG, "fetch %s from %lld, size=%lld", sf->url,
+       (long long)offset, (long long)size);
+  while (0 < (ret = HttpConnRead(conn, buf, SHARED_COPY_SIZE))) {
+    if (0 != _append(sf, buf, ret, offset)) {
+      LOGE(SHARED_FETCH_TAG, "write cache failed");
+      ret = AVERROR(EIO);
+      break;
+    }
+    offset += ret;
+    __atomic_store_n(&hdr->written, offset, __ATOMIC_RELEASE);
+    _notify(hdr);
+  }
+  NetSessionRelease(conn);
+  if (AVERROR_EOF == ret && 0 <= size && offset < size) {
+    ret = AVERROR(EIO);
+  }
+L_END:
+  av_free(buf);
+  _set_state(hdr, AVERROR_EOF == ret ? SHARED_DONE : SHARED_FAILED);
+  return NULL;
+}
+
+static void _fetch_stop(SharedFetch *sf) {
+  if (sf->fetching) {
+    pthread_join(sf->fetch_thread, NULL);
+    sf->fetching = 0;
+  }
+}
+
+static int _fetch_start(SharedFetch *sf) {
+  _fetch_stop(sf);
+  if (SHARED_DONE == sf->hdr->state) {
+    return 0;
+  }
+  if (0 != pthread_create(&sf->fetch_thread, NULL, __shared_fetch_tsk, sf)) {
+    LOGE(SHARED_FETCH_TAG, "create fetch thread failed");
+    return -1;
+  }
+  sf->fetching = 1;
+  return 0;
+}
+
+/* lock free means nobody downloads, either never started or writer gone */
+static int _try_become_writer(SharedFetch *sf) {
+  if (0 != flock(sf->fd, LOCK_EX | LOCK_NB)) {
+    return 0;
+  }
+  sf->writer = 1;
+  if (SHARED_MAGIC != sf->hdr->magic) {
+    __atomic_store_n(&sf->hdr->size, -1, __ATOMIC_RELAXED);
+    __atomic_store_n(&sf->hdr->written, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&sf->hdr->state, SHARED_IDLE, __ATOMIC_RELAXED);
+    __atomic_store_n(&sf->hdr->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+  }
+  if (SHARED_DONE == sf->hdr->state) {
+    return 0;
+  }
+  LOGT(SHARED_FETCH_TAG, "become writer at %lld",
+       (long long)sf->hdr->written);
+  return 0 == _fetch_start(sf);
+}
+
+static int _shared_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  SharedFetch *sf = (SharedFetch *)opaque;
+  SharedHeader *hdr = sf->hdr;
+  int32_t seq, state;
+  int64_t avail;
+  int ret;
+  while (!sf->aborted) {
+    seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+    state = __atomic_load_n(&hdr->state, __ATOMIC_ACQUIRE);
+    avail = __atomic_load_n(&hdr->written, __ATOMIC_ACQUIRE) - sf->pos;
+    if (0 < avail) {
+      ret = pread(sf->fd, buf, (int)FFMIN(avail, buf_size),
+                  SHARED_HEADER_SIZE + sf->pos);
+      if (ret <= 0) {
+        return AVERROR(EIO);
+      }
+      sf->pos += ret;
+      return ret;
+    }
+    if (SHARED_DONE == state) {
+      return AVERROR_EOF;
+    }
+    if (!sf->writer) {
+      _try_become_writer(sf);
+    } else if (SHARED_FAILED == state) {
+      /* own download failed, player retries through seek */
+      return AVERROR(EIO);
+    }
+    _futex_wait(&hdr->seq, seq, SHARED_WAIT_MS);
+  }
+  return AVERROR_EOF;
+}
+
+static int64_t _shared_seek(void *opaque, int64_t offset, int whence) {
+  SharedFetch *sf = (SharedFetch *)opaque;
+  int64_t size = __atomic_load_n(&sf->hdr->size, __ATOMIC_ACQUIRE);
+  int64_t pos;
+  if (whence & AVSEEK_SIZE) {
+    return 0 <= size ? size : AVERROR(ENOSYS);
+  }
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = sf->pos + offset;
+      break;
+    case SEEK_END:
+      if (size < 0) {
+        return AVERROR(ENOSYS);
+      }
+      pos = size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  if (sf->writer && SHARED_FAILED == sf->hdr->state) {
+    _fetch_start(sf);
+  }
+  sf->pos = pos;
+  return pos;
+}
+
+static char* _cache_path(const char *url, const char *cache_dir) {
+  uint8_t md5[16];
+  char hex[33];
+  int i;
+  av_md5_sum(md5, (const uint8_t *)url, strlen(url));
+  for (i = 0; i < 16; i++) {
+    snprintf(hex + i * 2, 3, "%02x", md5[i]);
+  }
+  return av_asprintf("%s/%s.cache", cache_dir, hex);
+}
+
+SharedFetch* SharedFetchOpen(const char *url, const char *cache_dir) {
+  SharedFetch *sf;
+  unsigned char *buffer;
+  char *path = NULL;
+  if (NULL == (sf = av_mallocz(sizeof(SharedFetch)))) {
+    LOGE(SHARED_FETCH_TAG, "alloc shared fetch failed");
+    return NULL;
+  }
+  sf->fd = -1;
+  sf->int_cb.callback = _shared_interrupt_cb;
+  sf->int_cb.opaque = sf;
+  if (NULL == (sf->url = av_strdup(url)) ||
+      NULL == (path = _cache_path(url, cache_dir))) {
+    goto L_ERROR;
+  }
+  if (0 > (sf->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644))) {
+    LOGE(SHARED_FETCH_TAG, "open %s failed", path);
+    goto L_ERROR;
+  }
+  /* never shrinks, data of a running writer stays intact */
+  if (0 != posix_fallocate(sf->fd, 0, SHARED_HEADER_SIZE)) {
+    goto L_ERROR;
+  }
+  sf->hdr = mmap(NULL, SHARED_HEADER_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, sf->fd, 0);
+  if (MAP_FAILED == sf->hdr) {
+    sf->hdr = NULL;
+    goto L_ERROR;
+  }
+  if (NULL == (buffer = av_malloc(SHARED_AVIO_BUF_SIZE))) {
+    goto L_ERROR;
+  }
+  sf->avio = avio_alloc_context(buffer, SHARED_AVIO_BUF_SIZE, 0, sf,
+                                _shared_read_packet, NULL, _shared_seek);
+  if (NULL == sf->avio) {
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  _try_become_writer(sf);
+  /* seeking ahead waits for download, keep demuxer from probing the end */
+  sf->avio->seekable = (SHARED_DONE == sf->hdr->state ?
+                        AVIO_SEEKABLE_NORMAL : 0);
+  LOGT(SHARED_FETCH_TAG, "%s %s", sf->writer ? "fetch" : "attach", path);
+  av_free(path);
+  return sf;
+L_ERROR:
+  av_free(path);
+  SharedFetchClose(sf);
+  return NULL;
+}
+
+void SharedFetchClose(SharedFetch *sf) {
+  if (NULL == sf) {
+    return;
+  }
+  SharedFetchAbort(sf);
+  _fetch_stop(sf);
+  if (sf->writer) {
+    if (SHARED_DONE != sf->hdr->state) {
+      /* waiting reader gets the lock and resumes download */
+      _set_state(sf->hdr, SHARED_FAILED);
+    }
+    flock(sf->fd, LOCK_UN);
+  }
+  if (NULL != sf->avio) {
+    av_freep(&sf->avio->buffer);
+    avio_context_free(&sf->avio);
+  }
+  if (NULL != sf->hdr) {
+    munmap(sf->hdr, SHARED_HEADER_SIZE);
+  }
+  if (0 <= sf->fd) {
+    close(sf->fd);
+  }
+  av_freep(&sf->url);
+  av_free(sf);
+}
+
+AVIOContext* SharedFetchGetAVIO(SharedFetch *sf) {
+  return sf->avio;
+}
+
+int SharedFetchAbort(SharedFetch *sf) {
+  sf->aborted = 1;
+  if (NULL != sf->hdr) {
+    _notify(sf->hdr);
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_shared_fetch.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.27
+ *
+ **************************************************************************/
+#ifndef SHARED_FETCH_INC_UNI_SHARED_FETCH_H_
+#define SHARED_FETCH_INC_UNI_SHARED_FETCH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct SharedFetch SharedFetch;
+
+/**
+ * one download per url for all readers on host, threads or processes.
+ * url is fetched into cache_dir/<md5 of url>.cache by whichever opener
+ * holds the file lock, every other opener reads the growing file at its
+ * own offset. when downloader goes away a waiting reader takes over and
+ * resumes with Range. finished files are served as cache, cleaning
+ * cache_dir is up to the application
+ */
+SharedFetch* SharedFetchOpen(const char *url, const char *cache_dir);
+void         SharedFetchClose(SharedFetch *sf);
+AVIOContext* SharedFetchGetAVIO(SharedFetch *sf);
+/* make blocking read return, used on stop */
+int          SharedFetchAbort(SharedFetch *sf);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* SHARED_FETCH_INC_UNI_SHARED_FETCH_H_ */
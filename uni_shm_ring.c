@@ -0,0 +1,382 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_shm_ring.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.29
+ *
+ **************************************************************************/
+#include "uni_shm_ring.h"
+
+#include <libavutil/avstring.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include "uni_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RING_TAG         "shm_ring"
+#define SHM_RING_MAGIC       (0x53524e47)
+#define SHM_STAMP_SLOTS      (128)
+#define SHM_WAIT_MS          (100)
+
+typedef struct {
+  uint64_t pos;
+  int64_t  ns;
+} ShmStamp;
+
+/* first page of segment, same layout in every process */
+typedef struct {
+  uint32_t magic;
+  uint32_t capacity;
+  int32_t  rate;
+  int32_t  channels;
+  int32_t  bit;
+  int32_t  is_float;
+  int32_t  planar;
+  int32_t  closed;          /* producer destroyed ring */
+  int32_t  data_seq;        /* futex, consumer sleeps on it */
+  int32_t  space_seq;       /* futex, producer sleeps on it */
+  int32_t  reader_waiting;
+  int32_t  writer_waiting;
+  uint64_t write_pos __attribute__((aligned(64)));
+  uint64_t read_pos  __attribute__((aligned(64)));
+  uint64_t stamp_count __attribute__((aligned(64)));
+  ShmStamp stamps[SHM_STAMP_SLOTS];
+} ShmHeader;
+
+struct ShmRing {
+  int       fd;
+  int       producer;
+  char      *name;
+  ShmHeader *hdr;
+  uint8_t   *data;
+  size_t    map_len;
+  int       aborted;
+  AudioSink *sink;
+};
+
+static int64_t _now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _futex_wait(int32_t *addr, int32_t val, int timeout_ms) {
+  struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void _futex_wake_all(int32_t *seq) {
+  __atomic_add_fetch(seq, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* pairs with the waiting flag store in _sleep, syscall only for sleeper */
+static void _wake(int32_t *seq, int32_t *waiting) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+    _futex_wake_all(seq);
+  }
+}
+
+static uint64_t _readable(ShmHeader *hdr, uint64_t read_pos) {
+  return __atomic_load_n(&hdr->write_pos, __ATOMIC_ACQUIRE) - read_pos;
+}
+
+static uint64_t _writable(ShmHeader *hdr, uint64_t write_pos) {
+  return hdr->capacity - (write_pos -
+                          __atomic_load_n(&hdr->read_pos, __ATOMIC_ACQUIRE));
+}
+
+/* announce sleeper first, then recheck, so a wake in between is not lost */
+static void _sleep(int32_t *seq, int32_t *waiting, int (*ready)(ShmRing *),
+                   ShmRing *ring, int timeout_ms) {
+  int32_t val = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  if (!ready(ring)) {
+    _futex_wait(seq, val, timeout_ms);
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+static int _space_ready(ShmRing *ring) {
+  return ring->aborted || 0 < _writable(ring->hdr, ring->hdr->write_pos);
+}
+
+static int _drained_ready(ShmRing *ring) {
+  return ring->aborted || 0 == _readable(ring->hdr, ring->hdr->read_pos);
+}
+
+static int _data_ready(ShmRing *ring) {
+  return __atomic_load_n(&ring->hdr->closed, __ATOMIC_ACQUIRE) ||
+         0 < _readable(ring->hdr, ring->hdr->read_pos);
+}
+
+/* mmap offsets must be page aligned, 16K and 64K page kernels too */
+static size_t _header_size(void) {
+  return FFALIGN(sizeof(ShmHeader), sysconf(_SC_PAGESIZE));
+}
+
+/* header pages, data, then data again right behind it */
+static int _ring_map(ShmRing *ring, uint32_t capacity) {
+  size_t hsize = _header_size();
+  size_t len = hsize + 2 * (size_t)capacity;
+  uint8_t *base = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+  if (MAP_FAILED == base) {
+    return -1;
+  }
+  if (MAP_FAILED == mmap(base, hsize + capacity,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         ring->fd, 0) ||
+      MAP_FAILED == mmap(base + hsize + capacity, capacity,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         ring->fd, hsize)) {
+    LOGE(SHM_RING_TAG, "map ring failed[%s]", strerror(errno));
+    munmap(base, len);
+    return -1;
+  }
+  ring->hdr = (ShmHeader *)base;
+  ring->data = base + hsize;
+  ring->map_len = len;
+  return 0;
+}
+
+static int _shm_sink_open(void *opaque, const SinkFormat *format) {
+  ShmRing *ring = (ShmRing *)opaque;
+  ring->aborted = 0;
+  ring->hdr->rate = format->rate;
+  ring->hdr->channels = format->channels;
+  ring->hdr->bit = format->bit;
+  ring->hdr->is_float = format->is_float;
+  ring->hdr->planar = format->planar;
+  return 0;
+}
+
+/* copy as much as fits, double mapping makes wrap a plain memcpy */
+static int _shm_sink_write(void *opaque, const struct iovec *iov,
+                           int iovcnt) {
+  ShmRing *ring = (ShmRing *)opaque;
+  ShmHeader *hdr = ring->hdr;
+  uint64_t pos = hdr->write_pos;
+  uint8_t *dst;
+  int64_t space;
+  int i, len, total = 0;
+  while (0 == (space = _writable(hdr, pos))) {
+    if (ring->aborted) {
+      return -1;
+    }
+    _sleep(&hdr->space_seq, &hdr->writer_waiting, _space_ready, ring,
+           SHM_WAIT_MS);
+  }
+  dst = ring->data + pos % hdr->capacity;
+  for (i = 0; i < iovcnt && total < space; i++) {
+    len = FFMIN(iov[i].iov_len, space - total);
+    memcpy(dst + total, iov[i].iov_base, len);
+    total += len;
+  }
+  hdr->stamps[hdr->stamp_count % SHM_STAMP_SLOTS].pos = pos;
+  hdr->stamps[hdr->stamp_count % SHM_STAMP_SLOTS].ns = _now_ns();
+  __atomic_store_n(&hdr->stamp_count, hdr->stamp_count + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&hdr->write_pos, pos + total, __ATOMIC_RELEASE);
+  _wake(&hdr->data_seq, &hdr->reader_waiting);
+  return total;
+}
+
+static int _shm_sink_drain(void *opaque) {
+  ShmRing *ring = (ShmRing *)opaque;
+  while (!_drained_ready(ring)) {
+    _sleep(&ring->hdr->space_seq, &ring->hdr->writer_waiting,
+           _drained_ready, ring, SHM_WAIT_MS);
+  }
+  return ring->aborted ? -1 : 0;
+}
+
+static void _shm_sink_abort(void *opaque) {
+  ShmRing *ring = (ShmRing *)opaque;
+  ring->aborted = 1;
+  _futex_wake_all(&ring->hdr->space_seq);
+}
+
+static const AudioSinkOps g_shm_sink_ops = {
+  .name  = "shm_ring",
+  .open  = _shm_sink_open,
+  .write = _shm_sink_write,
+  .drain = _shm_sink_drain,
+  .abort = _shm_sink_abort,
+};
+
+ShmRing* ShmRingCreate(const char *name, int capacity) {
+  ShmRing *ring;
+  long page = sysconf(_SC_PAGESIZE);
+  if (NULL == (ring = av_mallocz(sizeof(ShmRing)))) {
+    LOGE(SHM_RING_TAG, "alloc shm ring failed");
+    return NULL;
+  }
+  ring->producer = 1;
+  /* second mapping must start on a page */
+  capacity = FFALIGN(FFMAX(capacity, 1), page);
+  if (NULL != name) {
+    ring->name = av_strdup(name);
+    ring->fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  } else {
+    ring->fd = syscall(SYS_memfd_create, "uni_shm_ring", MFD_CLOEXEC);
+  }
+  if (ring->fd < 0) {
+    LOGE(SHM_RING_TAG, "create segment failed[%s]", strerror(errno));
+    goto L_ERROR;
+  }
+  if (0 != ftruncate(ring->fd, _header_size() + capacity) ||
+      0 != _ring_map(ring, capacity)) {
+    LOGE(SHM_RING_TAG, "size segment %d failed", capacity);
+    goto L_ERROR;
+  }
+  ring->hdr->capacity = capacity;
+  __atomic_store_n(&ring->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+  if (NULL == (ring->sink = AudioSinkCreate(&g_shm_sink_ops, ring))) {
+    goto L_ERROR;
+  }
+  LOGT(SHM_RING_TAG, "ring %s, capacity=%d", NULL != name ? name : "memfd",
+       capacity);
+  return ring;
+L_ERROR:
+  ShmRingDestroy(ring);
+  return NULL;
+}
+
+ShmRing* ShmRingAttach(int fd) {
+  ShmRing *ring;
+  ShmHeader *hdr;
+  uint32_t capacity = 0;
+  if (NULL == (ring = av_mallocz(sizeof(ShmRing)))) {
+    return NULL;
+  }
+  ring->fd = fd;
+  hdr = mmap(NULL, sizeof(ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+  if (MAP_FAILED != hdr) {
+    if (SHM_RING_MAGIC == __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE)) {
+      capacity = hdr->capacity;
+    }
+    munmap(hdr, sizeof(ShmHeader));
+  }
+  if (0 == capacity || 0 != _ring_map(ring, capacity)) {
+    LOGE(SHM_RING_TAG, "fd %d is no shm ring", fd);
+    ShmRingDestroy(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+void ShmRingDestroy(ShmRing *ring) {
+  if (NULL == ring) {
+    return;
+  }
+  if (NULL != ring->hdr && ring->producer) {
+    __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_RELEASE);
+    _futex_wake_all(&ring->hdr->data_seq);
+  }
+  AudioSinkDestroy(ring->sink);
+  if (NULL != ring->hdr) {
+    munmap(ring->hdr, ring->map_len);
+  }
+  if (0 <= ring->fd) {
+    close(ring->fd);
+  }
+  if (NULL != ring->name) {
+    /* attached consumers keep their mapping */
+    shm_unlink(ring->name);
+    av_free(ring->name);
+  }
+  av_free(ring);
+}
+
+int ShmRingGetFd(ShmRing *ring) {
+  return ring->fd;
+}
+
+AudioSink* ShmRingGetSink(ShmRing *ring) {
+  return ring->sink;
+}
+
+int ShmRingGetFormat(ShmRing *ring, SinkFormat *format) {
+  format->rate = ring->hdr->rate;
+  format->channels = ring->hdr->channels;
+  format->bit = ring->hdr->bit;
+  format->is_float = ring->hdr->is_float;
+  format->planar = ring->hdr->planar;
+  return 0 < format->rate ? 0 : -1;
+}
+
+int ShmRingPeek(ShmRing *ring, const uint8_t **data, int timeout_ms) {
+  ShmHeader *hdr = ring->hdr;
+  uint64_t pos = hdr->read_pos, avail;
+  int64_t until_ns = _now_ns() + (int64_t)timeout_ms * 1000000;
+  int64_t left_ms;
+  while (0 == (avail = _readable(hdr, pos))) {
+    if (__atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE)) {
+      return -1;
+    }
+    if (0 >= (left_ms = (until_ns - _now_ns()) / 1000000)) {
+      return 0;
+    }
+    _sleep(&hdr->data_seq, &hdr->reader_waiting, _data_ready, ring,
+           (int)FFMIN(left_ms, SHM_WAIT_MS));
+  }
+  *data = ring->data + pos % hdr->capacity;
+  return (int)avail;
+}
+
+int ShmRingRelease(ShmRing *ring, int len) {
+  ShmHeader *hdr = ring->hdr;
+  if (len < 0 || (uint64_t)len > _readable(hdr, hdr->read_pos)) {
+    return -1;
+  }
+  __atomic_store_n(&hdr->read_pos, hdr->read_pos + len, __ATOMIC_RELEASE);
+  _wake(&hdr->space_seq, &hdr->writer_waiting);
+  return 0;
+}
+
+uint64_t ShmRingReadPos(ShmRing *ring) {
+  return ring->hdr->read_pos;
+}
+
+int64_t ShmRingTimestamp(ShmRing *ring, uint64_t pos) {
+  ShmHeader *hdr = ring->hdr;
+  uint64_t count = __atomic_load_n(&hdr->stamp_count, __ATOMIC_ACQUIRE);
+  int64_t bytes_per_sec = (int64_t)hdr->rate * hdr->channels * hdr->bit / 8;
+  ShmStamp *stamp;
+  uint64_t i;
+  /* oldest slot may be under rewrite, leave it out */
+  for (i = count; 0 < i && count - i < SHM_STAMP_SLOTS - 1; i--) {
+    stamp = &hdr->stamps[(i - 1) % SHM_STAMP_SLOTS];
+    if (stamp->pos <= pos) {
+      return stamp->ns + (0 < bytes_per_sec ?
+             (int64_t)(pos - stamp->pos) * 1000000000 / bytes_per_sec : 0);
+    }
+  }
+  return -1;
+}
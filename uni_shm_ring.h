@@ -0,0 +1,69 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_shm_ring.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.29
+ *
+ **************************************************************************/
+#ifndef SHM_RING_INC_UNI_SHM_RING_H_
+#define SHM_RING_INC_UNI_SHM_RING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "uni_audio_sink.h"
+#include <stdint.h>
+
+typedef struct ShmRing ShmRing;
+
+/**
+ * single producer single consumer pcm ring in a memfd or shm_open segment.
+ * data pages are mapped twice back to back, so consumer reads any span in
+ * place even across wrap. positions are byte counters that never wrap,
+ * futex wake-ups cost a syscall only when the other side sleeps
+ */
+
+/* producer side, name NULL makes an anonymous memfd, capacity in bytes */
+ShmRing*   ShmRingCreate(const char *name, int capacity);
+/* consumer side, takes fd got from ShmRingGetFd by SCM_RIGHTS or fork */
+ShmRing*   ShmRingAttach(int fd);
+void       ShmRingDestroy(ShmRing *ring);
+int        ShmRingGetFd(ShmRing *ring);
+/* player facing sink, write blocks while ring full, ring outlives sink */
+AudioSink* ShmRingGetSink(ShmRing *ring);
+
+/* stream format last written by producer */
+int        ShmRingGetFormat(ShmRing *ring, SinkFormat *format);
+/**
+ * wait up to timeout_ms for data, *data points at readable bytes in the
+ * mapping. return readable bytes, 0 timeout, -1 producer gone and empty
+ */
+int        ShmRingPeek(ShmRing *ring, const uint8_t **data, int timeout_ms);
+/* hand len bytes back to producer */
+int        ShmRingRelease(ShmRing *ring, int len);
+/* byte counter of next unread byte */
+uint64_t   ShmRingReadPos(ShmRing *ring);
+/* CLOCK_MONOTONIC ns when byte pos was written, -1 when stamp overwritten */
+int64_t    ShmRingTimestamp(ShmRing *ring, uint64_t pos);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* SHM_RING_INC_UNI_SHM_RING_H_ */
@@ -0,0 +1,545 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_uring_io.c
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.20
+ *
+ **************************************************************************/
+#include "uni_uring_io.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+#include "uni_log.h"
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#define URING_SUPPORTED
+#endif
+#endif
+
+#define URING_IO_TAG          "uring_io"
+#define URING_AVIO_BUF_SIZE   (32 * 1024)
+
+typedef enum {
+  BLOCK_FREE = 0,
+  BLOCK_INFLIGHT,
+  BLOCK_READY
+} BlockState;
+
+typedef struct {
+  UringFile    *file;
+  uint8_t      *buf;
+  struct iovec iov;
+  int64_t      offset;
+  int          res;
+  BlockState   state;
+} UringBlock;
+
+struct UringFile {
+  UringReader     *reader;
+  int             fd;
+  int64_t         size;
+  int64_t         pos;
+  int             inflight;
+  UringBlock      *blocks;
+  AVIOContext     *avio;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+};
+
+typedef struct {
+  int                 fd;
+  unsigned            entries;
+  unsigned            cq_entries;
+  unsigned            outstanding;
+  unsigned            *sq_head;
+  unsigned            *sq_tail;
+  unsigned            *sq_mask;
+  unsigned            *sq_array;
+  unsigned            *cq_head;
+  unsigned            *cq_tail;
+  unsigned            *cq_mask;
+#ifdef URING_SUPPORTED
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+#endif
+  void                *sq_ptr;
+  size_t              sq_len;
+  void                *cq_ptr;
+  size_t              cq_len;
+  size_t              sqes_len;
+} Ring;
+
+struct UringReader {
+  Ring            ring;
+  int             block_size;
+  int             blocks_per_file;
+  int             running;
+  pthread_t       reap_thread;
+  pthread_mutex_t ring_mutex;
+};
+
+#ifdef URING_SUPPORTED
+static int _ring_setup(Ring *ring, int queue_depth) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  if (0 > (ring->fd = syscall(__NR_io_uring_setup, queue_depth, &p))) {
+    return -1;
+  }
+  ring->entries = p.sq_entries;
+  ring->cq_entries = p.cq_entries;
+  ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->sq_len = ring->cq_len = FFMAX(ring->sq_len, ring->cq_len);
+  }
+  ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (MAP_FAILED == ring->sq_ptr) {
+    goto L_ERROR;
+  }
+  ring->cq_ptr = ring->sq_ptr;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (MAP_FAILED == ring->cq_ptr) {
+      goto L_ERROR;
+    }
+  }
+  ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (MAP_FAILED == ring->sqes) {
+    goto L_ERROR;
+  }
+  ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+  ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+  return 0;
+L_ERROR:
+  LOGW(URING_IO_TAG, "io_uring mmap failed[%s]", strerror(errno));
+  if (MAP_FAILED != ring->cq_ptr && NULL != ring->cq_ptr &&
+      ring->cq_ptr != ring->sq_ptr) {
+    munmap(ring->cq_ptr, ring->cq_len);
+  }
+  if (MAP_FAILED != ring->sq_ptr && NULL != ring->sq_ptr) {
+    munmap(ring->sq_ptr, ring->sq_len);
+  }
+  close(ring->fd);
+  memset(ring, 0, sizeof(Ring));
+  ring->fd = -1;
+  return -1;
+}
+
+static void _ring_release(Ring *ring) {
+  if (ring->fd < 0) {
+    return;
+  }
+  munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_ptr != ring->sq_ptr) {
+    munmap(ring->cq_ptr, ring->cq_len);
+  }
+  munmap(ring->sq_ptr, ring->sq_len);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+/**
+ * caller holds ring_mutex, user_data NULL is the shutdown nop. only queues,
+ * _ring_enter submits. reads in flight are capped at cq size, kernels
+ * without IORING_FEAT_NODROP drop overflowing completions and readers would
+ * wait forever. the nop goes past the cap, pending reads wake reaper anyway
+ */
+static int _ring_queue(Ring *ring, uint8_t opcode, int fd,
+                       struct iovec *iov, int64_t offset, void *user_data) {
+  struct io_uring_sqe *sqe;
+  unsigned tail = *ring->sq_tail, index;
+  if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+      ring->entries ||
+      (NULL != user_data && ring->outstanding >= ring->cq_entries)) {
+    return -1;
+  }
+  index = tail & *ring->sq_mask;
+  sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)iov;
+  sqe->len = (NULL != iov);
+  sqe->off = offset;
+  sqe->user_data = (uintptr_t)user_data;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->outstanding++;
+  return 0;
+}
+
+/* one doorbell for a whole fill pass, caller holds ring_mutex */
+static void _ring_enter(Ring *ring, unsigned count) {
+  int ret;
+  /* sqes are queued once tail moves, only retry the doorbell */
+  while (0 < count) {
+    ret = syscall(__NR_io_uring_enter, ring->fd, count, 0, 0, NULL, 0);
+    if (0 < ret) {
+      count -= FFMIN((unsigned)ret, count);
+    } else if (ret < 0 && EINTR != errno && EAGAIN != errno) {
+      LOGE(URING_IO_TAG, "io_uring submit failed[%s]", strerror(errno));
+      break;
+    }
+  }
+}
+
+static void _complete_block(UringBlock *block, int res) {
+  UringFile *file = block->file;
+  pthread_mutex_lock(&file->mutex);
+  block->res = res;
+  block->state = BLOCK_READY;
+  file->inflight--;
+  pthread_cond_broadcast(&file->cond);
+  pthread_mutex_unlock(&file->mutex);
+}
+
+static void* __uring_reap_tsk(void *args) {
+  UringReader *reader = (UringReader *)args;
+  Ring *ring = &reader->ring;
+  struct io_uring_cqe *cqe;
+  unsigned head, reaped;
+  while (reader->running) {
+    if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0 && EINTR != errno) {
+      LOGE(URING_IO_TAG, "io_uring_enter failed[%s]", strerror(errno));
+      break;
+    }
+    head = *ring->cq_head;
+    reaped = 0;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = &ring->cqes[head & *ring->cq_mask];
+      if (0 != cqe->user_data) {
+        _complete_block((UringBlock *)(uintptr_t)cqe->user_data, cqe->res);
+      }
+      head++;
+      reaped++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&reader->ring_mutex);
+    ring->outstanding -= reaped;
+    pthread_mutex_unlock(&reader->ring_mutex);
+  }
+  return NULL;
+}
+#endif
+
+/* caller holds file mutex, 1 when queued on ring and awaits doorbell */
+static int _submit_block(UringFile *file, UringBlock *block,
+                         int64_t offset) {
+  UringReader *reader = file->reader;
+  block->offset = offset;
+  block->iov.iov_base = block->buf;
+  block->iov.iov_len = (size_t)FFMIN(reader->block_size, file->size - offset);
+  block->state = BLOCK_INFLIGHT;
+#ifdef URING_SUPPORTED
+  if (0 <= reader->ring.fd) {
+    int ret;
+    pthread_mutex_lock(&reader->ring_mutex);
+    ret = _ring_queue(&reader->ring, IORING_OP_READV, file->fd, &block->iov,
+                      offset, block);
+    pthread_mutex_unlock(&reader->ring_mutex);
+    if (0 == ret) {
+      file->inflight++;
+      return 1;
+    }
+  }
+#endif
+  /* no ring or ring full, read in place */
+  block->res = pread(file->fd, block->buf, block->iov.iov_len, offset);
+  block->res = block->res < 0 ? -errno : block->res;
+  block->state = BLOCK_READY;
+  return 0;
+}
+
+static UringBlock* _find_block(UringFile *file, int64_t offset) {
+  int i;
+  for (i = 0; i < file->reader->blocks_per_file; i++) {
+    if (BLOCK_FREE != file->blocks[i].state &&
+        offset == file->blocks[i].offset) {
+      return &file->blocks[i];
+    }
+  }
+  return NULL;
+}
+
+/* free block, or a ready one fallen out of window [base, end) */
+static UringBlock* _reusable_block(UringFile *file, int64_t base,
+                                   int64_t end) {
+  UringBlock *block;
+  int i;
+  for (i = 0; i < file->reader->blocks_per_file; i++) {
+    block = &file->blocks[i];
+    if (BLOCK_FREE == block->state ||
+        (BLOCK_READY == block->state &&
+         (block->offset < base || block->offset >= end))) {
+      return block;
+    }
+  }
+  return NULL;
+}
+
+static void _fill_ahead(UringFile *file) {
+  UringReader *reader = file->reader;
+  int64_t base = file->pos - file->pos % reader->block_size;
+  int64_t end = base + (int64_t)reader->block_size * reader->blocks_per_file;
+  int64_t offset;
+  UringBlock *block;
+  unsigned queued = 0;
+  if (file->pos >= file->size) {
+    return;
+  }
+  for (offset = base; offset < end && offset < file->size;
+       offset += reader->block_size) {
+    if (NULL != _find_block(file, offset)) {
+      continue;
+    }
+    if (NULL == (block = _reusable_block(file, base, end))) {
+      break;
+    }
+    queued += _submit_block(file, block, offset);
+  }
+#ifdef URING_SUPPORTED
+  if (0 < queued) {
+    pthread_mutex_lock(&reader->ring_mutex);
+    _ring_enter(&reader->ring, queued);
+    pthread_mutex_unlock(&reader->ring_mutex);
+  }
+#endif
+}
+
+static int _uring_read_packet(void *opaque, uint8_t *buf, int buf_size) {
+  UringFile *file = (UringFile *)opaque;
+  UringBlock *block;
+  int64_t offset;
+  int skip, len;
+  pthread_mutex_lock(&file->mutex);
+  if (file->pos >= file->size) {
+    pthread_mutex_unlock(&file->mutex);
+    return AVERROR_EOF;
+  }
+  offset = file->pos - file->pos % file->reader->block_size;
+  _fill_ahead(file);
+  while (NULL == (block = _find_block(file, offset)) ||
+         BLOCK_INFLIGHT == block->state) {
+    if (NULL == block) {
+      _fill_ahead(file);
+      if (NULL != _find_block(file, offset)) {
+        continue;
+      }
+    }
+    pthread_cond_wait(&file->cond, &file->mutex);
+  }
+  skip = (int)(file->pos - offset);
+  if (block->res <= skip) {
+    pthread_mutex_unlock(&file->mutex);
+    LOGE(URING_IO_TAG, "read at %lld failed[%d]", (long long)offset,
+         block->res);
+    return block->res < 0 ? block->res : AVERROR(EIO);
+  }
+  len = FFMIN(buf_size, block->res - skip);
+  memcpy(buf, block->buf + skip, len);
+  file->pos += len;
+  if (skip + len == block->res) {
+    block->state = BLOCK_FREE;
+    _fill_ahead(file);
+  }
+  pthread_mutex_unlock(&file->mutex);
+  return len;
+}
+
+static int64_t _uring_seek(void *opaque, int64_t offset, int whence) {
+  UringFile *file = (UringFile *)opaque;
+  int64_t pos;
+  if (whence & AVSEEK_SIZE) {
+    return file->size;
+  }
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = file->pos + offset;
+      break;
+    case SEEK_END:
+      pos = file->size + offset;
+      break;
+    default:
+      return AVERROR(EINVAL);
+  }
+  if (pos < 0) {
+    return AVERROR(EINVAL);
+  }
+  pthread_mutex_lock(&file->mutex);
+  file->pos = pos;
+  pthread_mutex_unlock(&file->mutex);
+  return pos;
+}
+
+UringReader* UringReaderCreate(int queue_depth, int block_size,
+                               int blocks_per_file) {
+  UringReader *reader;
+  if (NULL == (reader = av_mallocz(sizeof(UringReader)))) {
+    LOGE(URING_IO_TAG, "alloc uring reader failed");
+    return NULL;
+  }
+  reader->block_size = block_size;
+  reader->blocks_per_file = FFMAX(1, blocks_per_file);
+  reader->ring.fd = -1;
+  pthread_mutex_init(&reader->ring_mutex, NULL);
+#ifdef URING_SUPPORTED
+  if (0 == _ring_setup(&reader->ring, queue_depth)) {
+    reader->running = 1;
+    if (0 != pthread_create(&reader->reap_thread, NULL, __uring_reap_tsk,
+                            reader)) {
+      reader->running = 0;
+      _ring_release(&reader->ring);
+    }
+  }
+#endif
+  if (reader->ring.fd < 0) {
+    LOGW(URING_IO_TAG, "io_uring unavailable, fallback to pread");
+  }
+  return reader;
+}
+
+void UringReaderDestroy(UringReader *reader) {
+  if (NULL == reader) {
+    return;
+  }
+#ifdef URING_SUPPORTED
+  if (reader->running) {
+    reader->running = 0;
+    pthread_mutex_lock(&reader->ring_mutex);
+    if (0 == _ring_queue(&reader->ring, IORING_OP_NOP, -1, NULL, 0, NULL)) {
+      _ring_enter(&reader->ring, 1);
+    }
+    pthread_mutex_unlock(&reader->ring_mutex);
+    pthread_join(reader->reap_thread, NULL);
+  }
+  _ring_release(&reader->ring);
+#endif
+  pthread_mutex_destroy(&reader->ring_mutex);
+  av_free(reader);
+}
+
+static void _free_file(UringFile *file) {
+  int i;
+  if (NULL != file->avio) {
+    av_freep(&file->avio->buffer);
+    avio_context_free(&file->avio);
+  }
+  for (i = 0; NULL != file->blocks && i < file->reader->blocks_per_file;
+       i++) {
+    av_free(file->blocks[i].buf);
+  }
+  av_freep(&file->blocks);
+  if (0 <= file->fd) {
+    close(file->fd);
+  }
+  pthread_cond_destroy(&file->cond);
+  pthread_mutex_destroy(&file->mutex);
+  av_free(file);
+}
+
+UringFile* UringReaderOpen(UringReader *reader, const char *path) {
+  UringFile *file;
+  unsigned char *buffer;
+  struct stat st;
+  int i;
+  if (NULL == (file = av_mallocz(sizeof(UringFile)))) {
+    return NULL;
+  }
+  file->reader = reader;
+  pthread_mutex_init(&file->mutex, NULL);
+  pthread_cond_init(&file->cond, NULL);
+  if (0 > (file->fd = open(path, O_RDONLY | O_CLOEXEC)) ||
+      0 != fstat(file->fd, &st)) {
+    LOGE(URING_IO_TAG, "open %s failed[%s]", path, strerror(errno));
+    goto L_ERROR;
+  }
+  file->size = st.st_size;
+  posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (NULL == (file->blocks = av_mallocz_array(reader->blocks_per_file,
+                                               sizeof(UringBlock)))) {
+    goto L_ERROR;
+  }
+  for (i = 0; i < reader->blocks_per_file; i++) {
+    file->blocks[i].file = file;
+    if (NULL == (file->blocks[i].buf = av_malloc(reader->block_size))) {
+      goto L_ERROR;
+    }
+  }
+  if (NULL == (buffer = av_malloc(URING_AVIO_BUF_SIZE))) {
+    goto L_ERROR;
+  }
+  file->avio = avio_alloc_context(buffer, URING_AVIO_BUF_SIZE, 0, file,
+                                  _uring_read_packet, NULL, _uring_seek);
+  if (NULL == file->avio) {
+    av_free(buffer);
+    goto L_ERROR;
+  }
+  /* queue read-ahead now, data is in flight before demuxer asks */
+  pthread_mutex_lock(&file->mutex);
+  _fill_ahead(file);
+  pthread_mutex_unlock(&file->mutex);
+  return file;
+L_ERROR:
+  _free_file(file);
+  return NULL;
+}
+
+void UringReaderClose(UringFile *file) {
+  if (NULL == file) {
+    return;
+  }
+  /* kernel still writes into block buffers until completion */
+  pthread_mutex_lock(&file->mutex);
+  while (0 < file->inflight) {
+    pthread_cond_wait(&file->cond, &file->mutex);
+  }
+  pthread_mutex_unlock(&file->mutex);
+  _free_file(file);
+}
+
+AVIOContext* UringFileGetAVIO(UringFile *file) {
+  return file->avio;
+}
@@ -0,0 +1,53 @@
+/**************************************************************************
+ * Copyright (C) 2018-2019  Junlon2006
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ **************************************************************************
+ *
+ * Description : uni_uring_io.h
+ * Author      : junlon2006@163.com
+ * Date        : 2019.04.20
+ *
+ **************************************************************************/
+#ifndef URING_IO_INC_UNI_URING_IO_H_
+#define URING_IO_INC_UNI_URING_IO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavformat/avio.h>
+
+typedef struct UringReader UringReader;
+typedef struct UringFile   UringFile;
+
+/**
+ * one io_uring shared by all files opened on reader, each file keeps
+ * blocks_per_file reads of block_size in flight ahead of its demuxer.
+ * falls back to pread when kernel has no io_uring
+ */
+UringReader* UringReaderCreate(int queue_depth, int block_size,
+                               int blocks_per_file);
+void         UringReaderDestroy(UringReader *reader);
+
+UringFile*   UringReaderOpen(UringReader *reader, const char *path);
+/* waits for in-flight reads of file, then frees it */
+void         UringReaderClose(UringFile *file);
+AVIOContext* UringFileGetAVIO(UringFile *file);
+
+#ifdef __cplusplus
+}   /* __cplusplus */
+#endif
+#endif  /* URING_IO_INC_UNI_URING_IO_H_ */